@@ -0,0 +1,637 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>           // For isalnum
+#include <signal.h>
+#include <netinet/in.h>      // For AF_INET/AF_INET6
+#include <sys/wait.h>        // For WIFEXITED, WEXITSTATUS
+#include <net/if.h>          // For if_nametoindex
+#include <linux/rtnetlink.h> // For RTM_NEWROUTE/RTM_DELROUTE
+#include <linux/if_link.h>   // For XDP_FLAGS_*
+
+#include "ipban.h"
+
+#define NFT_COMMAND "nft -f -"
+#define IPSET_COMMAND "ipset -exist restore"
+#define IPSET_MIN_MAXELEM 65536
+#define ELEMENTS_PER_LINE 1024 // Keep generated lines reasonably short
+#define BPF_PIN_ROOT "/sys/fs/bpf" // bpffs; the xdp backend pins its maps in <root>/<set_name>
+
+// --- Enforcement backends ---
+//
+// All backends receive the same desired IPv4/IPv6 prefix lists (sorted, unique
+// and usually aggregated). `delta` is what changed since the backend was last
+// given a set by this process, or NULL when the current state is unknown and a
+// full sync is needed.
+
+// --- FIB blackhole routes (rtnetlink) ---
+//
+// Every route is added with rtm_protocol = route_protocol, and deletes and dumps
+// ask for it too: only our own blackholes are ever reconciled or removed, and a
+// route installed by anything else is left alone. Routes go to the main table,
+// or to route_table, which a policy rule at rule_priority makes the lookup use.
+
+// --- Table swap (route backend with swap_tables) ---
+//
+// The blackholes live in one of two dedicated tables, selected by the policy
+// rule "priority <rule_priority> lookup <table>". A full sync fills the other
+// (staging) table while the active one keeps blocking, adds a rule for it and
+// then deletes the old rule, so the new set takes effect in one step; while both
+// rules exist the union of both sets is blocked. The old table is flushed last.
+
+#define MAX_RULES 8
+
+// Find the swap table the rule currently points to (0 if none). tables/count
+// receive all tables looked up at the rule priority. Returns 0 or -1.
+static int find_active_table(Backend *backend, int family, uint32_t *tables, int *count, uint32_t *active) {
+    *count = nl_rule_tables(&backend->nl, family, backend->rule_priority, tables, MAX_RULES);
+    if (*count == -1) return -1;
+    *active = 0;
+    for (int i = 0; i < *count && !*active; i++) {
+        if (tables[i] == backend->swap_tables[0] || tables[i] == backend->swap_tables[1]) *active = tables[i];
+    }
+    return 0;
+}
+
+// Delete all our blackholes from a table, dumping again if ACKs were lost
+static int flush_table(NlSocket *nl, uint32_t table, int family, const char *label) {
+    int ret = 0;
+    nl->table = table;
+    for (int attempt = 0; attempt < RESYNC_ATTEMPTS; attempt++) {
+        PrefixList installed;
+        init_prefix_list(&installed, 1024);
+        nl->acks_lost = 0;
+        ret = nl_dump_blackholes(nl, family, &installed);
+        if (ret == 0 && installed.count > 0) {
+            log_info("%s: flushing %zu routes from table %u\n", label, installed.count, table);
+            ret = apply_prefixes(nl, RTM_DELROUTE, &installed, label);
+        }
+        free_prefix_list(&installed);
+        if (!nl->acks_lost) break;
+    }
+    return ret;
+}
+
+static int swap_family(Backend *backend, int f, const PrefixList *desired) {
+    int family = f == 0 ? AF_INET : AF_INET6;
+    const char *label = backend->label[f];
+    NlSocket *nl = &backend->nl;
+    uint32_t tables[MAX_RULES], active;
+    int count;
+    if (find_active_table(backend, family, tables, &count, &active) == -1) return -1;
+    uint32_t staging = active == backend->swap_tables[0] ? backend->swap_tables[1] : backend->swap_tables[0];
+
+    // Start from an empty staging table; an interrupted run may have left routes in it
+    if (flush_table(nl, staging, family, label) == -1) return -1;
+    log_info("%s: %zu desired, loading table %u\n", label, desired->count, staging);
+    nl->table = staging;
+    nl->acks_lost = 0;
+    int ret = apply_prefixes(nl, RTM_NEWROUTE, desired, label);
+    // Which adds made it is unknown: compare with a dump of the staging table
+    if (ret == -1 && nl->acks_lost) ret = reconcile_routes(nl, family, desired, label);
+    if (ret == -1) {
+        log_error("Could not fill %s table %u, table %u stays active.\n", label, staging, active);
+        return -1;
+    }
+
+    double start = stats_now();
+    if (nl_rule(nl, RTM_NEWRULE, family, backend->rule_priority, staging) == -1) return -1;
+    for (int i = 0; i < count; i++) {
+        if (tables[i] != staging && (tables[i] == backend->swap_tables[0] || tables[i] == backend->swap_tables[1])) {
+            if (nl_rule(nl, RTM_DELRULE, family, backend->rule_priority, tables[i]) == -1) return -1;
+        }
+    }
+    stats_phase(f == 0 ? "swap_ipv4" : "swap_ipv6", start, desired->count);
+    backend->active_table[f] = staging;
+    log_info("%s: rule priority %u now looks up table %u\n", label, backend->rule_priority, staging);
+
+    if (active && flush_table(nl, active, family, label) == -1) {
+        log_warn("Could not flush the previous %s table %u.\n", label, active);
+    }
+    return 0;
+}
+
+// Make the rule "priority <rule_priority> lookup <route_table>" exist for family
+static int add_table_rule(Backend *backend, int f) {
+    if (backend->rule_added & (1 << f)) return 0;
+    if (nl_rule(&backend->nl, RTM_NEWRULE, f == 0 ? AF_INET : AF_INET6, backend->rule_priority,
+                backend->route_table) == -1) {
+        return -1;
+    }
+    backend->rule_added |= 1 << f;
+    log_info("%s: rule priority %u looks up table %u\n", backend->label[f], backend->rule_priority, backend->route_table);
+    return 0;
+}
+
+static int route_apply(Backend *backend, const PrefixList *desired[2], const PrefixDelta *delta) {
+    int failed = 0;
+    for (int f = 0; f < 2; f++) {
+        if (backend->swap_tables[0] && (!delta || !backend->active_table[f])) {
+            if (swap_family(backend, f, desired[f]) == -1) failed = 1;
+            continue;
+        }
+        if (!backend->swap_tables[0] && backend->route_table != RT_TABLE_MAIN && add_table_rule(backend, f) == -1) {
+            failed = 1;
+        }
+        // Deltas go straight into the active (or configured) table
+        backend->nl.table = backend->swap_tables[0] ? backend->active_table[f] : backend->route_table;
+        if (!delta) {
+            if (reconcile_routes(&backend->nl, f == 0 ? AF_INET : AF_INET6, desired[f], backend->label[f]) == -1) failed = 1;
+            continue;
+        }
+        const PrefixList *to_add = &delta->add[f], *to_remove = &delta->remove[f];
+        log_info("%s: %zu desired, %zu to add, %zu to remove\n", backend->label[f], desired[f]->count, to_add->count, to_remove->count);
+        backend->nl.acks_lost = 0;
+        int ret = apply_prefixes(&backend->nl, RTM_NEWROUTE, to_add, backend->label[f]);
+        if (apply_prefixes(&backend->nl, RTM_DELROUTE, to_remove, backend->label[f]) == -1) ret = -1;
+        // The outcome of some requests is unknown: resync the family from a dump
+        if (ret == -1 && backend->nl.acks_lost) {
+            ret = reconcile_routes(&backend->nl, f == 0 ? AF_INET : AF_INET6, desired[f], backend->label[f]);
+        }
+        if (ret == -1) failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+static int route_check(Backend *backend, const PrefixList *desired[2], CheckResult result[2]) {
+    for (int f = 0; f < 2; f++) {
+        backend->nl.table = backend->route_table;
+        if (!backend->swap_tables[0] && backend->route_table != RT_TABLE_MAIN) {
+            uint32_t tables[MAX_RULES];
+            int count = nl_rule_tables(&backend->nl, f == 0 ? AF_INET : AF_INET6, backend->rule_priority, tables, MAX_RULES);
+            if (count == -1) return -1;
+            int found = 0;
+            for (int i = 0; i < count && !found; i++) found = tables[i] == backend->route_table;
+            if (!found) {
+                log_warn("No %s rule at priority %u points to table %u.\n", backend->label[f],
+                         backend->rule_priority, backend->route_table);
+                result[f].expected = result[f].missing = desired[f]->count;
+                continue;
+            }
+        }
+        if (backend->swap_tables[0]) {
+            uint32_t tables[MAX_RULES];
+            int count;
+            if (find_active_table(backend, f == 0 ? AF_INET : AF_INET6, tables, &count, &backend->nl.table) == -1) {
+                return -1;
+            }
+            if (!backend->nl.table) {
+                log_warn("No %s rule at priority %u points to table %u or %u.\n", backend->label[f],
+                         backend->rule_priority, backend->swap_tables[0], backend->swap_tables[1]);
+                result[f].expected = result[f].missing = desired[f]->count;
+                continue;
+            }
+        }
+        if (check_routes(&backend->nl, f == 0 ? AF_INET : AF_INET6, desired[f], &result[f]) == -1) return -1;
+    }
+    return 0;
+}
+
+// Remove our rules, then our routes: from both swap tables, or from route_table.
+// Since the dumps only return routes of our protocol, this is one pass over
+// what we installed, not over the whole table.
+static int route_flush(Backend *backend) {
+    NlSocket *nl = &backend->nl;
+    uint32_t ours[2] = { backend->route_table, 0 };
+    if (backend->swap_tables[0]) {
+        ours[0] = backend->swap_tables[0];
+        ours[1] = backend->swap_tables[1];
+    }
+    int failed = 0;
+    for (int f = 0; f < 2; f++) {
+        int family = f == 0 ? AF_INET : AF_INET6;
+        if (ours[0] != RT_TABLE_MAIN) {
+            uint32_t tables[MAX_RULES];
+            int count = nl_rule_tables(nl, family, backend->rule_priority, tables, MAX_RULES);
+            if (count == -1) failed = 1;
+            for (int i = 0; i < count; i++) {
+                if (tables[i] != ours[0] && tables[i] != ours[1]) continue;
+                if (nl_rule(nl, RTM_DELRULE, family, backend->rule_priority, tables[i]) == -1) {
+                    failed = 1;
+                    continue;
+                }
+                log_info("%s: removed rule priority %u lookup %u\n", backend->label[f], backend->rule_priority, tables[i]);
+            }
+        }
+        for (int t = 0; t < 2 && ours[t]; t++) {
+            if (flush_table(nl, ours[t], family, backend->label[f]) == -1) failed = 1;
+        }
+        backend->active_table[f] = 0;
+    }
+    backend->rule_added = 0;
+    return failed ? -1 : 0;
+}
+
+static void route_close(Backend *backend) {
+    nl_close(&backend->nl);
+}
+
+// --- XDP drop program (xdp backend) ---
+//
+// The prefixes live in two LPM trie maps read by an XDP program on each of
+// xdp_interfaces, which drops matching packets in the driver (or, in generic
+// mode, right after it). The tries are updated in place: only the prefixes that
+// changed are inserted or deleted.
+
+// Insert or delete one family's prefixes and print a summary; absent as for
+// xdp_update. Returns 0 or -1.
+static int xdp_apply_prefixes(Backend *backend, int add, int absent, const PrefixList *prefixes, int f) {
+    NlResult result = {0};
+    if (prefixes->count == 0) return 0;
+    char phase[32];
+    snprintf(phase, sizeof(phase), "xdp_%s_%s", add ? "add" : "delete", f == 0 ? "ipv4" : "ipv6");
+    double start = stats_now();
+    int ret = xdp_update(&backend->xdp, add, absent, prefixes->items, prefixes->count, &result);
+    stats_phase(phase, start, prefixes->count);
+    stats_add(STAT_KERNEL_OPS, prefixes->count);
+    stats_add(STAT_KERNEL_OPS_FAILED, result.failed);
+    stats_add(add ? STAT_ROUTES_ADDED : STAT_ROUTES_REMOVED, result.ok);
+    if (add) {
+        log_info("  %s: %zu added, %zu already existed, %zu failed\n", backend->label[f], result.ok, result.exists, result.failed);
+    } else {
+        log_info("  %s: %zu removed, %zu already gone, %zu failed\n", backend->label[f], result.ok, result.absent, result.failed);
+    }
+    return ret;
+}
+
+// Attach the program to every interface (replacing an older ipban program). Returns 0 or -1.
+static int xdp_attach_all(Backend *backend) {
+    char list[sizeof(backend->interfaces)];
+    snprintf(list, sizeof(list), "%s", backend->interfaces);
+    int failed = 0;
+    char *save = NULL;
+    for (char *name = strtok_r(list, ", ", &save); name; name = strtok_r(NULL, ", ", &save)) {
+        int ifindex = (int)if_nametoindex(name);
+        if (ifindex == 0) {
+            log_error("Unknown interface '%s' in xdp_interfaces\n", name);
+            failed = 1;
+            continue;
+        }
+        if (nl_xdp_attach(&backend->nl, ifindex, backend->xdp.prog_fd, backend->xdp_flags) == -1) {
+            failed = 1;
+            continue;
+        }
+        log_info("XDP program attached to %s.\n", name);
+    }
+    return failed ? -1 : 0;
+}
+
+static int xdp_backend_apply(Backend *backend, const PrefixList *desired[2], const PrefixDelta *delta) {
+    int failed = 0;
+    for (int f = 0; f < 2; f++) {
+        if (delta) {
+            log_info("%s: %zu desired, %zu to add, %zu to remove\n", backend->label[f], desired[f]->count,
+                     delta->add[f].count, delta->remove[f].count);
+            if (xdp_apply_prefixes(backend, 1, 0, &delta->add[f], f) == -1) failed = 1;
+            if (xdp_apply_prefixes(backend, 0, 0, &delta->remove[f], f) == -1) failed = 1;
+            continue;
+        }
+        // Full sync: compare with what the (possibly pinned) trie holds
+        PrefixList installed, to_add, to_remove;
+        init_prefix_list(&installed, desired[f]->count + 16);
+        init_prefix_list(&to_add, 16);
+        init_prefix_list(&to_remove, 16);
+        double start = stats_now();
+        if (xdp_dump(&backend->xdp, f == 0 ? AF_INET : AF_INET6, &installed) == -1) failed = 1;
+        prefix_list_sort_unique(&installed);
+        stats_phase(f == 0 ? "xdp_dump_ipv4" : "xdp_dump_ipv6", start, installed.count);
+        diff_prefix_lists(desired[f], &installed, &to_add, &to_remove);
+        log_info("%s: %zu desired, %zu installed, %zu to add, %zu to remove\n", backend->label[f],
+                 desired[f]->count, installed.count, to_add.count, to_remove.count);
+        free_prefix_list(&installed);
+        // After the dump the prefixes to add are known to be missing
+        if (xdp_apply_prefixes(backend, 1, 1, &to_add, f) == -1) failed = 1;
+        if (xdp_apply_prefixes(backend, 0, 0, &to_remove, f) == -1) failed = 1;
+        free_prefix_list(&to_add);
+        free_prefix_list(&to_remove);
+    }
+    // (Re)attached on full syncs, once the tries are filled
+    if (!delta && xdp_attach_all(backend) == -1) failed = 1;
+    stats_set(STAT_XDP_DROPPED, xdp_dropped(&backend->xdp));
+    return failed ? -1 : 0;
+}
+
+static int xdp_backend_check(Backend *backend, const PrefixList *desired[2], CheckResult result[2]) {
+    for (int f = 0; f < 2; f++) {
+        PrefixList installed, to_add, to_remove;
+        init_prefix_list(&installed, desired[f]->count + 16);
+        init_prefix_list(&to_add, 16);
+        init_prefix_list(&to_remove, 16);
+        int ret = xdp_dump(&backend->xdp, f == 0 ? AF_INET : AF_INET6, &installed);
+        prefix_list_sort_unique(&installed);
+        diff_prefix_lists(desired[f], &installed, &to_add, &to_remove);
+        result[f].expected += desired[f]->count;
+        result[f].missing += to_add.count;
+        result[f].present += desired[f]->count - to_add.count;
+        result[f].extra += to_remove.count; // Only ipban writes to its tries
+        free_prefix_list(&installed);
+        free_prefix_list(&to_add);
+        free_prefix_list(&to_remove);
+        if (ret == -1) return -1;
+    }
+    log_info("XDP drops so far: %llu packets\n", (unsigned long long)xdp_dropped(&backend->xdp));
+    return 0;
+}
+
+// The program stays attached and the maps pinned after exit
+static void xdp_backend_close(Backend *backend) {
+    xdp_close(&backend->xdp);
+    nl_close(&backend->nl);
+}
+
+// --- Script driven backends (nft / ipset) ---
+
+// Feed a generated script to cmd on stdin. Returns 0 if the command succeeded.
+static int run_script(const char *cmd, const char *script, size_t len) {
+    FILE *fp = popen(cmd, "w");
+    if (fp == NULL) {
+        log_error("Failed to run command: %s\n", cmd);
+        log_errno("popen failed");
+        return -1;
+    }
+    size_t written = fwrite(script, 1, len, fp);
+    int ret = pclose(fp);
+    if (written != len) {
+        log_error("Short write to command: %s\n", cmd);
+        return -1;
+    }
+    if (ret == -1 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0) {
+        log_error("Command '%s' failed (raw return: %d)\n", cmd, ret);
+        return -1;
+    }
+    return 0;
+}
+
+// Update the kernel op counters after a script ran. A script is one
+// transaction, so either all of its element operations failed or none did. A
+// full load rewrites the sets, so it does not say which prefixes are new.
+static void count_script_ops(int ret, int delta, size_t added, size_t removed) {
+    stats_add(STAT_KERNEL_OPS, added + removed);
+    if (ret == -1) {
+        stats_add(STAT_KERNEL_OPS_FAILED, added + removed);
+    } else if (delta) {
+        stats_add(STAT_ROUTES_ADDED, added);
+        stats_add(STAT_ROUTES_REMOVED, removed);
+    }
+}
+
+// Growable text buffer for generated scripts
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} ScriptBuf;
+
+static void script_printf(ScriptBuf *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void script_printf(ScriptBuf *buf, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf->data ? buf->data + buf->len : NULL, buf->capacity - buf->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (buf->len + (size_t)n < buf->capacity) {
+            buf->len += (size_t)n;
+            return;
+        }
+        size_t new_capacity = buf->capacity ? buf->capacity * 2 : 65536;
+        while (new_capacity <= buf->len + (size_t)n) new_capacity *= 2;
+        char *new_data = (char*)realloc(buf->data, new_capacity);
+        if (!new_data) {
+            log_errno("Failed to allocate memory for script");
+            exit(EXIT_FAILURE);
+        }
+        buf->data = new_data;
+        buf->capacity = new_capacity;
+    }
+}
+
+// Append "add|delete element <set> { a, b, ... }" lines for prefixes
+static void nft_elements(ScriptBuf *buf, const char *verb, const char *table, const char *set,
+                         const PrefixList *prefixes) {
+    char text[PREFIX_STRLEN];
+    for (size_t i = 0; i < prefixes->count; i++) {
+        if (i % ELEMENTS_PER_LINE == 0) {
+            script_printf(buf, "%s%s element inet %s %s { ", i ? " }\n" : "", verb, table, set);
+        } else {
+            script_printf(buf, ", ");
+        }
+        script_printf(buf, "%s", format_prefix(&prefixes->items[i], text, sizeof(text)));
+    }
+    if (prefixes->count > 0) script_printf(buf, " }\n");
+}
+
+// nftables: one interval set per family in table inet <set_name>, matched on
+// source address in prerouting and destination address in output. The whole
+// script is a single nft transaction, so the new contents replace the old
+// atomically. The sets do not auto-merge: every element stays exactly as added,
+// so a delta can delete it again (the prefixes are aggregated, never overlapping).
+// A full sync deletes and recreates the table in the same transaction, which also
+// replaces sets that older versions created with other flags.
+static int nft_apply(Backend *backend, const PrefixList *desired[2], const PrefixDelta *delta) {
+    const char *table = backend->set_name;
+    const char *sets[2] = { "block_v4", "block_v6" };
+    ScriptBuf buf = { NULL, 0, 0 };
+    size_t added = 0, removed = 0;
+
+    if (!delta) script_printf(&buf, "add table inet %s\ndelete table inet %s\n", table, table);
+    script_printf(&buf,
+        "table inet %s {\n"
+        "    set block_v4 { type ipv4_addr; flags interval; }\n"
+        "    set block_v6 { type ipv6_addr; flags interval; }\n"
+        "    chain input { type filter hook prerouting priority -300; policy accept; }\n"
+        "    chain output { type filter hook output priority -300; policy accept; }\n"
+        "}\n", table);
+
+    if (!delta) {
+        script_printf(&buf,
+            "add rule inet %s input ip saddr @block_v4 drop\n"
+            "add rule inet %s input ip6 saddr @block_v6 drop\n"
+            "add rule inet %s output ip daddr @block_v4 drop\n"
+            "add rule inet %s output ip6 daddr @block_v6 drop\n",
+            table, table, table, table);
+    }
+    for (int f = 0; f < 2; f++) {
+        if (!delta) {
+            nft_elements(&buf, "add", table, sets[f], desired[f]);
+            added += desired[f]->count;
+            log_info("%s: %zu prefixes loaded into set %s %s\n", backend->label[f], desired[f]->count, table, sets[f]);
+            continue;
+        }
+        const PrefixList *to_add = &delta->add[f], *to_remove = &delta->remove[f];
+        nft_elements(&buf, "delete", table, sets[f], to_remove);
+        nft_elements(&buf, "add", table, sets[f], to_add);
+        added += to_add->count;
+        removed += to_remove->count;
+        log_info("%s: %zu desired, %zu to add, %zu to remove\n", backend->label[f], desired[f]->count, to_add->count, to_remove->count);
+    }
+
+    int ret = run_script(NFT_COMMAND, buf.data, buf.len);
+    free(buf.data);
+    count_script_ops(ret, delta != NULL, added, removed);
+    return ret;
+}
+
+// maxelem of an existing ipset, or 0 if there is no such set
+static size_t ipset_maxelem(const char *name) {
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_') return 0; // Not passed to a shell
+    }
+    char cmd[128], line[512];
+    snprintf(cmd, sizeof(cmd), "ipset list -terse %s 2>/dev/null", name);
+    FILE *fp = popen(cmd, "r");
+    if (!fp) return 0;
+    size_t maxelem = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = strncmp(line, "Header:", 7) == 0 ? strstr(line, " maxelem ") : NULL;
+        if (p) maxelem = strtoul(p + 9, NULL, 10);
+    }
+    pclose(fp);
+    return maxelem;
+}
+
+// ipset: one hash:net set per family (<set_name>4, <set_name>6). A full sync
+// fills a temporary set and swaps it with the live one, which is atomic for
+// packet matching. The sets have to be referenced by the firewall rules.
+// `create` is only sent for a missing set: an existing one with other
+// parameters would fail the restore. maxelem only grows, in powers of two,
+// to stay at least twice the prefix count; growing takes a full load, since
+// swapping in a new set is the only way to change it.
+static int ipset_apply(Backend *backend, const PrefixList *desired[2], const PrefixDelta *delta) {
+    ScriptBuf buf = { NULL, 0, 0 };
+    char text[PREFIX_STRLEN];
+    size_t added = 0, removed = 0, maxelem[2];
+    int full[2];
+
+    for (int f = 0; f < 2; f++) {
+        const char *inet = f == 0 ? "inet" : "inet6";
+        char name[80], tmp[84];
+        snprintf(name, sizeof(name), "%s%c", backend->set_name, f == 0 ? '4' : '6');
+        snprintf(tmp, sizeof(tmp), "%s-tmp", name);
+        size_t live = backend->set_maxelem[f] ? backend->set_maxelem[f] : ipset_maxelem(name);
+        maxelem[f] = live ? live : IPSET_MIN_MAXELEM;
+        while (maxelem[f] < desired[f]->count * 2) maxelem[f] *= 2;
+        if (!live) script_printf(&buf, "create %s hash:net family %s maxelem %zu\n", name, inet, maxelem[f]);
+        full[f] = !delta || maxelem[f] != live;
+
+        if (full[f]) {
+            if (live && maxelem[f] != live) {
+                log_info("%s: growing ipset %s to maxelem %zu\n", backend->label[f], name, maxelem[f]);
+            }
+            // An interrupted run may have left the temporary set, possibly with another size
+            if (ipset_maxelem(tmp)) script_printf(&buf, "destroy %s\n", tmp);
+            script_printf(&buf, "create %s hash:net family %s maxelem %zu\n", tmp, inet, maxelem[f]);
+            for (size_t i = 0; i < desired[f]->count; i++) {
+                script_printf(&buf, "add %s %s\n", tmp, format_prefix(&desired[f]->items[i], text, sizeof(text)));
+            }
+            added += desired[f]->count;
+            script_printf(&buf, "swap %s %s\n", tmp, name);
+            script_printf(&buf, "destroy %s\n", tmp);
+            log_info("%s: %zu prefixes loaded into ipset %s\n", backend->label[f], desired[f]->count, name);
+            continue;
+        }
+        const PrefixList *to_add = &delta->add[f], *to_remove = &delta->remove[f];
+        for (size_t i = 0; i < to_remove->count; i++) {
+            script_printf(&buf, "del %s %s\n", name, format_prefix(&to_remove->items[i], text, sizeof(text)));
+        }
+        for (size_t i = 0; i < to_add->count; i++) {
+            script_printf(&buf, "add %s %s\n", name, format_prefix(&to_add->items[i], text, sizeof(text)));
+        }
+        log_info("%s: %zu desired, %zu to add, %zu to remove\n", backend->label[f], desired[f]->count, to_add->count, to_remove->count);
+        added += to_add->count;
+        removed += to_remove->count;
+    }
+
+    int ret = run_script(IPSET_COMMAND, buf.data, buf.len);
+    free(buf.data);
+    count_script_ops(ret, !full[0] && !full[1], added, removed);
+    // After a failure the sets are looked at again
+    for (int f = 0; f < 2; f++) backend->set_maxelem[f] = ret == 0 ? maxelem[f] : 0;
+    return ret;
+}
+
+// A helper that dies early must not kill us with SIGPIPE; the short write is reported instead
+static void ignore_sigpipe(void) {
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static void script_close(Backend *backend) {
+    (void)backend;
+}
+
+// --- Backend selection ---
+
+// Set up the backend named in settings. Returns 0, or -1 on error.
+int backend_open(Backend *backend, const Settings *settings) {
+    memset(backend, 0, sizeof(*backend));
+    backend->nl.fd = -1;
+    snprintf(backend->set_name, sizeof(backend->set_name), "%s", settings->set_name);
+    backend->swap_tables[0] = settings->swap_tables[0];
+    backend->swap_tables[1] = settings->swap_tables[1];
+    backend->rule_priority = settings->rule_priority;
+    backend->route_table = settings->route_table;
+    snprintf(backend->label[0], sizeof(backend->label[0]), "IPv4");
+    snprintf(backend->label[1], sizeof(backend->label[1]), "IPv6");
+
+    if (strcmp(settings->backend, "route") == 0) {
+        backend->name = "route";
+        backend->apply = route_apply;
+        backend->close = route_close;
+        backend->check = route_check;
+        backend->flush = route_flush;
+        if (settings->swap_tables[0] && settings->route_table != RT_TABLE_MAIN) {
+            log_warn("route_table is not used with swap_tables, ignored.\n");
+            backend->route_table = RT_TABLE_MAIN;
+        }
+        if (nl_open(&backend->nl) == -1) return -1;
+        backend->nl.protocol = (unsigned char)settings->route_protocol;
+        return 0;
+    }
+    if (settings->swap_tables[0]) {
+        log_warn("swap_tables only applies to the route backend, ignored.\n");
+        backend->swap_tables[0] = backend->swap_tables[1] = 0;
+    }
+    if (strcmp(settings->backend, "xdp") == 0) {
+        backend->name = "xdp";
+        backend->apply = xdp_backend_apply;
+        backend->close = xdp_backend_close;
+        backend->check = xdp_backend_check;
+        if (!settings->xdp_interfaces[0]) {
+            log_error("The xdp backend needs xdp_interfaces in [settings]\n");
+            return -1;
+        }
+        snprintf(backend->interfaces, sizeof(backend->interfaces), "%s", settings->xdp_interfaces);
+        if (strcmp(settings->xdp_mode, "native") == 0) backend->xdp_flags = XDP_FLAGS_DRV_MODE;
+        else if (strcmp(settings->xdp_mode, "generic") == 0) backend->xdp_flags = XDP_FLAGS_SKB_MODE;
+        char pin_dir[128];
+        snprintf(pin_dir, sizeof(pin_dir), "%s/%s", BPF_PIN_ROOT, settings->set_name);
+        if (nl_open(&backend->nl) == -1) return -1;
+        if (xdp_open(&backend->xdp, pin_dir) == -1) {
+            nl_close(&backend->nl);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(settings->backend, "nftables") == 0) {
+        backend->name = "nftables";
+        backend->apply = nft_apply;
+        backend->close = script_close;
+        ignore_sigpipe();
+        return 0;
+    }
+    if (strcmp(settings->backend, "ipset") == 0) {
+        backend->name = "ipset";
+        backend->apply = ipset_apply;
+        backend->close = script_close;
+        ignore_sigpipe();
+        return 0;
+    }
+    log_error("Unknown backend '%s' (expected route, nftables, ipset or xdp)\n", settings->backend);
+    return -1;
+}
+
+void backend_close(Backend *backend) {
+    if (backend->close) backend->close(backend);
+}
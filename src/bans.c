@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- Dynamic bans ---
+//
+// Prefixes banned at runtime for a limited time. Entries live in a pool and are
+// found through a chained hash table; both link through pool indices (+1, so 0
+// means none). Expiry is tracked in a hierarchical timing wheel with 1 second
+// ticks: level 0 holds entries due within 256 ticks in the slot of their expiry
+// tick, level n entries due within 256^(n+1) ticks, in the slot of the matching
+// byte of the expiry tick. When the lower byte(s) of the clock wrap, the next
+// slot of the level above is redistributed one level down. Adding, removing and
+// expiring an entry are O(1) however many bans exist.
+//
+// Changes are not applied one by one: every entry that was banned, unbanned or
+// expired is remembered, and ban_collect() turns the net effect into sorted
+// add/remove lists for one batched update.
+
+#define BAN_WHEEL_BITS 8
+
+enum {
+    BAN_ALIVE = 1,      // Currently banned (otherwise unbanned/expired, freed on collect)
+    BAN_INSTALLED = 2,  // Part of the block set as of the last collect
+    BAN_TOUCHED = 4,    // On the touched list
+};
+
+struct BanEntry {
+    Prefix prefix;
+    uint32_t expires;   // Tick
+    uint32_t wheel_next;
+    uint32_t wheel_prev;
+    uint32_t hash_next; // Also links the free list
+    unsigned char flags;
+    unsigned char level; // Wheel position, for unlinking
+    unsigned char slot;
+};
+
+void init_ban_store(BanStore *store) {
+    memset(store, 0, sizeof(*store));
+    store->bucket_mask = 1023;
+    store->buckets = (uint32_t*)calloc(store->bucket_mask + 1, sizeof(uint32_t));
+    if (!store->buckets) {
+        log_errno("Failed to allocate memory for ban table");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void free_ban_store(BanStore *store) {
+    free(store->entries);
+    free(store->buckets);
+    free(store->touched);
+    memset(store, 0, sizeof(*store));
+}
+
+// --- Hash table ---
+
+static uint32_t find_entry(const BanStore *store, const Prefix *prefix) {
+    uint32_t idx = store->buckets[prefix_hash(prefix) & store->bucket_mask];
+    while (idx) {
+        const BanEntry *entry = &store->entries[idx - 1];
+        if (prefix_cmp(&entry->prefix, prefix) == 0) return idx;
+        idx = entry->hash_next;
+    }
+    return 0;
+}
+
+static void grow_buckets(BanStore *store) {
+    uint32_t new_mask = store->bucket_mask * 2 + 1;
+    uint32_t *buckets = (uint32_t*)calloc((size_t)new_mask + 1, sizeof(uint32_t));
+    if (!buckets) {
+        log_errno("Failed to allocate memory for ban table");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t b = 0; b <= store->bucket_mask; b++) {
+        uint32_t idx = store->buckets[b];
+        while (idx) {
+            BanEntry *entry = &store->entries[idx - 1];
+            uint32_t next = entry->hash_next;
+            uint32_t pos = prefix_hash(&entry->prefix) & new_mask;
+            entry->hash_next = buckets[pos];
+            buckets[pos] = idx;
+            idx = next;
+        }
+    }
+    free(store->buckets);
+    store->buckets = buckets;
+    store->bucket_mask = new_mask;
+}
+
+static uint32_t new_entry(BanStore *store, const Prefix *prefix) {
+    uint32_t idx = store->free_list;
+    if (idx) {
+        store->free_list = store->entries[idx - 1].hash_next;
+    } else {
+        if (store->used == store->capacity) {
+            uint32_t new_capacity = store->capacity ? store->capacity * 2 : 1024;
+            BanEntry *entries = (BanEntry*)realloc(store->entries, (size_t)new_capacity * sizeof(BanEntry));
+            if (!entries) {
+                log_errno("Failed to allocate memory for bans");
+                exit(EXIT_FAILURE);
+            }
+            store->entries = entries;
+            store->capacity = new_capacity;
+        }
+        idx = ++store->used;
+    }
+    if (++store->stored > (size_t)store->bucket_mask + 1) grow_buckets(store);
+    BanEntry *entry = &store->entries[idx - 1];
+    memset(entry, 0, sizeof(*entry));
+    entry->prefix = *prefix;
+    uint32_t pos = prefix_hash(prefix) & store->bucket_mask;
+    entry->hash_next = store->buckets[pos];
+    store->buckets[pos] = idx;
+    return idx;
+}
+
+static void free_entry(BanStore *store, uint32_t idx) {
+    BanEntry *entry = &store->entries[idx - 1];
+    uint32_t *link = &store->buckets[prefix_hash(&entry->prefix) & store->bucket_mask];
+    while (*link != idx) link = &store->entries[*link - 1].hash_next;
+    *link = entry->hash_next;
+    entry->hash_next = store->free_list;
+    store->free_list = idx;
+    store->stored--;
+}
+
+// --- Timing wheel ---
+
+static void wheel_link(BanStore *store, uint32_t idx) {
+    BanEntry *entry = &store->entries[idx - 1];
+    uint32_t delta = entry->expires - store->now;
+    int level = 0;
+    while (level < BAN_WHEEL_LEVELS - 1 && delta >= (1U << (BAN_WHEEL_BITS * (level + 1)))) level++;
+    int slot = (entry->expires >> (BAN_WHEEL_BITS * level)) & (BAN_WHEEL_SLOTS - 1);
+    entry->level = (unsigned char)level;
+    entry->slot = (unsigned char)slot;
+    entry->wheel_prev = 0;
+    entry->wheel_next = store->wheel[level][slot];
+    if (entry->wheel_next) store->entries[entry->wheel_next - 1].wheel_prev = idx;
+    store->wheel[level][slot] = idx;
+}
+
+static void wheel_unlink(BanStore *store, uint32_t idx) {
+    BanEntry *entry = &store->entries[idx - 1];
+    if (entry->wheel_prev) {
+        store->entries[entry->wheel_prev - 1].wheel_next = entry->wheel_next;
+    } else {
+        store->wheel[entry->level][entry->slot] = entry->wheel_next;
+    }
+    if (entry->wheel_next) store->entries[entry->wheel_next - 1].wheel_prev = entry->wheel_prev;
+}
+
+// Move the entries of a slot one or more levels down, now that they are closer
+static void cascade(BanStore *store, int level, int slot) {
+    uint32_t idx = store->wheel[level][slot];
+    store->wheel[level][slot] = 0;
+    while (idx) {
+        uint32_t next = store->entries[idx - 1].wheel_next;
+        wheel_link(store, idx);
+        idx = next;
+    }
+}
+
+static void touch(BanStore *store, uint32_t idx) {
+    BanEntry *entry = &store->entries[idx - 1];
+    if (entry->flags & BAN_TOUCHED) return;
+    if (store->touched_count == store->touched_capacity) {
+        size_t new_capacity = store->touched_capacity ? store->touched_capacity * 2 : 1024;
+        uint32_t *touched = (uint32_t*)realloc(store->touched, new_capacity * sizeof(uint32_t));
+        if (!touched) {
+            log_errno("Failed to allocate memory for ban changes");
+            exit(EXIT_FAILURE);
+        }
+        store->touched = touched;
+        store->touched_capacity = new_capacity;
+    }
+    store->touched[store->touched_count++] = idx;
+    entry->flags |= BAN_TOUCHED;
+}
+
+static void end_ban(BanStore *store, uint32_t idx) {
+    BanEntry *entry = &store->entries[idx - 1];
+    entry->flags &= ~BAN_ALIVE;
+    store->active[entry->prefix.family == AF_INET ? 0 : 1]--;
+    touch(store, idx);
+}
+
+// --- Public interface ---
+
+int ban_add(BanStore *store, const Prefix *prefix, uint32_t ttl) {
+    if (ttl == 0) ttl = 1; // Expiring in the current tick would wait for a full wheel turn
+    if (ttl > BAN_MAX_TTL) ttl = BAN_MAX_TTL;
+    uint32_t expires = store->now + ttl;
+    uint32_t idx = find_entry(store, prefix);
+    if (!idx) idx = new_entry(store, prefix);
+    BanEntry *entry = &store->entries[idx - 1];
+    if (entry->flags & BAN_ALIVE) {
+        // Banned again: keep the later expiry
+        if (expires - store->now <= entry->expires - store->now) return 0;
+        wheel_unlink(store, idx);
+        entry->expires = expires;
+        wheel_link(store, idx);
+        return 0;
+    }
+    entry->flags |= BAN_ALIVE;
+    entry->expires = expires;
+    wheel_link(store, idx);
+    store->active[prefix->family == AF_INET ? 0 : 1]++;
+    touch(store, idx);
+    return 1;
+}
+
+int ban_remove(BanStore *store, const Prefix *prefix) {
+    uint32_t idx = find_entry(store, prefix);
+    if (!idx || !(store->entries[idx - 1].flags & BAN_ALIVE)) return 0;
+    wheel_unlink(store, idx);
+    end_ban(store, idx);
+    return 1;
+}
+
+size_t ban_advance(BanStore *store, uint32_t now) {
+    size_t expired = 0;
+    while (store->now != now) {
+        uint32_t t = ++store->now;
+        // Redistribute the levels whose lower bytes just wrapped, top down
+        for (int level = BAN_WHEEL_LEVELS - 1; level > 0; level--) {
+            uint32_t lower = t & ((1U << (BAN_WHEEL_BITS * level)) - 1);
+            if (lower == 0) cascade(store, level, (t >> (BAN_WHEEL_BITS * level)) & (BAN_WHEEL_SLOTS - 1));
+        }
+        int slot = t & (BAN_WHEEL_SLOTS - 1);
+        uint32_t idx = store->wheel[0][slot];
+        store->wheel[0][slot] = 0;
+        while (idx) {
+            uint32_t next = store->entries[idx - 1].wheel_next;
+            end_ban(store, idx);
+            expired++;
+            idx = next;
+        }
+    }
+    return expired;
+}
+
+size_t ban_collect(BanStore *store, PrefixList add[2], PrefixList remove[2]) {
+    size_t changes = 0;
+    for (size_t i = 0; i < store->touched_count; i++) {
+        uint32_t idx = store->touched[i];
+        BanEntry *entry = &store->entries[idx - 1];
+        int f = entry->prefix.family == AF_INET ? 0 : 1;
+        entry->flags &= ~BAN_TOUCHED;
+        if ((entry->flags & BAN_ALIVE) && !(entry->flags & BAN_INSTALLED)) {
+            prefix_list_push(&add[f], &entry->prefix);
+            entry->flags |= BAN_INSTALLED;
+            changes++;
+        } else if (!(entry->flags & BAN_ALIVE)) {
+            if (entry->flags & BAN_INSTALLED) {
+                prefix_list_push(&remove[f], &entry->prefix);
+                changes++;
+            }
+            free_entry(store, idx);
+        }
+    }
+    store->touched_count = 0;
+    for (int f = 0; f < 2; f++) {
+        prefix_list_sort_unique(&add[f]);
+        prefix_list_sort_unique(&remove[f]);
+    }
+    return changes;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Stand-in IRR whois server for benchmarks. Answers "!g"/"!6" queries with the
+// same deterministic prefixes as the bgpq4 stub in run.sh (BENCH_ASN_PREFIXES
+// per ASN and family), "!!", "!n" and "!s" like IRRd, and closes on "!q".
+// Usage: irrd_stub PORT  (listens on 127.0.0.1, prints the server pid once ready)
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} Buf;
+
+static void append(Buf *buf, const char *text, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        size_t new_capacity = buf->capacity ? buf->capacity * 2 : 65536;
+        while (new_capacity < buf->len + len) new_capacity *= 2;
+        buf->data = (char*)realloc(buf->data, new_capacity);
+        if (!buf->data) {
+            perror("realloc");
+            exit(2);
+        }
+        buf->capacity = new_capacity;
+    }
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+}
+
+static void answer(Buf *out, const char *line, long per_asn) {
+    char item[64];
+    if (line[0] != '!') {
+        append(out, "F Unrecognized command\n", 23);
+        return;
+    }
+    if (line[1] == 'n' || line[1] == 's') {
+        append(out, "C\n", 2);
+        return;
+    }
+    if ((line[1] != 'g' && line[1] != '6') || strncmp(line + 2, "AS", 2) != 0) {
+        append(out, "F Unrecognized command\n", 23);
+        return;
+    }
+    long asn = atol(line + 4);
+    Buf data = { NULL, 0, 0 };
+    for (long i = 0; i < per_asn; i++) {
+        long j = asn * per_asn + i;
+        int n = line[1] == 'g'
+              ? snprintf(item, sizeof(item), "%s100.%ld.%ld.0/24", i ? " " : "", (j / 256) % 256, j % 256)
+              : snprintf(item, sizeof(item), "%s2001:db8:%lx:%lx::/64", i ? " " : "", asn % 65536, i);
+        append(&data, item, (size_t)n);
+    }
+    if (data.len == 0) {
+        append(out, "C\n", 2);
+        return;
+    }
+    int n = snprintf(item, sizeof(item), "A%zu\n", data.len + 1);
+    append(out, item, (size_t)n);
+    append(out, data.data, data.len);
+    append(out, "\nC\n", 3);
+    free(data.data);
+}
+
+static int write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void serve(int fd, long per_asn) {
+    Buf in = { NULL, 0, 0 }, out = { NULL, 0, 0 };
+    char chunk[65536];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) break;
+        append(&in, chunk, (size_t)n);
+        size_t pos = 0;
+        char *nl;
+        int quit = 0;
+        while (!quit && (nl = memchr(in.data + pos, '\n', in.len - pos)) != NULL) {
+            *nl = '\0';
+            const char *line = in.data + pos;
+            pos = nl - in.data + 1;
+            if (strcmp(line, "!q") == 0) quit = 1;
+            else if (strcmp(line, "!!") != 0) answer(&out, line, per_asn);
+        }
+        memmove(in.data, in.data + pos, in.len - pos);
+        in.len -= pos;
+        if (write_all(fd, out.data, out.len) == -1 || quit) break;
+        out.len = 0;
+    }
+    free(in.data);
+    free(out.data);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s port\n", argv[0]);
+        return 2;
+    }
+    const char *env = getenv("BENCH_ASN_PREFIXES");
+    long per_asn = env ? atol(env) : 50;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)atoi(argv[1]));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+        perror("irrd_stub: listen");
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        return 2;
+    }
+    if (pid > 0) {
+        printf("%d\n", (int)pid);
+        return 0;
+    }
+    fclose(stdout);
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        serve(fd, per_asn);
+        close(fd);
+    }
+}
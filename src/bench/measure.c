@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Run a command and write its wall time, peak RSS and exit status as JSON.
+// Usage: measure OUTPUT_FILE command [args...]
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s output_file command [args...]\n", argv[0]);
+        return 2;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        return 2;
+    }
+    if (pid == 0) {
+        execvp(argv[2], argv + 2);
+        perror(argv[2]);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4 failed");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        perror(argv[1]);
+        return 2;
+    }
+    fprintf(out, "{\"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, \"max_rss_kb\": %ld, \"exit_status\": %d}\n",
+            (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6,
+            usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0,
+            usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0,
+            usage.ru_maxrss, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,199 @@
+#!/bin/sh
+# End-to-end benchmark: generates synthetic configs, runs ipban against a stub
+# bgpq4 (and a stub IRR server) inside a throwaway network namespace and prints
+# one JSON object per run.
+#
+# Environment:
+#   BENCH_SIZES         prefix counts to test (default: "1000 100000 1000000")
+#   BENCH_ASNS          number of ASNs in the ASN scenario (default: 1000)
+#   BENCH_ASN_PREFIXES  prefixes the stub returns per ASN and family (default: 50)
+#   BENCH_LOG_LINES     lines in the log scanning scenario (default: 2000000)
+#   BENCH_GEO_RECORDS   records in the delegated-stats file of the country scenario (default: 300000)
+#   BENCH_OUT           also append the results to this file
+set -eu
+
+BENCH_SIZES=${BENCH_SIZES:-"1000 100000 1000000"}
+BENCH_ASNS=${BENCH_ASNS:-1000}
+BENCH_ASN_PREFIXES=${BENCH_ASN_PREFIXES:-50}
+BENCH_LOG_LINES=${BENCH_LOG_LINES:-2000000}
+BENCH_GEO_RECORDS=${BENCH_GEO_RECORDS:-300000}
+
+here=$(cd "$(dirname "$0")" && pwd)
+ipban=$here/../ipban
+measure=$here/measure
+irrd_stub=$here/irrd_stub
+real_ip=$(command -v ip || true)
+commit=$(git -C "$here" rev-parse --short HEAD 2>/dev/null || echo unknown)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# A fresh network namespace per scenario, so the host routing table is never touched
+if unshare -rn true 2>/dev/null; then
+    netns="unshare -rn"
+elif unshare -n true 2>/dev/null; then
+    netns="unshare -n"
+else
+    echo "bench: cannot create a network namespace (unshare -rn), giving up" >&2
+    exit 1
+fi
+
+# Stub tools: bgpq4 prints deterministic prefixes per ASN, ip does nothing
+mkdir -p "$work/bin"
+cat > "$work/bin/bgpq4" <<'STUB'
+#!/bin/sh
+# Called as: bgpq4 -4|-6 -A -F '%n/%l\n' AS<n>
+asn=${5#AS}
+awk -v fam="$1" -v asn="$asn" -v n="$BENCH_ASN_PREFIXES" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        j = asn * n + i
+        if (fam == "-4") printf "100.%d.%d.0/24\n", int(j / 256) % 256, j % 256
+        else printf "2001:db8:%x:%x::/64\n", asn % 65536, i
+    }
+}'
+STUB
+printf '#!/bin/sh\nexit 0\n' > "$work/bin/ip"
+chmod +x "$work/bin/bgpq4" "$work/bin/ip"
+PATH=$work/bin:$PATH
+export PATH BENCH_ASN_PREFIXES
+
+# One prefix per line: 90% IPv4 /24s in scattered order (with some duplicates), 10% IPv6 /64s
+gen_prefixes() {
+    awk -v n="$1" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            if (i % 10 == 0) {
+                printf "2001:db8:%x:%x::/64\n", int(i / 65536), i % 65536
+            } else {
+                j = (i * 2654435761) % 16777216
+                printf "%d.%d.%d.0/24\n", 1 + int(j / 65536) % 223, int(j / 256) % 256, j % 256
+            }
+        }
+    }'
+}
+
+settings() { # [irr_server]
+    printf '[settings]\ncache_dir = ""\n'
+    if [ -n "${1:-}" ]; then printf 'irr_server = "%s"\n' "$1"; fi
+    printf '\n'
+}
+
+gen_inline_config() {
+    settings
+    printf '[ipv4_routes]\nroutes = [\n'
+    grep -v : "$1" | sed 's/.*/    "&",/'
+    printf ']\n\n[ipv6_routes]\nroutes = [\n'
+    grep : "$1" | sed 's/.*/    "&",/'
+    printf ']\n'
+}
+
+gen_feed_config() {
+    settings
+    printf '[feeds]\nfiles = ["%s"]\n' "$1"
+}
+
+gen_asn_config() { # count [irr_server]
+    settings "${2:-}"
+    printf '[asn_block]\nas_numbers = [\n'
+    awk -v n="$1" 'BEGIN { for (i = 0; i < n; i++) printf "    \"AS%d\",\n", 64512 + i }'
+    printf ']\n'
+}
+
+# Delegated-stats records for 100 countries, 3 in 4 IPv4 ranges of varying size
+gen_delegated() {
+    awk -v n="$1" 'BEGIN {
+        print "2|ripencc|1760000000|" n "|19830705|20261016|+0000"
+        print "ripencc|*|ipv4|*|" n "|summary"
+        addr = 16777216
+        for (i = 0; i < n; i++) {
+            j = (i * 2654435761) % 16777216
+            cc = sprintf("%c%c", 65 + int(j / 4) % 10, 65 + int(j / 40) % 10)
+            if (i % 4 == 3) {
+                printf "ripencc|%s|ipv6|2a%02x:%x::|%d|20100712|allocated|id%d\n", cc, j % 256, int(j / 256) % 65536, 29 + j % 4 * 3, i
+            } else {
+                size = 256 * (1 + j % 24)
+                printf "ripencc|%s|ipv4|%d.%d.%d.%d|%d|20100712|allocated|id%d\n", cc, int(addr / 16777216), int(addr / 65536) % 256, int(addr / 256) % 256, addr % 256, size, i
+                addr += size
+                if (addr >= 3741319168) addr = 16777216
+            }
+        }
+    }'
+}
+
+# Access log lines with an sshd failure every 20th line, from a few hundred repeat offenders
+gen_log() {
+    awk -v n="$1" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            j = (i * 2654435761) % 16777216
+            if (i % 20 == 0) {
+                printf "Oct 16 10:22:%02d host sshd[%d]: Failed password for invalid user admin from 203.0.113.%d port %d ssh2\n", i % 60, 1000 + i % 5000, 1 + j % 250, 1024 + j % 60000
+            } else {
+                printf "%d.%d.%d.%d - - [16/Oct/2026:10:22:%02d +0000] \"GET /index.html?id=%d HTTP/1.1\" 200 5123 \"-\" \"Mozilla/5.0\"\n", 1 + int(j / 65536) % 223, int(j / 256) % 256, j % 256, 1 + i % 254, i % 60, i
+            }
+        }
+    }'
+}
+
+emit() { # scenario size run
+    line=$(printf '{"commit": "%s", "scenario": "%s", "prefixes": %s, "run": "%s", "process": %s, "stats": %s}' \
+        "$commit" "$1" "$2" "$3" "$(cat "$work/$3.measure")" "$(cat "$work/$3.timings" 2>/dev/null || echo null)")
+    echo "$line"
+    if [ -n "${BENCH_OUT:-}" ]; then echo "$line" >> "$BENCH_OUT"; fi
+}
+
+# Run ipban twice in one namespace: "first" programs everything, "repeat" finds nothing to change.
+# With irr set, the stub IRR server is started on 127.0.0.1:4343 in the namespace first.
+run_scenario() { # scenario size config [irr]
+    rm -f "$work"/*.timings
+    $netns sh -c '
+        if [ -n "$5" ]; then "$6" link set lo up && pid=$("$5" 4343) || exit 1; fi
+        "$1" "$3/first.measure" "$2" -c "$4" -t "$3/first.timings" > "$3/first.log" 2>&1
+        "$1" "$3/repeat.measure" "$2" -c "$4" -t "$3/repeat.timings" > "$3/repeat.log" 2>&1
+        if [ -n "$5" ]; then kill "$pid"; fi
+    ' bench "$measure" "$ipban" "$work" "$3" "${4:+$irrd_stub}" "$real_ip"
+    emit "$1" "$2" first
+    emit "$1" "$2" repeat
+}
+
+for size in $BENCH_SIZES; do
+    echo "bench: $size prefixes" >&2
+    gen_prefixes "$size" > "$work/prefixes.txt"
+    gen_inline_config "$work/prefixes.txt" > "$work/inline.toml"
+    run_scenario inline "$size" "$work/inline.toml"
+    gen_feed_config "$work/prefixes.txt" > "$work/feed.toml"
+    run_scenario feed "$size" "$work/feed.toml"
+done
+
+# Uninstall: program the largest feed, then time --flush removing it
+echo "bench: flush of $size prefixes" >&2
+rm -f "$work"/*.timings
+$netns sh -c '
+    "$1" "$3/apply.measure" "$2" -c "$4" > /dev/null 2>&1
+    "$1" "$3/flush.measure" "$2" -c "$4" --flush -t "$3/flush.timings" > "$3/flush.log" 2>&1
+' bench "$measure" "$ipban" "$work" "$work/feed.toml"
+emit flush "$size" flush
+
+echo "bench: $BENCH_ASNS ASNs" >&2
+gen_asn_config "$BENCH_ASNS" > "$work/asn.toml"
+run_scenario asn $((BENCH_ASNS * BENCH_ASN_PREFIXES * 2)) "$work/asn.toml"
+
+if [ -n "$real_ip" ]; then
+    echo "bench: $BENCH_ASNS ASNs over IRR" >&2
+    gen_asn_config "$BENCH_ASNS" 127.0.0.1:4343 > "$work/asn_irr.toml"
+    run_scenario asn_irr $((BENCH_ASNS * BENCH_ASN_PREFIXES * 2)) "$work/asn_irr.toml" irr
+else
+    echo "bench: no ip command to bring up loopback, skipping the IRR scenario" >&2
+fi
+
+# Countries: "first" parses the file, "repeat" finds the prefixes in the cache
+echo "bench: $BENCH_GEO_RECORDS delegated-stats records" >&2
+gen_delegated "$BENCH_GEO_RECORDS" > "$work/delegated.txt"
+mkdir -p "$work/cache"
+printf '[settings]\ncache_dir = "%s"\n\n[geo_block]\ncountries = ["AA", "BB", "CC", "DD", "EE"]\nfiles = ["%s"]\n' \
+    "$work/cache" "$work/delegated.txt" > "$work/geo.toml"
+run_scenario geo "$BENCH_GEO_RECORDS" "$work/geo.toml"
+
+echo "bench: log scan, $BENCH_LOG_LINES lines" >&2
+gen_log "$BENCH_LOG_LINES" > "$work/bench.log"
+printf '[settings]\nlog_threshold = 5\n\n[logwatch]\npatterns = ["Failed password", "Invalid user"]\n' > "$work/logscan.toml"
+rm -f "$work"/*.timings
+"$measure" "$work/scan.measure" "$ipban" -c "$work/logscan.toml" --scan-logs "$work/bench.log" > "$work/scan.log" 2>&1
+emit logscan "$BENCH_LOG_LINES" scan
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- On-disk prefix cache ---
+//
+// One file per key and family (e.g. "AS1234.v4"): a fixed header followed by
+// packed records of address bytes plus prefix length (5 bytes for IPv4, 17 for
+// IPv6). Files are read through mmap and replaced atomically with rename().
+
+#define CACHE_MAGIC "IPBANC1"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t family;      // 4 or 6
+    int64_t fetched_at;   // Unix time of the fetch that produced the data
+    uint64_t hash;        // FNV-1a over the records
+    uint64_t count;       // Number of records
+} CacheHeader;
+
+// FNV-1a 64, continued from h
+uint64_t fnv1a64(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+static void cache_path(char *buf, size_t buf_len, const char *dir, const char *key, int family) {
+    snprintf(buf, buf_len, "%s/%s.v%c", dir, key, family == AF_INET ? '4' : '6');
+}
+
+// Load cached prefixes for key/family and append them to out.
+// Returns 0 on success, -1 if there is no usable cache entry.
+int cache_load(const char *dir, const char *key, int family, PrefixList *out, CacheInfo *info) {
+    char path[4096];
+    cache_path(path, sizeof(path), dir, key, family);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) log_errno(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_errno("mmap failed for cache file");
+        return -1;
+    }
+
+    const CacheHeader *hdr = (const CacheHeader *)map;
+    size_t addr_len = family == AF_INET ? 4 : 16;
+    size_t record_len = addr_len + 1;
+    const unsigned char *records = (const unsigned char *)map + sizeof(CacheHeader);
+    int ok = memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) == 0 &&
+             hdr->version == CACHE_VERSION &&
+             hdr->family == (family == AF_INET ? 4u : 6u) &&
+             hdr->count == ((size_t)st.st_size - sizeof(CacheHeader)) / record_len &&
+             (size_t)st.st_size == sizeof(CacheHeader) + hdr->count * record_len &&
+             fnv1a64(FNV1A64_INIT, records, hdr->count * record_len) == hdr->hash;
+    if (!ok) {
+        log_warn("Ignoring corrupt cache file %s\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    Prefix prefix;
+    memset(&prefix, 0, sizeof(prefix));
+    prefix.family = (unsigned char)family;
+    for (uint64_t i = 0; i < hdr->count; i++) {
+        memcpy(prefix.addr, records + i * record_len, addr_len);
+        prefix.len = records[i * record_len + addr_len];
+        prefix_list_push(out, &prefix);
+    }
+    if (info) {
+        info->fetched_at = hdr->fetched_at;
+        info->hash = hdr->hash;
+        info->count = (size_t)hdr->count;
+    }
+    munmap(map, st.st_size);
+    return 0;
+}
+
+// Write prefixes for key/family to the cache, replacing any previous entry atomically.
+// Returns 0 on success, -1 on error.
+int cache_store(const char *dir, const char *key, int family, const Prefix *prefixes, size_t count,
+                int64_t fetched_at) {
+    size_t addr_len = family == AF_INET ? 4 : 16;
+    size_t record_len = addr_len + 1;
+    size_t data_len = count * record_len;
+    unsigned char *data = (unsigned char*)malloc(data_len > 0 ? data_len : 1);
+    if (!data) {
+        log_errno("Failed to allocate memory for cache entry");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        memcpy(data + i * record_len, prefixes[i].addr, addr_len);
+        data[i * record_len + addr_len] = prefixes[i].len;
+    }
+
+    CacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.family = family == AF_INET ? 4 : 6;
+    hdr.fetched_at = fetched_at;
+    hdr.hash = fnv1a64(FNV1A64_INIT, data, data_len);
+    hdr.count = count;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        char error_buf[512];
+        snprintf(error_buf, sizeof(error_buf), "Failed to create cache directory '%s'", dir);
+        log_errno(error_buf);
+        free(data);
+        return -1;
+    }
+
+    char path[4096], tmp_path[4200];
+    cache_path(path, sizeof(path), dir, key, family);
+    // Unique per writer: the daemon's refresh thread and its main thread may
+    // store the same entry at once
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!file) {
+        log_errno(tmp_path);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(data);
+        return -1;
+    }
+    fchmod(fd, 0644);
+    int ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+             (data_len == 0 || fwrite(data, data_len, 1, file) == 1);
+    if (fclose(file) != 0) ok = 0;
+    free(data);
+    if (!ok || rename(tmp_path, path) < 0) {
+        log_errno("Failed to write cache file");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,672 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>       // For isspace, isalnum
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+#include <linux/rtnetlink.h> // For RT_TABLE_*, RTPROT_*
+
+#include "ipban.h"
+
+#define CACHE_DIR "/var/cache/ipban"
+#define ROUTE_PROTOCOL 201 // Not used by any routing daemon in rtnetlink.h
+
+// --- Configuration Reading ---
+
+// Set defaults for options of the [settings] section
+static void init_settings(Settings *settings) {
+    settings->aggregate = 1;
+    settings->fetch_jobs = 8;
+    snprintf(settings->cache_dir, sizeof(settings->cache_dir), "%s", CACHE_DIR);
+    settings->cache_ttl = 86400;
+    settings->refresh_interval = 3600;
+    snprintf(settings->backend, sizeof(settings->backend), "route");
+    snprintf(settings->set_name, sizeof(settings->set_name), "ipban");
+    settings->stats_textfile[0] = '\0';
+    settings->stats_json[0] = '\0';
+    settings->swap_tables[0] = 0;
+    settings->swap_tables[1] = 0;
+    settings->rule_priority = 100;
+    settings->route_table = RT_TABLE_MAIN;
+    settings->route_protocol = ROUTE_PROTOCOL;
+    settings->index_file[0] = '\0';
+    settings->irr_server[0] = '\0';
+    settings->irr_sources[0] = '\0';
+    settings->netns_jobs = 8;
+    settings->xdp_interfaces[0] = '\0';
+    snprintf(settings->xdp_mode, sizeof(settings->xdp_mode), "auto");
+    settings->control_socket[0] = '\0';
+    settings->ban_ttl = 3600;
+    settings->log_threshold = 5;
+    settings->log_window = 600;
+    settings->log_level = LOG_LEVEL_INFO;
+    settings->log_json = 0;
+}
+
+// Parse a boolean option value. Returns 0/1, or -1 if invalid.
+static int parse_bool(const char *value) {
+    if (strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "1") == 0) return 1;
+    if (strcmp(value, "false") == 0 || strcmp(value, "no") == 0 || strcmp(value, "0") == 0) return 0;
+    return -1;
+}
+
+// Copy a (possibly quoted) string option value into dst
+static void parse_string_setting(char *dst, size_t dst_size, const char *key, const char *value, int line_num) {
+    size_t len = strlen(value);
+    if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+        value++;
+        len -= 2;
+    }
+    if (len >= dst_size) {
+        log_warn("Value for '%s' too long on line %d\n", key, line_num);
+        return;
+    }
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+// Apply one key = value line of the [settings] section
+static void parse_setting(Settings *settings, const char *key, const char *value, int line_num) {
+    if (strcmp(key, "aggregate") == 0) {
+        int flag = parse_bool(value);
+        if (flag == -1) {
+            log_warn("Invalid boolean '%s' for '%s' on line %d\n", value, key, line_num);
+        } else {
+            settings->aggregate = flag;
+        }
+    } else if (strcmp(key, "fetch_jobs") == 0) {
+        char *endptr;
+        long jobs = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || jobs < 1 || jobs > 256) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected 1-256)\n", value, key, line_num);
+        } else {
+            settings->fetch_jobs = (int)jobs;
+        }
+    } else if (strcmp(key, "netns_jobs") == 0) {
+        char *endptr;
+        long jobs = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || jobs < 1 || jobs > 256) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected 1-256)\n", value, key, line_num);
+        } else {
+            settings->netns_jobs = (int)jobs;
+        }
+    } else if (strcmp(key, "cache_dir") == 0) {
+        parse_string_setting(settings->cache_dir, sizeof(settings->cache_dir), key, value, line_num);
+    } else if (strcmp(key, "backend") == 0) {
+        parse_string_setting(settings->backend, sizeof(settings->backend), key, value, line_num);
+    } else if (strcmp(key, "set_name") == 0) {
+        parse_string_setting(settings->set_name, sizeof(settings->set_name), key, value, line_num);
+    } else if (strcmp(key, "stats_textfile") == 0) {
+        parse_string_setting(settings->stats_textfile, sizeof(settings->stats_textfile), key, value, line_num);
+    } else if (strcmp(key, "stats_json") == 0) {
+        parse_string_setting(settings->stats_json, sizeof(settings->stats_json), key, value, line_num);
+    } else if (strcmp(key, "index_file") == 0) {
+        parse_string_setting(settings->index_file, sizeof(settings->index_file), key, value, line_num);
+    } else if (strcmp(key, "irr_server") == 0) {
+        parse_string_setting(settings->irr_server, sizeof(settings->irr_server), key, value, line_num);
+    } else if (strcmp(key, "irr_sources") == 0) {
+        parse_string_setting(settings->irr_sources, sizeof(settings->irr_sources), key, value, line_num);
+    } else if (strcmp(key, "control_socket") == 0) {
+        parse_string_setting(settings->control_socket, sizeof(settings->control_socket), key, value, line_num);
+    } else if (strcmp(key, "ban_ttl") == 0) {
+        char *endptr;
+        long seconds = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || seconds < 1 || seconds > (long)BAN_MAX_TTL) {
+            log_warn("Invalid value '%s' for '%s' on line %d\n", value, key, line_num);
+        } else {
+            settings->ban_ttl = seconds;
+        }
+    } else if (strcmp(key, "log_threshold") == 0) {
+        char *endptr;
+        long hits = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || hits < 1 || hits > 65535) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected 1-65535)\n", value, key, line_num);
+        } else {
+            settings->log_threshold = (int)hits;
+        }
+    } else if (strcmp(key, "log_window") == 0) {
+        char *endptr;
+        long seconds = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || seconds < 1 || seconds > 86400) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected 1-86400)\n", value, key, line_num);
+        } else {
+            settings->log_window = seconds;
+        }
+    } else if (strcmp(key, "log_level") == 0) {
+        char name[16] = "";
+        parse_string_setting(name, sizeof(name), key, value, line_num);
+        int level = parse_log_level(name);
+        if (level == -1) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected error, warn, info or debug)\n",
+                     value, key, line_num);
+        } else {
+            settings->log_level = level;
+        }
+    } else if (strcmp(key, "log_format") == 0) {
+        char format[16] = "";
+        parse_string_setting(format, sizeof(format), key, value, line_num);
+        if (strcmp(format, "text") != 0 && strcmp(format, "json") != 0) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected text or json)\n",
+                     value, key, line_num);
+        } else {
+            settings->log_json = strcmp(format, "json") == 0;
+        }
+    } else if (strcmp(key, "xdp_interfaces") == 0) {
+        parse_string_setting(settings->xdp_interfaces, sizeof(settings->xdp_interfaces), key, value, line_num);
+    } else if (strcmp(key, "xdp_mode") == 0) {
+        char mode[16] = "";
+        parse_string_setting(mode, sizeof(mode), key, value, line_num);
+        if (strcmp(mode, "auto") != 0 && strcmp(mode, "native") != 0 && strcmp(mode, "generic") != 0) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected auto, native or generic)\n",
+                     value, key, line_num);
+        } else {
+            snprintf(settings->xdp_mode, sizeof(settings->xdp_mode), "%s", mode);
+        }
+    } else if (strcmp(key, "swap_tables") == 0) {
+        // Two routing table ids, "a,b"; main/default/local are not allowed
+        char text[64] = "";
+        unsigned int a, b;
+        char extra;
+        parse_string_setting(text, sizeof(text), key, value, line_num);
+        if (sscanf(text, "%u,%u%c", &a, &b, &extra) != 2 || a == b || a == 0 || b == 0 ||
+            (a >= RT_TABLE_DEFAULT && a <= RT_TABLE_LOCAL) || (b >= RT_TABLE_DEFAULT && b <= RT_TABLE_LOCAL)) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected two table ids, e.g. \"1001,1002\")\n",
+                     value, key, line_num);
+        } else {
+            settings->swap_tables[0] = a;
+            settings->swap_tables[1] = b;
+        }
+    } else if (strcmp(key, "rule_priority") == 0) {
+        char *endptr;
+        long priority = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || priority < 1 || priority > 32765) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected 1-32765)\n", value, key, line_num);
+        } else {
+            settings->rule_priority = (uint32_t)priority;
+        }
+    } else if (strcmp(key, "route_table") == 0) {
+        char *endptr;
+        unsigned long table = strcmp(value, "main") == 0 ? RT_TABLE_MAIN : strtoul(value, &endptr, 10);
+        if ((strcmp(value, "main") != 0 && *endptr != '\0') || table == 0 || table > UINT32_MAX ||
+            table == RT_TABLE_DEFAULT || table == RT_TABLE_LOCAL) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected a table id or main)\n",
+                     value, key, line_num);
+        } else {
+            settings->route_table = (uint32_t)table;
+        }
+    } else if (strcmp(key, "route_protocol") == 0) {
+        // Below 3 are the kernel's own (unspec, redirect, kernel)
+        char *endptr;
+        long protocol = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || protocol < RTPROT_BOOT || protocol > 255) {
+            log_warn("Invalid value '%s' for '%s' on line %d (expected 3-255)\n", value, key, line_num);
+        } else {
+            settings->route_protocol = (int)protocol;
+        }
+    } else if (strcmp(key, "cache_ttl") == 0 || strcmp(key, "refresh_interval") == 0) {
+        char *endptr;
+        long seconds = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || seconds < 0 || (seconds == 0 && strcmp(key, "refresh_interval") == 0)) {
+            log_warn("Invalid value '%s' for '%s' on line %d\n", value, key, line_num);
+        } else if (strcmp(key, "cache_ttl") == 0) {
+            settings->cache_ttl = seconds;
+        } else {
+            settings->refresh_interval = seconds;
+        }
+    } else {
+        log_warn("Unknown setting '%s' on line %d\n", key, line_num);
+    }
+}
+
+// --- Mapped files ---
+
+// Map a whole file read-only. An empty file gives data == NULL, size == 0.
+// Returns 0 on success, -1 on error (errno is set, nothing is printed).
+int map_file(const char *path, MappedFile *file) {
+    file->data = NULL;
+    file->size = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        file->data = (const char *)map;
+        file->size = (size_t)st.st_size;
+    }
+    close(fd);
+    return 0;
+}
+
+void unmap_file(MappedFile *file) {
+    if (file->data) munmap((void *)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+// --- Config scanner ---
+//
+// Files are scanned in place: values are views into the mapping, and only
+// single items (a prefix, an ASN, a setting) are copied to the stack to be
+// NUL-terminated. Lists may span several lines and '#' or ';' starts a comment
+// anywhere outside a string.
+
+typedef struct {
+    const char *p;      // Current position
+    const char *end;
+    int line;           // Line number at p
+} Scanner;
+
+typedef struct {
+    const char *text;
+    size_t len;
+    int line;
+} Token;
+
+// What the items of a value are used for
+enum { TARGET_NONE, TARGET_ROUTES, TARGET_ROUTES_FILE, TARGET_ASNS, TARGET_PATHS, TARGET_NAMES, TARGET_COUNTRIES,
+       TARGET_SETTING };
+
+typedef struct {
+    int kind;
+    RouteArray *routes;         // TARGET_ROUTES, TARGET_ROUTES_FILE
+    RouteArray *routes_v6;      // If set, IPv6 items go here and IPv4 ones to routes ([allow])
+    AsnArray *asns;             // TARGET_ASNS
+    StringArray *strings;       // TARGET_PATHS, TARGET_NAMES, TARGET_COUNTRIES
+    Settings *settings;         // TARGET_SETTING
+    const char *key;
+    const char *config_path;    // Relative prefix file paths are resolved against it
+} ValueTarget;
+
+static int is_comment(char c) {
+    return c == '#' || c == ';';
+}
+
+// Skip spaces and tabs
+static void skip_space(Scanner *s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\r')) s->p++;
+}
+
+// Skip the rest of the current line including its newline
+static void skip_line(Scanner *s) {
+    const char *newline = (const char *)memchr(s->p, '\n', s->end - s->p);
+    if (newline) {
+        s->p = newline + 1;
+        s->line++;
+    } else {
+        s->p = s->end;
+    }
+}
+
+// Skip whitespace, line breaks and comments
+static void skip_blank(Scanner *s) {
+    for (;;) {
+        skip_space(s);
+        if (s->p >= s->end) return;
+        if (*s->p == '\n') {
+            s->p++;
+            s->line++;
+        } else if (is_comment(*s->p)) {
+            skip_line(s);
+        } else {
+            return;
+        }
+    }
+}
+
+// True if only blanks or a comment are left on the current line
+static int at_line_end(Scanner *s) {
+    skip_space(s);
+    return s->p >= s->end || *s->p == '\n' || is_comment(*s->p);
+}
+
+// Read a quoted string or a bare word. Returns 0, or -1 if malformed.
+static int scan_scalar(Scanner *s, Token *tok) {
+    tok->line = s->line;
+    if (s->p < s->end && (*s->p == '"' || *s->p == '\'')) {
+        char quote = *s->p++;
+        tok->text = s->p;
+        while (s->p < s->end && *s->p != quote && *s->p != '\n') {
+            if (*s->p == '\\' && quote == '"') {
+                log_warn("Escape sequences are not supported, on line %d\n", s->line);
+                return -1;
+            }
+            s->p++;
+        }
+        if (s->p >= s->end || *s->p != quote) {
+            log_warn("Unterminated string on line %d\n", tok->line);
+            return -1;
+        }
+        tok->len = s->p - tok->text;
+        s->p++;
+        return 0;
+    }
+    tok->text = s->p;
+    while (s->p < s->end && !isspace((unsigned char)*s->p) && *s->p != ',' && *s->p != ']' &&
+           !is_comment(*s->p)) {
+        s->p++;
+    }
+    tok->len = s->p - tok->text;
+    if (tok->len == 0) {
+        log_warn("Missing value on line %d\n", tok->line);
+        return -1;
+    }
+    return 0;
+}
+
+// NUL-terminated copy of a token. Returns 0, or -1 if it does not fit.
+static int token_copy(const Token *tok, char *buf, size_t buf_size) {
+    if (tok->len >= buf_size) return -1;
+    memcpy(buf, tok->text, tok->len);
+    buf[tok->len] = '\0';
+    return 0;
+}
+
+// Resolve a path given in the config relative to the config file's directory
+static void resolve_path(const char *config_path, const char *path, char *out, size_t out_size) {
+    const char *slash = strrchr(config_path, '/');
+    if (path[0] == '/' || !slash) {
+        snprintf(out, out_size, "%s", path);
+    } else {
+        snprintf(out, out_size, "%.*s/%s", (int)(slash - config_path), config_path, path);
+    }
+}
+
+// Add "addr/len" to routes, or to routes_v6 (if not NULL) when it is IPv6
+static int add_route_to(RouteArray *routes, RouteArray *routes_v6, const char *text) {
+    return add_route(routes_v6 && strchr(text, ':') ? routes_v6 : routes, text);
+}
+
+// Read a plain-text prefix file into routes, with the same syntax as feeds
+// (parse_prefix_line). With routes_v6, IPv6 prefixes go there instead; without,
+// prefixes of the other family are invalid.
+// Returns the number of new prefixes, or -1 if the file cannot be read.
+int load_prefix_file(const char *path, RouteArray *routes, RouteArray *routes_v6) {
+    MappedFile file;
+    if (map_file(path, &file) == -1) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Failed to open prefix file '%s'", path);
+        log_errno(error_buf);
+        return -1;
+    }
+    const char *p = file.data, *end = file.data + file.size;
+    int added = 0, invalid = 0, line_num = 0;
+    while (p < end) {
+        const char *line_end = (const char *)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        line_num++;
+        Prefix prefix;
+        const char *entry;
+        size_t len;
+        int ret = parse_prefix_line(p, line_end, &prefix, &entry, &len);
+        p = line_end + 1;
+        if (ret == 1) {
+            RouteArray *target = routes_v6 && prefix.family == AF_INET6 ? routes_v6 : routes;
+            if (prefix.family == target->family) {
+                added += add_prefix(target, &prefix);
+                continue;
+            }
+        }
+        if (ret != 0 && invalid++ < MAX_INVALID_REPORTED) {
+            log_warn("Invalid route format '%.*s' in %s line %d\n", (int)(len > 64 ? 64 : len), entry, path, line_num);
+        }
+    }
+    unmap_file(&file);
+    if (invalid > MAX_INVALID_REPORTED) {
+        log_warn("%d invalid lines in %s\n", invalid, path);
+    }
+    log_info("Loaded %d new prefixes from %s\n", added, path);
+    return added;
+}
+
+// Use one item of a value according to target
+static void handle_item(const ValueTarget *target, const Token *tok) {
+    char buf[512];
+    if (target->kind == TARGET_NONE) return;
+    if (token_copy(tok, buf, sizeof(buf)) == -1) {
+        log_warn("Value for '%s' too long on line %d\n", target->key, tok->line);
+        return;
+    }
+    switch (target->kind) {
+    case TARGET_ROUTES:
+        // Parsed into binary form, so differently spelled duplicates collapse too
+        if (add_route_to(target->routes, target->routes_v6, buf) == -1) {
+            log_warn("Invalid route format '%s' on line %d\n", buf, tok->line);
+        }
+        break;
+    case TARGET_ROUTES_FILE: {
+        char path[4096];
+        resolve_path(target->config_path, buf, path, sizeof(path));
+        load_prefix_file(path, target->routes, target->routes_v6);
+        break;
+    }
+    case TARGET_ASNS:
+        if (asn_number(buf)) {
+            add_asn(target->asns, buf); // Original format (with AS if present)
+        } else {
+            log_warn("Invalid ASN format '%s' on line %d\n", buf, tok->line);
+        }
+        break;
+    case TARGET_PATHS: {
+        char path[4096];
+        resolve_path(target->config_path, buf, path, sizeof(path));
+        add_string(target->strings, path);
+        break;
+    }
+    case TARGET_NAMES:
+        add_string(target->strings, buf); // Used as they are
+        break;
+    case TARGET_COUNTRIES: {
+        char cc[3];
+        if (parse_country(buf, cc) == 0) {
+            add_string(target->strings, cc);
+        } else {
+            log_warn("Invalid country code '%s' on line %d\n", buf, tok->line);
+        }
+        break;
+    }
+    case TARGET_SETTING:
+        parse_setting(target->settings, target->key, buf, tok->line);
+        break;
+    }
+}
+
+// Parse the value after '=': a single item or a list, which may span lines.
+// Returns 0, or -1 on a syntax error.
+static int parse_value(Scanner *s, ValueTarget *target) {
+    Token tok;
+    skip_space(s);
+    if (s->p < s->end && *s->p == '[') {
+        int start_line = s->line;
+        if (target->kind == TARGET_SETTING) {
+            log_warn("Setting '%s' does not take a list, on line %d\n", target->key, start_line);
+            target->kind = TARGET_NONE;
+        }
+        s->p++;
+        for (;;) {
+            skip_blank(s);
+            if (s->p >= s->end) {
+                log_warn("Unterminated list starting on line %d\n", start_line);
+                return -1;
+            }
+            if (*s->p == ']') {
+                s->p++;
+                return 0;
+            }
+            if (scan_scalar(s, &tok) == -1) return -1;
+            handle_item(target, &tok);
+            skip_blank(s);
+            if (s->p < s->end && *s->p == ',') {
+                s->p++;
+            } else if (s->p < s->end && *s->p != ']') {
+                log_warn("Expected ',' or ']' in list on line %d\n", s->line);
+                return -1;
+            }
+        }
+    }
+    if (at_line_end(s)) {
+        log_warn("Missing value for '%s' on line %d\n", target->key, s->line);
+        return -1;
+    }
+    if (scan_scalar(s, &tok) == -1) return -1;
+    handle_item(target, &tok);
+    return 0;
+}
+
+// Read the configuration file (routes, ASNs, feeds, allowed prefixes, namespaces, log watching, countries
+// and settings) into the initialized parts of out
+static int read_config(const char *filename, Config *out) {
+    MappedFile file;
+    if (map_file(filename, &file) == -1) {
+        char error_buf[512];
+        snprintf(error_buf, sizeof(error_buf), "Failed to open configuration file '%s'", filename);
+        log_errno(error_buf);
+        return -1;
+    }
+
+    Scanner s = { file.data, file.data + file.size, 1 };
+    char current_section[256] = "";
+    for (;;) {
+        skip_blank(&s);
+        if (s.p >= s.end) break;
+        int line_num = s.line;
+
+        // Section header
+        if (*s.p == '[') {
+            const char *line_end = (const char *)memchr(s.p, '\n', s.end - s.p);
+            if (!line_end) line_end = s.end;
+            const char *close = (const char *)memchr(s.p, ']', line_end - s.p);
+            if (!close) {
+                log_warn("Malformed section header on line %d\n", line_num);
+                skip_line(&s);
+                continue;
+            }
+            Token name = { s.p + 1, close - s.p - 1, line_num };
+            while (name.len > 0 && isspace((unsigned char)*name.text)) {
+                name.text++;
+                name.len--;
+            }
+            while (name.len > 0 && isspace((unsigned char)name.text[name.len - 1])) name.len--;
+            if (token_copy(&name, current_section, sizeof(current_section)) == -1) {
+                log_warn("Section name too long on line %d\n", line_num);
+                current_section[0] = '\0';
+            }
+            s.p = close + 1;
+            if (!at_line_end(&s)) log_warn("Unexpected text after section header on line %d\n", line_num);
+            skip_line(&s);
+            continue;
+        }
+
+        // key = value
+        char key[64];
+        Token key_tok = { s.p, 0, line_num };
+        while (s.p < s.end && (isalnum((unsigned char)*s.p) || *s.p == '_' || *s.p == '-')) s.p++;
+        key_tok.len = s.p - key_tok.text;
+        skip_space(&s);
+        if (key_tok.len == 0 || s.p >= s.end || *s.p != '=' || token_copy(&key_tok, key, sizeof(key)) == -1) {
+            log_warn("Expected 'key = value' on line %d\n", line_num);
+            skip_line(&s);
+            continue;
+        }
+        s.p++; // Skip '='
+
+        ValueTarget target = { TARGET_NONE, NULL, NULL, &out->asns, NULL, &out->settings, key, filename };
+        int allow = strcmp(current_section, "allow") == 0;
+        RouteArray *section_routes = strcmp(current_section, "ipv4_routes") == 0 ? &out->routes_v4 :
+                                     strcmp(current_section, "ipv6_routes") == 0 ? &out->routes_v6 :
+                                     allow ? &out->allow_v4 : NULL;
+        if (allow) target.routes_v6 = &out->allow_v6; // Mixed families
+        if (strcmp(current_section, "settings") == 0) {
+            target.kind = TARGET_SETTING;
+        } else if (section_routes && strcmp(key, "routes") == 0) {
+            target.kind = TARGET_ROUTES;
+            target.routes = section_routes;
+        } else if (section_routes && (strcmp(key, "routes_file") == 0 || strcmp(key, "include") == 0)) {
+            target.kind = TARGET_ROUTES_FILE;
+            target.routes = section_routes;
+        } else if (strcmp(current_section, "asn_block") == 0 && strcmp(key, "as_numbers") == 0) {
+            target.kind = TARGET_ASNS;
+        } else if (strcmp(current_section, "feeds") == 0 && strcmp(key, "files") == 0) {
+            target.kind = TARGET_PATHS;
+            target.strings = &out->feeds;
+        } else if (strcmp(current_section, "namespaces") == 0 && strcmp(key, "names") == 0) {
+            target.kind = TARGET_NAMES;
+            target.strings = &out->namespaces;
+        } else if (strcmp(current_section, "logwatch") == 0 && strcmp(key, "files") == 0) {
+            target.kind = TARGET_PATHS;
+            target.strings = &out->log_files;
+        } else if (strcmp(current_section, "logwatch") == 0 && strcmp(key, "patterns") == 0) {
+            target.kind = TARGET_NAMES;
+            target.strings = &out->log_patterns;
+        } else if (strcmp(current_section, "geo_block") == 0 && strcmp(key, "countries") == 0) {
+            target.kind = TARGET_COUNTRIES;
+            target.strings = &out->geo_countries;
+        } else if (strcmp(current_section, "geo_block") == 0 && strcmp(key, "files") == 0) {
+            target.kind = TARGET_PATHS;
+            target.strings = &out->geo_files;
+        }
+        // Values of unknown keys are parsed as well, so their lists are skipped correctly
+
+        if (parse_value(&s, &target) == 0 && !at_line_end(&s)) {
+            log_warn("Unexpected text after value on line %d\n", s.line);
+        }
+        skip_line(&s);
+    }
+
+    unmap_file(&file);
+    return 0;
+}
+
+
+// Initialize all parts of a Config and read the configuration file into it
+int load_config(const char *filename, Config *config) {
+    init_route_array(&config->routes_v4, AF_INET, 1024);
+    init_route_array(&config->routes_v6, AF_INET6, 1024);
+    init_asn_array(&config->asns, 10);
+    init_string_array(&config->feeds, 4);
+    init_route_array(&config->allow_v4, AF_INET, 64);
+    init_route_array(&config->allow_v6, AF_INET6, 64);
+    init_string_array(&config->namespaces, 4);
+    init_string_array(&config->log_files, 4);
+    init_string_array(&config->log_patterns, 4);
+    init_string_array(&config->geo_countries, 4);
+    init_string_array(&config->geo_files, 4);
+    init_settings(&config->settings);
+    if (read_config(filename, config) == -1) {
+        free_config(config);
+        return -1;
+    }
+    return 0;
+}
+
+// Free memory for Config
+void free_config(Config *config) {
+    free_route_array(&config->routes_v4);
+    free_route_array(&config->routes_v6);
+    free_asn_array(&config->asns);
+    free_string_array(&config->feeds);
+    free_route_array(&config->allow_v4);
+    free_route_array(&config->allow_v6);
+    free_string_array(&config->namespaces);
+    free_string_array(&config->log_files);
+    free_string_array(&config->log_patterns);
+    free_string_array(&config->geo_countries);
+    free_string_array(&config->geo_files);
+}
+
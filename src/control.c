@@ -0,0 +1,235 @@
+#define _GNU_SOURCE // For accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- Control socket ---
+//
+// A Unix stream socket of the daemon for runtime bans. Clients send one command
+// per line and may pipeline as many as they like; all complete lines of a read
+// are handled before the daemon applies anything. Successful ban/unban commands
+// are not answered, so a client can stream events without reading:
+//
+//   ban <addr>[/<len>] [<ttl seconds>]   ban (or extend) for ttl, default ban_ttl
+//   unban <addr>[/<len>]
+//   flush                                answered "ok" once pending changes are applied
+//   status                               answered "bans <ipv4> <ipv6>"
+//
+// Errors are answered "error: <message>". A client that does not read its
+// answers is disconnected once the socket buffer is full.
+
+#define CONTROL_LINE_MAX 256
+#define CONTROL_READ_SIZE 65536
+
+int control_open(ControlServer *server, const char *path) {
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_error("control_socket path too long: %s\n", path);
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    snprintf(server->path, sizeof(server->path), "%s", path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        log_errno("Failed to create control socket");
+        return -1;
+    }
+    unlink(path); // Left over from an earlier run
+    mode_t old_mask = umask(0117); // rw for owner and group only
+    int ret = bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (ret < 0 || listen(server->listen_fd, 64) < 0) {
+        char error_buf[300];
+        snprintf(error_buf, sizeof(error_buf), "Failed to listen on control socket %s", path);
+        log_errno(error_buf);
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void drop_client(ControlServer *server, int i) {
+    close(server->clients[i].fd);
+    free(server->clients[i].rest);
+    server->clients[i] = server->clients[--server->client_count];
+}
+
+void control_close(ControlServer *server) {
+    while (server->client_count > 0) drop_client(server, 0);
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        unlink(server->path);
+    }
+    server->listen_fd = -1;
+}
+
+int control_pollfds(const ControlServer *server, struct pollfd *fds) {
+    if (server->listen_fd < 0) return 0;
+    fds[0] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+    for (int i = 0; i < server->client_count; i++) {
+        // A client waiting for "flush" is not read until it is answered
+        fds[1 + i] = (struct pollfd){ .fd = server->clients[i].fd, .events = server->clients[i].flush_wait ? 0 : POLLIN };
+    }
+    return 1 + server->client_count;
+}
+
+// Queue an answer; returns -1 if the client cannot keep up
+static int reply(ControlClient *client, const char *text) {
+    ssize_t n = send(client->fd, text, strlen(text), MSG_DONTWAIT | MSG_NOSIGNAL);
+    return n == (ssize_t)strlen(text) ? 0 : -1;
+}
+
+// "addr" or "addr/len" of either family
+static int parse_ban_target(const char *text, Prefix *prefix) {
+    char buf[CONTROL_LINE_MAX];
+    int family = strchr(text, ':') ? AF_INET6 : AF_INET;
+    if (strchr(text, '/')) return parse_prefix(text, family, prefix);
+    snprintf(buf, sizeof(buf), "%s/%d", text, family == AF_INET ? 32 : 128);
+    return parse_prefix(buf, family, prefix);
+}
+
+// Handle one command line. Returns -1 if the client should be dropped.
+static int handle_line(ControlServer *server, ControlClient *client, char *line, BanStore *bans, long ttl) {
+    char *save = NULL;
+    char *cmd = strtok_r(line, " \t\r", &save);
+    char *arg = strtok_r(NULL, " \t\r", &save);
+    char *arg2 = strtok_r(NULL, " \t\r", &save);
+    char answer[128];
+    Prefix prefix;
+    if (!cmd) return 0;
+    if (strcmp(cmd, "ban") == 0 || strcmp(cmd, "unban") == 0) {
+        if (!arg || parse_ban_target(arg, &prefix) == -1) {
+            snprintf(answer, sizeof(answer), "error: invalid address '%.64s'\n", arg ? arg : "");
+            return reply(client, answer);
+        }
+        if (cmd[0] == 'u') {
+            ban_remove(bans, &prefix);
+            server->pending = 1;
+            return 0;
+        }
+        if (arg2) {
+            char *end;
+            long value = strtol(arg2, &end, 10);
+            if (*end != '\0' || value < 1) {
+                snprintf(answer, sizeof(answer), "error: invalid ttl '%.32s'\n", arg2);
+                return reply(client, answer);
+            }
+            ttl = value;
+        }
+        if (ban_add(bans, &prefix, ttl > (long)BAN_MAX_TTL ? BAN_MAX_TTL : (uint32_t)ttl)) {
+            stats_add(STAT_BANS_ADDED, 1);
+        }
+        server->pending = 1;
+        return 0;
+    }
+    if (strcmp(cmd, "flush") == 0) {
+        client->flush_wait = 1;
+        server->flush_requested = 1;
+        return 0;
+    }
+    if (strcmp(cmd, "status") == 0) {
+        snprintf(answer, sizeof(answer), "bans %zu %zu\n", bans->active[0], bans->active[1]);
+        return reply(client, answer);
+    }
+    snprintf(answer, sizeof(answer), "error: unknown command '%.32s'\n", cmd);
+    return reply(client, answer);
+}
+
+// Handle the complete lines in data. After a "flush" the rest is kept until it
+// is answered, so answers stay in order. Returns -1 to drop the client.
+static int handle_input(ControlServer *server, ControlClient *client, const char *data, size_t len,
+                        BanStore *bans, long ttl) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != '\n') {
+            if (client->len < CONTROL_LINE_MAX - 1) client->line[client->len] = data[i];
+            client->len++;
+            continue;
+        }
+        if (client->len >= CONTROL_LINE_MAX) {
+            client->len = 0;
+            if (reply(client, "error: line too long\n") == -1) return -1;
+            continue;
+        }
+        client->line[client->len] = '\0';
+        client->len = 0;
+        if (handle_line(server, client, client->line, bans, ttl) == -1) return -1;
+        if (client->flush_wait && i + 1 < len) {
+            client->rest = (char*)malloc(len - i - 1);
+            if (!client->rest) {
+                log_errno("Failed to allocate memory for control input");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(client->rest, data + i + 1, len - i - 1);
+            client->rest_len = len - i - 1;
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Read what a client sent and handle it. Returns -1 to drop the client.
+static int read_client(ControlServer *server, ControlClient *client, BanStore *bans, long ttl) {
+    char buf[CONTROL_READ_SIZE];
+    ssize_t n = read(client->fd, buf, sizeof(buf));
+    if (n == 0) return -1;
+    if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    return handle_input(server, client, buf, (size_t)n, bans, ttl);
+}
+
+void control_handle(ControlServer *server, const struct pollfd *fds, BanStore *bans, long ttl) {
+    if (server->listen_fd < 0) return;
+    // Clients first: accepting may reorder the client array
+    for (int i = server->client_count - 1; i >= 0; i--) {
+        if (server->clients[i].flush_wait || !(fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        if (read_client(server, &server->clients[i], bans, ttl) == -1) drop_client(server, i);
+    }
+    if (fds[0].revents & POLLIN) {
+        int fd;
+        while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            if (server->client_count == CONTROL_MAX_CLIENTS) {
+                log_warn("Too many control clients, refusing a connection.\n");
+                close(fd);
+                continue;
+            }
+            ControlClient *client = &server->clients[server->client_count++];
+            memset(client, 0, sizeof(*client));
+            client->fd = fd;
+        }
+    }
+}
+
+void control_flushed(ControlServer *server, BanStore *bans, long ttl) {
+    server->flush_requested = 0;
+    for (int i = server->client_count - 1; i >= 0; i--) {
+        ControlClient *client = &server->clients[i];
+        if (!client->flush_wait) continue;
+        client->flush_wait = 0;
+        if (reply(client, "ok\n") == -1) {
+            drop_client(server, i);
+            continue;
+        }
+        // Go on with what the client sent after the flush
+        char *rest = client->rest;
+        size_t rest_len = client->rest_len;
+        client->rest = NULL;
+        client->rest_len = 0;
+        int ret = rest ? handle_input(server, client, rest, rest_len, bans, ttl) : 0;
+        free(rest);
+        if (ret == -1) drop_client(server, i);
+    }
+}
@@ -0,0 +1,945 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <libgen.h>          // For dirname/basename
+#include <netinet/in.h>      // For AF_INET/AF_INET6
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <linux/rtnetlink.h> // For RTM_NEWROUTE/RTM_DELROUTE
+
+#include "ipban.h"
+
+// --- Daemon mode ---
+//
+// All prefix sources (direct config routes, each ASN, feed and country) are kept in
+// memory and folded into a reference-counted set per family. A config change, a
+// feed update or an ASN refresh only updates the sources that changed, and the
+// kernel only receives the difference between the new desired set and what was
+// applied last.
+
+typedef struct {
+    char *asn;              // As written in the config
+    PrefixList v4;          // Sorted, unique prefixes currently contributed
+    PrefixList v6;
+} AsnState;
+
+typedef struct {
+    FeedState state;
+    PrefixList v4;          // Sorted, unique prefixes currently contributed
+    PrefixList v6;
+} FeedSource;
+
+typedef struct {
+    const char *config_file;
+    Settings settings;
+    PrefixList config_v4;   // Direct routes of the loaded config, sorted
+    PrefixList config_v6;
+    PrefixList allow_v4;    // [allow] prefixes of the loaded config, sorted
+    PrefixList allow_v6;
+    AsnState *asns;
+    int asn_count;
+    int asn_capacity;
+    FeedSource *feeds;
+    int feed_count;
+    int feed_capacity;
+    StringArray geo_countries; // [geo_block] of the loaded config
+    StringArray geo_files;
+    PrefixList *geo_lists;  // IPv4 and IPv6 prefixes currently contributed per country
+    PrefixMultiset raw_v4;  // All sources combined
+    PrefixMultiset raw_v6;
+    PrefixList applied_v4;  // What was last programmed into the kernel
+    PrefixList applied_v6;
+    Backend backend;
+    NetnsSet netns;         // Extra network namespaces, programmed after ours
+    BanStore bans;          // Runtime bans from the control socket
+    ControlServer control;
+    LogWatch logs;          // [logwatch] files feeding runtime bans
+    int flush_armed;        // Ban changes wait for the flush timer
+    int force_full;         // Last apply failed, the live state is unknown
+    int inotify_fd;         // Watches the config directory and the feed directories
+    int config_wd;
+
+    // Background ASN refresh
+    pthread_t refresh_thread;
+    int refresh_running;
+    int refresh_done_fd;    // eventfd signalled when the refresh thread is done
+    Settings refresh_settings;
+    AsnArray refresh_asns;
+    AsnPrefixes *refresh_results;
+} Daemon;
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Replace the prefixes of one source (current) by next and move the reference
+// counts accordingly. next is consumed. Returns the number of prefixes that changed.
+static size_t update_source(PrefixMultiset *raw, PrefixList *current, PrefixList *next) {
+    PrefixList to_add, to_remove;
+    init_prefix_list(&to_add, 16);
+    init_prefix_list(&to_remove, 16);
+    diff_prefix_lists(next, current, &to_add, &to_remove);
+    prefix_multiset_update(raw, &to_add, 1);
+    prefix_multiset_update(raw, &to_remove, -1);
+    size_t changed = to_add.count + to_remove.count;
+    free_prefix_list(&to_add);
+    free_prefix_list(&to_remove);
+    free_prefix_list(current);
+    *current = *next;
+    return changed;
+}
+
+// Find the state of an ASN ("AS1234" and "1234" are the same ASN)
+static AsnState *find_asn(Daemon *d, const char *asn) {
+    const char *num = asn_number(asn);
+    if (!num) return NULL;
+    for (int i = 0; i < d->asn_count; i++) {
+        if (strcmp(asn_number(d->asns[i].asn), num) == 0) return &d->asns[i];
+    }
+    return NULL;
+}
+
+// Take over fetched prefixes of a newly configured ASN
+static void add_asn_state(Daemon *d, const char *asn, AsnPrefixes *fetched) {
+    if (d->asn_count >= d->asn_capacity) {
+        int new_capacity = d->asn_capacity ? d->asn_capacity * 2 : 16;
+        AsnState *new_asns = (AsnState*)realloc(d->asns, new_capacity * sizeof(AsnState));
+        if (!new_asns) {
+            log_errno("Failed to reallocate memory for ASN state");
+            exit(EXIT_FAILURE);
+        }
+        d->asns = new_asns;
+        d->asn_capacity = new_capacity;
+    }
+    AsnState *state = &d->asns[d->asn_count++];
+    state->asn = strdup(asn);
+    if (!state->asn) {
+        log_errno("Failed to duplicate ASN string");
+        exit(EXIT_FAILURE);
+    }
+    init_prefix_list(&state->v4, 16);
+    init_prefix_list(&state->v6, 16);
+    stats_source("asn", asn, fetched->v4.count, fetched->v6.count, fetched->seconds, fetched->cached, fetched->failed);
+    update_source(&d->raw_v4, &state->v4, &fetched->v4);
+    update_source(&d->raw_v6, &state->v6, &fetched->v6);
+}
+
+// Re-read a feed if its file changed and move its prefixes in the combined sets.
+// A feed that cannot be read keeps its previous prefixes. Returns the number of
+// prefixes that changed.
+static size_t update_feed(Daemon *d, FeedSource *feed) {
+    PrefixList next_v4, next_v6;
+    init_prefix_list(&next_v4, 1024);
+    init_prefix_list(&next_v6, 1024);
+    int ret = load_feed(&feed->state, &d->settings, &next_v4, &next_v6);
+    if (ret != 1) {
+        // Unchanged, or unreadable and keeping its previous prefixes
+        stats_source("feed", feed->state.path, feed->v4.count, feed->v6.count, 0, 0, ret == -1);
+        free_prefix_list(&next_v4);
+        free_prefix_list(&next_v6);
+        return 0;
+    }
+    stats_source("feed", feed->state.path, next_v4.count, next_v6.count, 0, 0, 0);
+    size_t changed = update_source(&d->raw_v4, &feed->v4, &next_v4);
+    changed += update_source(&d->raw_v6, &feed->v6, &next_v6);
+    log_info("Feed %s: %zu prefixes changed\n", feed->state.path, changed);
+    return changed;
+}
+
+// Check all feeds for changes. Returns the number of prefixes that changed.
+static size_t refresh_feeds(Daemon *d) {
+    size_t changed = 0;
+    for (int i = 0; i < d->feed_count; i++) {
+        changed += update_feed(d, &d->feeds[i]);
+    }
+    return changed;
+}
+
+// Watch the directory of a feed; feeds are usually replaced by a rename
+static void watch_feed(Daemon *d, const char *path) {
+    char dir_buf[4096];
+    snprintf(dir_buf, sizeof(dir_buf), "%s", path);
+    if (inotify_add_watch(d->inotify_fd, dirname(dir_buf), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_warn("Cannot watch the directory of feed %s, changes are picked up on refresh only.\n", path);
+    }
+}
+
+// Sync the feeds with the configured list: removed feeds are dropped, new ones
+// read and the others re-checked
+static void sync_feeds(Daemon *d, const StringArray *paths) {
+    for (int i = 0; i < d->feed_count; ) {
+        FeedSource *feed = &d->feeds[i];
+        int still_listed = 0;
+        for (int j = 0; j < paths->count && !still_listed; j++) {
+            still_listed = strcmp(paths->items[j], feed->state.path) == 0;
+        }
+        if (still_listed) {
+            i++;
+            continue;
+        }
+        PrefixList empty_v4, empty_v6;
+        init_prefix_list(&empty_v4, 1);
+        init_prefix_list(&empty_v6, 1);
+        update_source(&d->raw_v4, &feed->v4, &empty_v4);
+        update_source(&d->raw_v6, &feed->v6, &empty_v6);
+        log_info("Feed %s removed from config.\n", feed->state.path);
+        stats_remove_source("feed", feed->state.path);
+        free_feed_state(&feed->state);
+        free_prefix_list(&feed->v4);
+        free_prefix_list(&feed->v6);
+        d->feeds[i] = d->feeds[--d->feed_count];
+    }
+
+    for (int j = 0; j < paths->count; j++) {
+        FeedSource *feed = NULL;
+        for (int i = 0; i < d->feed_count && !feed; i++) {
+            if (strcmp(d->feeds[i].state.path, paths->items[j]) == 0) feed = &d->feeds[i];
+        }
+        if (!feed) {
+            if (d->feed_count >= d->feed_capacity) {
+                int new_capacity = d->feed_capacity ? d->feed_capacity * 2 : 8;
+                FeedSource *new_feeds = (FeedSource*)realloc(d->feeds, new_capacity * sizeof(FeedSource));
+                if (!new_feeds) {
+                    log_errno("Failed to reallocate memory for feed state");
+                    exit(EXIT_FAILURE);
+                }
+                d->feeds = new_feeds;
+                d->feed_capacity = new_capacity;
+            }
+            feed = &d->feeds[d->feed_count++];
+            init_feed_state(&feed->state, paths->items[j]);
+            init_prefix_list(&feed->v4, 16);
+            init_prefix_list(&feed->v6, 16);
+            watch_feed(d, paths->items[j]);
+        }
+        update_feed(d, feed);
+    }
+}
+
+// Resolve the countries from the delegated-stats files again and move their
+// prefixes in the combined sets; countries no longer listed (compared with
+// d->geo_countries) are dropped. If a file cannot be read, countries already
+// known keep their previous prefixes. Returns the number of prefixes that changed.
+static size_t update_geo(Daemon *d, const StringArray *countries, const StringArray *files) {
+    int count = countries->count;
+    PrefixList *next = (PrefixList*)calloc(count > 0 ? 2 * count : 1, sizeof(PrefixList));
+    PrefixList *lists = (PrefixList*)calloc(count > 0 ? 2 * count : 1, sizeof(PrefixList));
+    int *kept = (int*)calloc(d->geo_countries.count > 0 ? d->geo_countries.count : 1, sizeof(int));
+    if (!next || !lists || !kept) {
+        log_errno("Failed to allocate memory for country prefixes");
+        exit(EXIT_FAILURE);
+    }
+    if (count > 0 && files->count == 0) {
+        log_warn("[geo_block] lists countries but no files to resolve them from.\n");
+    }
+    int failed = count > 0 ? load_geo(files, countries, &d->settings, next) : 0;
+    size_t changed = 0;
+    for (int i = 0; i < count; i++) {
+        int old = -1;
+        for (int j = 0; j < d->geo_countries.count && old == -1; j++) {
+            if (strcmp(d->geo_countries.items[j], countries->items[i]) == 0) old = j;
+        }
+        if (old != -1) {
+            lists[2 * i] = d->geo_lists[2 * old];
+            lists[2 * i + 1] = d->geo_lists[2 * old + 1];
+            kept[old] = 1;
+        } else {
+            init_prefix_list(&lists[2 * i], 16);
+            init_prefix_list(&lists[2 * i + 1], 16);
+        }
+        if (failed && old != -1) {
+            free_prefix_list(&next[2 * i]);
+            free_prefix_list(&next[2 * i + 1]);
+        } else {
+            changed += update_source(&d->raw_v4, &lists[2 * i], &next[2 * i]);
+            changed += update_source(&d->raw_v6, &lists[2 * i + 1], &next[2 * i + 1]);
+        }
+        stats_source("geo", countries->items[i], lists[2 * i].count, lists[2 * i + 1].count, 0, 0, failed > 0);
+    }
+    for (int j = 0; j < d->geo_countries.count; j++) {
+        if (kept[j]) continue;
+        PrefixList empty_v4, empty_v6;
+        init_prefix_list(&empty_v4, 1);
+        init_prefix_list(&empty_v6, 1);
+        changed += update_source(&d->raw_v4, &d->geo_lists[2 * j], &empty_v4);
+        changed += update_source(&d->raw_v6, &d->geo_lists[2 * j + 1], &empty_v6);
+        free_prefix_list(&d->geo_lists[2 * j]);
+        free_prefix_list(&d->geo_lists[2 * j + 1]);
+        log_info("Country %s removed from config.\n", d->geo_countries.items[j]);
+        stats_remove_source("geo", d->geo_countries.items[j]);
+    }
+    free(d->geo_lists);
+    free(next);
+    free(kept);
+    d->geo_lists = lists;
+    if (count > 0) log_info("Countries: %d, %zu prefixes changed\n", count, changed);
+    return changed;
+}
+
+// Settings the backend and the control socket were opened with only change on
+// restart: a setting edited in the config keeps its running value, with a warning.
+static void keep_string(const char *name, const char *running, char *next, size_t size) {
+    if (strcmp(running, next) == 0) return;
+    log_warn("Setting %s changed to \"%s\", keeping \"%s\" until the daemon is restarted.\n",
+             name, next, running);
+    snprintf(next, size, "%s", running);
+}
+
+static long keep_number(const char *name, long running, long next) {
+    if (running != next) {
+        log_warn("Setting %s changed to %ld, keeping %ld until the daemon is restarted.\n", name, next, running);
+    }
+    return running;
+}
+
+static void keep_startup_settings(const Settings *running, Settings *next) {
+    keep_string("backend", running->backend, next->backend, sizeof(next->backend));
+    keep_string("set_name", running->set_name, next->set_name, sizeof(next->set_name));
+    keep_string("xdp_interfaces", running->xdp_interfaces, next->xdp_interfaces, sizeof(next->xdp_interfaces));
+    keep_string("xdp_mode", running->xdp_mode, next->xdp_mode, sizeof(next->xdp_mode));
+    keep_string("control_socket", running->control_socket, next->control_socket, sizeof(next->control_socket));
+    if (memcmp(running->swap_tables, next->swap_tables, sizeof(next->swap_tables)) != 0) {
+        log_warn("Setting swap_tables changed to %u,%u, keeping %u,%u until the daemon is restarted.\n",
+                 next->swap_tables[0], next->swap_tables[1], running->swap_tables[0], running->swap_tables[1]);
+        memcpy(next->swap_tables, running->swap_tables, sizeof(next->swap_tables));
+    }
+    next->rule_priority = (uint32_t)keep_number("rule_priority", running->rule_priority, next->rule_priority);
+    next->route_table = (uint32_t)keep_number("route_table", running->route_table, next->route_table);
+    next->route_protocol = (int)keep_number("route_protocol", running->route_protocol, next->route_protocol);
+}
+
+// Read the config and fold the changes into the in-memory state: direct routes
+// are diffed, removed ASNs are dropped and only new ASNs are fetched.
+static int daemon_load(Daemon *d) {
+    Config config;
+    double start = stats_now();
+    if (load_config(d->config_file, &config) == -1) {
+        log_error("Failed to read or parse configuration file, keeping the previous configuration.\n");
+        return -1;
+    }
+    // The backend is open once the first load is done
+    if (d->backend.name) keep_startup_settings(&d->settings, &config.settings);
+    d->settings = config.settings;
+    log_configure(&d->settings);
+    stats_phase("config", start, config.routes_v4.count + config.routes_v6.count);
+    stats_set(STAT_PREFIXES_CONFIG, config.routes_v4.count + config.routes_v6.count);
+
+    PrefixList next_v4, next_v6;
+    init_prefix_list(&next_v4, config.routes_v4.count);
+    init_prefix_list(&next_v6, config.routes_v6.count);
+    route_array_to_list(&config.routes_v4, &next_v4);
+    route_array_to_list(&config.routes_v6, &next_v6);
+    size_t changed = update_source(&d->raw_v4, &d->config_v4, &next_v4);
+    changed += update_source(&d->raw_v6, &d->config_v6, &next_v6);
+    log_info("Direct routes: %zu IPv4, %zu IPv6 (%zu changed)\n",
+             d->config_v4.count, d->config_v6.count, changed);
+    free_prefix_list(&d->allow_v4);
+    free_prefix_list(&d->allow_v6);
+    init_prefix_list(&d->allow_v4, config.allow_v4.count);
+    init_prefix_list(&d->allow_v6, config.allow_v6.count);
+    route_array_to_list(&config.allow_v4, &d->allow_v4);
+    route_array_to_list(&config.allow_v6, &d->allow_v6);
+    stats_set(STAT_PREFIXES_ALLOWED, d->allow_v4.count + d->allow_v6.count);
+
+    // Drop ASNs that are no longer configured
+    for (int i = 0; i < d->asn_count; ) {
+        AsnState *state = &d->asns[i];
+        const char *num = asn_number(state->asn);
+        int still_listed = 0;
+        for (int j = 0; j < config.asns.count && !still_listed; j++) {
+            const char *other = asn_number(config.asns.asns[j]);
+            still_listed = other && strcmp(other, num) == 0;
+        }
+        if (still_listed) {
+            i++;
+            continue;
+        }
+        PrefixList empty_v4, empty_v6;
+        init_prefix_list(&empty_v4, 1);
+        init_prefix_list(&empty_v6, 1);
+        update_source(&d->raw_v4, &state->v4, &empty_v4);
+        update_source(&d->raw_v6, &state->v6, &empty_v6);
+        log_info("ASN %s removed from config.\n", state->asn);
+        stats_remove_source("asn", state->asn);
+        free(state->asn);
+        free_prefix_list(&state->v4);
+        free_prefix_list(&state->v6);
+        d->asns[i] = d->asns[--d->asn_count];
+    }
+
+    // Fetch only ASNs we do not know yet
+    AsnArray added;
+    init_asn_array(&added, 10);
+    for (int j = 0; j < config.asns.count; j++) {
+        if (asn_number(config.asns.asns[j]) && !find_asn(d, config.asns.asns[j])) {
+            add_asn(&added, config.asns.asns[j]);
+        }
+    }
+    if (added.count > 0) {
+        log_info("Fetching prefixes for %d new ASNs...\n", added.count);
+        AsnPrefixes *fetched = (AsnPrefixes*)calloc(added.count, sizeof(AsnPrefixes));
+        if (!fetched) {
+            log_errno("Failed to allocate memory for fetch results");
+            exit(EXIT_FAILURE);
+        }
+        FetchSummary summary;
+        start = stats_now();
+        int fetched_count = fetch_asn_sets(&added, &d->settings, fetched, &summary);
+        stats_phase("fetch", start, fetched_count);
+        for (int j = 0; j < added.count; j++) {
+            add_asn_state(d, added.asns[j], &fetched[j]);
+        }
+        free(fetched);
+    }
+    free_asn_array(&added);
+
+    sync_feeds(d, &config.feeds);
+    update_geo(d, &config.geo_countries, &config.geo_files);
+    // Keep the [geo_block] lists for refreshes; the previous ones go with the config
+    StringArray old_countries = d->geo_countries, old_files = d->geo_files;
+    d->geo_countries = config.geo_countries;
+    d->geo_files = config.geo_files;
+    config.geo_countries = old_countries;
+    config.geo_files = old_files;
+    netns_sync(&d->netns, &config.namespaces, &d->settings);
+    log_watch_sync(&d->logs, &config.log_files, &config.log_patterns, &d->settings);
+    free_config(&config);
+    return 0;
+}
+
+// Update the per-source gauges and write the stats files
+static void write_stats(Daemon *d, int success) {
+    uint64_t asn_prefixes = 0, feed_prefixes = 0, geo_prefixes = 0;
+    for (int i = 0; i < d->asn_count; i++) asn_prefixes += d->asns[i].v4.count + d->asns[i].v6.count;
+    for (int i = 0; i < d->feed_count; i++) feed_prefixes += d->feeds[i].v4.count + d->feeds[i].v6.count;
+    for (int i = 0; i < 2 * d->geo_countries.count; i++) geo_prefixes += d->geo_lists[i].count;
+    stats_set(STAT_PREFIXES_ASN, asn_prefixes);
+    stats_set(STAT_PREFIXES_FEED, feed_prefixes);
+    stats_set(STAT_PREFIXES_GEO, geo_prefixes);
+    stats_write(d->settings.stats_textfile, d->settings.stats_json, success);
+}
+
+// Rewrite the lookup index from the current sources
+static void write_index(Daemon *d) {
+    static const PrefixList empty = { NULL, 0, 0 };
+    int geo_first = 2 + d->asn_count + d->feed_count;
+    int count = geo_first + d->geo_countries.count + 1;
+    IndexSource *sources = (IndexSource*)malloc(count * sizeof(IndexSource));
+    if (!sources) {
+        log_errno("Failed to allocate memory for index sources");
+        exit(EXIT_FAILURE);
+    }
+    sources[0] = (IndexSource){ "config", "ipv4_routes", &d->config_v4, &empty };
+    sources[1] = (IndexSource){ "config", "ipv6_routes", &empty, &d->config_v6 };
+    sources[count - 1] = (IndexSource){ "allow", "config", &d->allow_v4, &d->allow_v6 };
+    for (int i = 0; i < d->asn_count; i++) {
+        sources[2 + i] = (IndexSource){ "asn", d->asns[i].asn, &d->asns[i].v4, &d->asns[i].v6 };
+    }
+    for (int i = 0; i < d->feed_count; i++) {
+        sources[2 + d->asn_count + i] = (IndexSource){ "feed", d->feeds[i].state.path, &d->feeds[i].v4, &d->feeds[i].v6 };
+    }
+    for (int i = 0; i < d->geo_countries.count; i++) {
+        sources[geo_first + i] =
+            (IndexSource){ "geo", d->geo_countries.items[i], &d->geo_lists[2 * i], &d->geo_lists[2 * i + 1] };
+    }
+    double start = stats_now();
+    lpm_write_index(d->settings.index_file, sources, count);
+    stats_phase("index", start, d->raw_v4.list.count + d->raw_v6.list.count);
+    free(sources);
+}
+
+static void init_prefix_delta(PrefixDelta *delta) {
+    for (int f = 0; f < 2; f++) {
+        init_prefix_list(&delta->add[f], 16);
+        init_prefix_list(&delta->remove[f], 16);
+    }
+}
+
+static void free_prefix_delta(PrefixDelta *delta) {
+    for (int f = 0; f < 2; f++) {
+        free_prefix_list(&delta->add[f]);
+        free_prefix_list(&delta->remove[f]);
+    }
+}
+
+// Program desired into the backend and the namespaces: the delta from the
+// applied set, or everything from scratch if delta is NULL. The caller makes
+// desired the applied set.
+static void program_set(Daemon *d, const PrefixList *desired[2], const PrefixDelta *delta, int index) {
+    stats_set(STAT_PREFIXES_DESIRED, desired[0]->count + desired[1]->count);
+    uint64_t failed_before = stats_get(STAT_KERNEL_OPS_FAILED);
+    double start = stats_now();
+    if (d->backend.apply(&d->backend, desired, delta) == -1) {
+        log_warn("Applying the block set failed, a full sync will be attempted next time.\n");
+        d->force_full = 1;
+    } else {
+        d->force_full = 0;
+    }
+    stats_phase(delta ? "apply_delta" : "apply_full", start, desired[0]->count + desired[1]->count);
+    // Namespaces whose last apply failed are synced from scratch on their own
+    int netns_failed = netns_apply(&d->netns, desired, delta, d->settings.netns_jobs);
+    if (index && d->settings.index_file[0]) write_index(d);
+    write_stats(d, !d->force_full && !netns_failed && stats_get(STAT_KERNEL_OPS_FAILED) == failed_before);
+}
+
+// Rebuild the desired set from all sources and program it. With full set, the
+// live state is synced from scratch (for routes: dumped and reconciled, which
+// heals drift); otherwise only the delta to the last applied set is sent. The
+// lookup index is rewritten if index is set (not for runtime bans, which change
+// too often).
+static void daemon_apply(Daemon *d, int full, int index) {
+    PrefixList desired_v4, desired_v6;
+    double start = stats_now();
+    init_prefix_list(&desired_v4, d->raw_v4.list.count);
+    init_prefix_list(&desired_v6, d->raw_v6.list.count);
+    size_t carved = build_desired(&d->raw_v4.list, &d->settings, &d->allow_v4, &desired_v4, "IPv4");
+    carved += build_desired(&d->raw_v6.list, &d->settings, &d->allow_v6, &desired_v6, "IPv6");
+    stats_phase("aggregate", start, d->raw_v4.list.count + d->raw_v6.list.count);
+    stats_set(STAT_BLOCKS_CARVED, carved);
+
+    const PrefixList *desired[2] = { &desired_v4, &desired_v6 };
+    if (full) {
+        program_set(d, desired, NULL, index);
+    } else {
+        PrefixDelta delta;
+        init_prefix_delta(&delta);
+        diff_prefix_lists(&desired_v4, &d->applied_v4, &delta.add[0], &delta.remove[0]);
+        diff_prefix_lists(&desired_v6, &d->applied_v6, &delta.add[1], &delta.remove[1]);
+        program_set(d, desired, &delta, index);
+        free_prefix_delta(&delta);
+    }
+    free_prefix_list(&d->applied_v4);
+    free_prefix_list(&d->applied_v6);
+    d->applied_v4 = desired_v4;
+    d->applied_v6 = desired_v6;
+}
+
+// --- Runtime bans ---
+
+#define BAN_FLUSH_MS 100 // Ban changes arriving within this window are applied together
+
+// Seconds since the daemon started, the clock of the ban wheel
+static uint32_t ban_clock(const struct timespec *epoch) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec - epoch->tv_sec);
+}
+
+static void arm_timer_ms(int timer_fd, long first_ms, long interval_ms) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = first_ms / 1000;
+    spec.it_value.tv_nsec = (first_ms % 1000) * 1000000L;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) log_errno("timerfd_settime failed");
+}
+
+// The kernel change for ban changes already counted in the raw sets, worked
+// out from the applied set instead of rebuilding it: a ban that overlaps no
+// other blocked prefix adds or removes its own (allow-carved) blocks, and with
+// aggregation one inside another blocked prefix changes nothing. Returns 0, or
+// -1 if only a rebuild gets it right (a ban covering other prefixes, or
+// blocks merged with a neighbour by an earlier aggregation).
+static int ban_delta(Daemon *d, const PrefixList add[2], const PrefixList remove[2], PrefixDelta *delta) {
+    int aggregate = aggregate_enabled(&d->settings);
+    int rebuild = 0;
+    for (int f = 0; f < 2 && !rebuild; f++) {
+        const PrefixMultiset *raw = f == 0 ? &d->raw_v4 : &d->raw_v6;
+        const PrefixList *applied = f == 0 ? &d->applied_v4 : &d->applied_v6;
+        PrefixTrie allow;
+        init_prefix_trie(&allow, f == 0 ? &d->allow_v4 : &d->allow_v6);
+        for (int adding = 1; adding >= 0 && !rebuild; adding--) {
+            const PrefixList *changes = adding ? &add[f] : &remove[f];
+            for (size_t i = 0; i < changes->count && !rebuild; i++) {
+                const Prefix *prefix = &changes->items[i];
+                long at = prefix_list_find(&raw->list, prefix);
+                if (at >= 0 && raw->refs[at] > (uint32_t)adding) continue; // Listed by another source too
+                if (prefix_list_covered(&raw->list, prefix)) {
+                    if (aggregate) continue;
+                    if (!adding) rebuild = 1; // Its blocks may be shared
+                }
+                if (aggregate || !adding) {
+                    rebuild |= prefix_list_covers(&raw->list, prefix);
+                    if (adding) rebuild |= prefix_list_covers(&remove[f], prefix);
+                }
+                if (rebuild) break;
+                PrefixList blocks;
+                init_prefix_list(&blocks, 4);
+                prefix_list_push(&blocks, prefix);
+                subtract_prefix_list(&blocks, &allow);
+                for (size_t b = 0; b < blocks.count; b++) {
+                    int present = prefix_list_find(applied, &blocks.items[b]) >= 0;
+                    if (adding && !present) prefix_list_push(&delta->add[f], &blocks.items[b]);
+                    if (!adding && present) prefix_list_push(&delta->remove[f], &blocks.items[b]);
+                    if (!adding && !present) rebuild = 1;
+                }
+                free_prefix_list(&blocks);
+            }
+        }
+        free_prefix_trie(&allow);
+        prefix_list_sort_unique(&delta->add[f]);
+        prefix_list_sort_unique(&delta->remove[f]);
+    }
+    return rebuild ? -1 : 0;
+}
+
+// Fold the ban changes since the last flush into the block set and apply them.
+// Only the bans' own blocks are programmed; the desired set is rebuilt (which
+// also aggregates the bans) when a source changes.
+static void apply_bans(Daemon *d) {
+    PrefixList add[2], remove[2];
+    for (int f = 0; f < 2; f++) {
+        init_prefix_list(&add[f], 64);
+        init_prefix_list(&remove[f], 64);
+    }
+    size_t changes = ban_collect(&d->bans, add, remove);
+    stats_set(STAT_BANS_ACTIVE, d->bans.active[0] + d->bans.active[1]);
+    if (changes > 0) {
+        prefix_multiset_update(&d->raw_v4, &add[0], 1);
+        prefix_multiset_update(&d->raw_v6, &add[1], 1);
+        prefix_multiset_update(&d->raw_v4, &remove[0], -1);
+        prefix_multiset_update(&d->raw_v6, &remove[1], -1);
+        log_info("Runtime bans: %zu added, %zu removed, %zu active\n", add[0].count + add[1].count,
+                 remove[0].count + remove[1].count, d->bans.active[0] + d->bans.active[1]);
+        PrefixDelta delta;
+        init_prefix_delta(&delta);
+        if (d->force_full || ban_delta(d, add, remove, &delta) == -1) {
+            daemon_apply(d, d->force_full, 0);
+        } else if (delta.add[0].count + delta.add[1].count + delta.remove[0].count + delta.remove[1].count > 0) {
+            prefix_list_update(&d->applied_v4, &delta.add[0], &delta.remove[0]);
+            prefix_list_update(&d->applied_v6, &delta.add[1], &delta.remove[1]);
+            const PrefixList *desired[2] = { &d->applied_v4, &d->applied_v6 };
+            program_set(d, desired, &delta, 0);
+        }
+        free_prefix_delta(&delta);
+    }
+    for (int f = 0; f < 2; f++) {
+        free_prefix_list(&add[f]);
+        free_prefix_list(&remove[f]);
+    }
+    control_flushed(&d->control, &d->bans, d->settings.ban_ttl);
+}
+
+// --- Background ASN refresh ---
+
+static void *refresh_main(void *arg) {
+    Daemon *d = (Daemon *)arg;
+    FetchSummary summary;
+    fetch_asn_sets(&d->refresh_asns, &d->refresh_settings, d->refresh_results, &summary);
+    uint64_t one = 1;
+    if (write(d->refresh_done_fd, &one, sizeof(one)) < 0) log_errno("write to eventfd failed");
+    return NULL;
+}
+
+// Start refetching all configured ASNs in a background thread. Entries younger
+// than cache_ttl are served from the cache, so only stale ASNs hit the IRR.
+static void start_refresh(Daemon *d) {
+    if (d->refresh_running || d->asn_count == 0) return;
+    init_asn_array(&d->refresh_asns, d->asn_count);
+    for (int i = 0; i < d->asn_count; i++) {
+        add_asn(&d->refresh_asns, d->asns[i].asn);
+    }
+    d->refresh_settings = d->settings;
+    d->refresh_results = (AsnPrefixes*)calloc(d->refresh_asns.count, sizeof(AsnPrefixes));
+    if (!d->refresh_results) {
+        log_errno("Failed to allocate memory for refresh results");
+        exit(EXIT_FAILURE);
+    }
+    log_info("Refreshing prefixes for %d ASNs in the background...\n", d->refresh_asns.count);
+    if (pthread_create(&d->refresh_thread, NULL, refresh_main, d) != 0) {
+        log_errno("pthread_create failed for ASN refresh");
+        free(d->refresh_results);
+        free_asn_array(&d->refresh_asns);
+        return;
+    }
+    d->refresh_running = 1;
+}
+
+// Merge the results of a finished refresh; ASNs removed meanwhile are ignored.
+// Returns the number of prefixes added or removed.
+static size_t finish_refresh(Daemon *d) {
+    pthread_join(d->refresh_thread, NULL);
+    d->refresh_running = 0;
+    size_t changed = 0;
+    for (int i = 0; i < d->refresh_asns.count; i++) {
+        AsnState *state = find_asn(d, d->refresh_asns.asns[i]);
+        AsnPrefixes *result = &d->refresh_results[i];
+        if (state) {
+            stats_source("asn", state->asn, result->failed ? state->v4.count : result->v4.count,
+                         result->failed ? state->v6.count : result->v6.count, result->seconds,
+                         result->cached, result->failed);
+        }
+        if (!state || result->failed) {
+            // Keep what we have if the ASN is gone or could not be fetched
+            free_prefix_list(&result->v4);
+            free_prefix_list(&result->v6);
+            continue;
+        }
+        changed += update_source(&d->raw_v4, &state->v4, &result->v4);
+        changed += update_source(&d->raw_v6, &state->v6, &result->v6);
+    }
+    free(d->refresh_results);
+    d->refresh_results = NULL;
+    free_asn_array(&d->refresh_asns);
+    log_info("ASN refresh finished, %zu prefixes changed.\n", changed);
+    return changed;
+}
+
+static void arm_refresh_timer(int timer_fd, long interval) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = interval;
+    spec.it_interval.tv_sec = interval;
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) log_errno("timerfd_settime failed");
+}
+
+// --- Event loop ---
+
+// Sort the inotify events in buf into config file changes and anything else,
+// which may be a feed
+static void scan_events(const char *buf, ssize_t len, int config_wd, const char *config_name,
+                        int *config_touched, int *other_touched) {
+    for (const char *p = buf; p < buf + len; ) {
+        const struct inotify_event *ev = (const struct inotify_event *)p;
+        if (ev->len > 0 && ev->wd == config_wd && strcmp(ev->name, config_name) == 0) {
+            *config_touched = 1;
+        } else {
+            *other_touched = 1;
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+}
+
+int run_daemon(const char *config_file) {
+    Daemon d;
+    memset(&d, 0, sizeof(d));
+    d.config_file = config_file;
+    init_prefix_list(&d.config_v4, 16);
+    init_prefix_list(&d.config_v6, 16);
+    init_prefix_list(&d.allow_v4, 16);
+    init_prefix_list(&d.allow_v6, 16);
+    init_prefix_multiset(&d.raw_v4);
+    init_prefix_multiset(&d.raw_v6);
+    init_prefix_list(&d.applied_v4, 16);
+    init_prefix_list(&d.applied_v6, 16);
+    init_netns_set(&d.netns);
+    init_ban_store(&d.bans);
+    init_log_watch(&d.logs);
+    d.control.listen_fd = -1;
+
+    // Signals are handled synchronously through a signalfd
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    // Watch the directory: editors usually replace the file instead of writing it in place
+    char dir_buf[4096], name_buf[4096];
+    snprintf(dir_buf, sizeof(dir_buf), "%s", config_file);
+    snprintf(name_buf, sizeof(name_buf), "%s", config_file);
+    const char *config_dir = dirname(dir_buf);
+    const char *config_name = basename(name_buf);
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    d.inotify_fd = inotify_fd;
+    d.config_wd = inotify_fd < 0 ? -1 : inotify_add_watch(inotify_fd, config_dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (d.config_wd < 0) {
+        log_errno("Failed to watch configuration directory");
+        return 1;
+    }
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    d.refresh_done_fd = eventfd(0, EFD_CLOEXEC);
+    if (signal_fd < 0 || timer_fd < 0 || tick_fd < 0 || flush_fd < 0 || d.refresh_done_fd < 0) {
+        log_errno("Failed to set up daemon event sources");
+        return 1;
+    }
+
+    log_info("Reading configuration from %s...\n", config_file);
+    if (daemon_load(&d) == -1) return 1;
+    // The backend is chosen once at startup; changing it requires a restart
+    if (backend_open(&d.backend, &d.settings) == -1) {
+        log_error("Failed to set up the '%s' backend. Exiting.\n", d.settings.backend);
+        return 1;
+    }
+    log_info("\n--- Applying Block Set (%s backend) ---\n", d.backend.name);
+    daemon_apply(&d, 1, 1);
+    log_info("------------------------------------\n");
+    arm_refresh_timer(timer_fd, d.settings.refresh_interval);
+    // Runtime bans expire (and watched logs are checked) once a second
+    struct timespec ban_epoch;
+    clock_gettime(CLOCK_MONOTONIC, &ban_epoch);
+    arm_timer_ms(tick_fd, 1000, 1000);
+    // Like the backend, the control socket is set up once
+    if (d.settings.control_socket[0]) {
+        if (control_open(&d.control, d.settings.control_socket) == -1) return 1;
+        log_info("Accepting runtime bans on %s (default duration %ld s).\n", d.settings.control_socket, d.settings.ban_ttl);
+    }
+    long armed_interval = d.settings.refresh_interval;
+    log_info("Daemon running, watching %s (ASN refresh every %ld s).\n", config_file, armed_interval);
+
+    int running = 1;
+    while (running) {
+        struct pollfd fds[7 + 1 + CONTROL_MAX_CLIENTS] = {
+            { .fd = signal_fd, .events = POLLIN },
+            { .fd = inotify_fd, .events = POLLIN },
+            { .fd = timer_fd, .events = POLLIN },
+            { .fd = d.refresh_done_fd, .events = POLLIN },
+            { .fd = tick_fd, .events = POLLIN },
+            { .fd = flush_fd, .events = POLLIN },
+            { .fd = d.logs.inotify_fd, .events = POLLIN }, // Ignored while -1
+        };
+        int nfds = 7 + control_pollfds(&d.control, fds + 7);
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            log_errno("poll failed");
+            break;
+        }
+
+        int reload = 0, resync = 0, feeds_touched = 0;
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGHUP) {
+                    // Also the way to heal drift: the live state is dumped and reconciled
+                    reload = 1;
+                    resync = 1;
+                } else {
+                    log_info("Received signal %u, exiting.\n", info.ssi_signo);
+                    running = 0;
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t len;
+            while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+                scan_events(buf, len, d.config_wd, config_name, &reload, &feeds_touched);
+            }
+        }
+        if (running && reload) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            log_info("\nConfiguration changed, reloading...\n");
+            if (daemon_load(&d) == 0) {
+                daemon_apply(&d, d.force_full || resync, 1);
+                if (d.settings.refresh_interval != armed_interval) {
+                    armed_interval = d.settings.refresh_interval;
+                    arm_refresh_timer(timer_fd, armed_interval);
+                }
+            }
+            log_info("Reload done in %.1f ms.\n", elapsed_ms(&start));
+        }
+        if (running && !reload && feeds_touched) {
+            // A reload re-checks the feeds anyway
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (refresh_feeds(&d) > 0) {
+                daemon_apply(&d, d.force_full, 1);
+                log_info("Feed update done in %.1f ms.\n", elapsed_ms(&start));
+            }
+        }
+        if (fds[2].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                // Also catches feed changes inotify cannot see (e.g. network filesystems)
+                // and new delegated-stats files
+                size_t changed = refresh_feeds(&d);
+                changed += update_geo(&d, &d.geo_countries, &d.geo_files);
+                if (changed > 0) daemon_apply(&d, d.force_full, 1);
+                start_refresh(&d);
+            }
+        }
+        if (fds[3].revents & POLLIN) {
+            uint64_t value;
+            if (read(d.refresh_done_fd, &value, sizeof(value)) == sizeof(value)) {
+                // Only the changed prefixes; a failed earlier apply is retried in full
+                if (finish_refresh(&d) > 0 || d.force_full) daemon_apply(&d, d.force_full, 1);
+            }
+        }
+
+        // Runtime bans: commands, log matches and expiries are collected, then applied together
+        uint64_t ticks;
+        if ((fds[4].revents & POLLIN) && read(tick_fd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+            uint32_t now = ban_clock(&ban_epoch);
+            size_t expired = ban_advance(&d.bans, now);
+            stats_add(STAT_BANS_EXPIRED, expired);
+            if (expired > 0) d.control.pending = 1;
+            if (log_watch_tick(&d.logs, &d.bans, now, d.settings.ban_ttl) > 0) d.control.pending = 1;
+        }
+        if ((fds[6].revents & POLLIN) &&
+            log_watch_events(&d.logs, &d.bans, ban_clock(&ban_epoch), d.settings.ban_ttl) > 0) {
+            d.control.pending = 1;
+        }
+        if (running) control_handle(&d.control, fds + 7, &d.bans, d.settings.ban_ttl);
+        if ((fds[5].revents & POLLIN) && read(flush_fd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+            d.flush_armed = 0;
+            apply_bans(&d);
+        }
+        if (d.control.flush_requested) {
+            // A client waits: apply now instead of at the end of the window
+            if (d.flush_armed) arm_timer_ms(flush_fd, 0, 0);
+            d.flush_armed = 0;
+            d.control.pending = 0;
+            while (d.control.flush_requested) apply_bans(&d);
+        }
+        if (d.control.pending && !d.flush_armed) {
+            arm_timer_ms(flush_fd, BAN_FLUSH_MS, 0);
+            d.flush_armed = 1;
+        }
+        d.control.pending = 0;
+    }
+
+    // Installed routes stay in place; only in-memory state is released
+    if (d.refresh_running) finish_refresh(&d);
+    backend_close(&d.backend);
+    free_netns_set(&d.netns);
+    control_close(&d.control);
+    free_log_watch(&d.logs);
+    free_ban_store(&d.bans);
+    for (int i = 0; i < d.asn_count; i++) {
+        free(d.asns[i].asn);
+        free_prefix_list(&d.asns[i].v4);
+        free_prefix_list(&d.asns[i].v6);
+    }
+    free(d.asns);
+    for (int i = 0; i < d.feed_count; i++) {
+        free_feed_state(&d.feeds[i].state);
+        free_prefix_list(&d.feeds[i].v4);
+        free_prefix_list(&d.feeds[i].v6);
+    }
+    free(d.feeds);
+    for (int i = 0; i < 2 * d.geo_countries.count; i++) free_prefix_list(&d.geo_lists[i]);
+    free(d.geo_lists);
+    free_string_array(&d.geo_countries);
+    free_string_array(&d.geo_files);
+    free_prefix_list(&d.config_v4);
+    free_prefix_list(&d.config_v6);
+    free_prefix_list(&d.allow_v4);
+    free_prefix_list(&d.allow_v6);
+    free_prefix_multiset(&d.raw_v4);
+    free_prefix_multiset(&d.raw_v6);
+    free_prefix_list(&d.applied_v4);
+    free_prefix_list(&d.applied_v6);
+    close(inotify_fd);
+    close(timer_fd);
+    close(tick_fd);
+    close(flush_fd);
+    close(signal_fd);
+    close(d.refresh_done_fd);
+    return 0;
+}
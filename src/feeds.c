@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- Local prefix feeds ---
+//
+// Feeds are plain-text files dropped by other tools (bogon lists, abuse lists):
+// one address or prefix per line, IPv4 and IPv6 mixed, with '#' or ';'
+// comments. A feed is only read again when its size or mtime changed, and only
+// reparsed when its content hash changed. With a cache directory the parsed
+// prefixes and the change state are kept on disk as well, so a run with an
+// unchanged feed does not read the feed file at all.
+
+#define FEED_STATE_MAGIC "IPBANF1"
+
+// Change state stored next to the cached prefixes of a feed
+typedef struct {
+    char magic[8];
+    int64_t size;
+    int64_t mtime_ns;
+    uint64_t content_hash;
+} FeedStateFile;
+
+void init_feed_state(FeedState *feed, const char *path) {
+    memset(feed, 0, sizeof(*feed));
+    feed->path = strdup(path);
+    if (!feed->path) {
+        log_errno("Failed to duplicate feed path");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void free_feed_state(FeedState *feed) {
+    free(feed->path);
+    feed->path = NULL;
+    feed->known = 0;
+}
+
+// Cache key of a feed, derived from its path
+static void feed_key(const FeedState *feed, char *buf, size_t buf_len) {
+    snprintf(buf, buf_len, "feed-%016llx",
+             (unsigned long long)fnv1a64(FNV1A64_INIT, feed->path, strlen(feed->path)));
+}
+
+static int read_state_file(const char *dir, const char *key, FeedStateFile *state) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.state", dir, key);
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+    int ok = fread(state, sizeof(*state), 1, file) == 1 &&
+             memcmp(state->magic, FEED_STATE_MAGIC, sizeof(state->magic)) == 0;
+    fclose(file);
+    return ok ? 0 : -1;
+}
+
+// Replace the change state file of a feed atomically
+static void write_state_file(const char *dir, const char *key, const FeedState *feed) {
+    char path[4096], tmp_path[4200];
+    FeedStateFile state;
+    memset(&state, 0, sizeof(state));
+    memcpy(state.magic, FEED_STATE_MAGIC, sizeof(state.magic));
+    state.size = feed->size;
+    state.mtime_ns = feed->mtime_ns;
+    state.content_hash = feed->content_hash;
+    snprintf(path, sizeof(path), "%s/%s.state", dir, key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        log_errno(tmp_path);
+        return;
+    }
+    int ok = fwrite(&state, sizeof(state), 1, file) == 1;
+    if (fclose(file) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) < 0) {
+        log_errno("Failed to write feed state file");
+        unlink(tmp_path);
+    }
+}
+
+// Store prefixes and change state of a feed. The state file is replaced last,
+// so it never describes prefixes that were not written.
+static void store_feed_cache(const Settings *settings, const FeedState *feed, const PrefixList *v4,
+                             const PrefixList *v6) {
+    char key[64];
+    feed_key(feed, key, sizeof(key));
+    int64_t now = (int64_t)time(NULL);
+    if (cache_store(settings->cache_dir, key, AF_INET, v4->items, v4->count, now) == -1 ||
+        cache_store(settings->cache_dir, key, AF_INET6, v6->items, v6->count, now) == -1) {
+        return;
+    }
+    write_state_file(settings->cache_dir, key, feed);
+}
+
+// Load the cached prefixes of a feed. Returns 0, or -1 if they are missing.
+static int load_feed_cache(const Settings *settings, const FeedState *feed, PrefixList *v4, PrefixList *v6) {
+    char key[64];
+    feed_key(feed, key, sizeof(key));
+    if (cache_load(settings->cache_dir, key, AF_INET, v4, NULL) == -1) return -1;
+    if (cache_load(settings->cache_dir, key, AF_INET6, v6, NULL) == -1) {
+        v4->count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Parse feed contents straight into the prefix lists (no per-entry dedup, the
+// lists are sorted and made unique once at the end)
+static void parse_feed(const char *path, const MappedFile *file, PrefixList *v4, PrefixList *v6) {
+    const char *p = file->data, *end = file->data + file->size;
+    int line_num = 0, invalid = 0;
+    while (p < end) {
+        const char *line_end = (const char *)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        line_num++;
+        Prefix prefix;
+        const char *entry;
+        size_t len;
+        int ret = parse_prefix_line(p, line_end, &prefix, &entry, &len);
+        p = line_end + 1;
+        if (ret == 1) {
+            prefix_list_push(prefix.family == AF_INET ? v4 : v6, &prefix);
+        } else if (ret == -1 && invalid++ < MAX_INVALID_REPORTED) {
+            log_warn("Invalid prefix '%.*s' in %s line %d\n", (int)(len > 64 ? 64 : len), entry, path, line_num);
+        }
+    }
+    if (invalid > MAX_INVALID_REPORTED) {
+        log_warn("%d invalid lines in %s\n", invalid, path);
+    }
+    prefix_list_sort_unique(v4);
+    prefix_list_sort_unique(v6);
+}
+
+// Read a feed if it changed since the last call (see ipban.h)
+int load_feed(FeedState *feed, const Settings *settings, PrefixList *v4, PrefixList *v6) {
+    struct stat st;
+    if (stat(feed->path, &st) < 0) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Failed to read feed '%s'", feed->path);
+        log_errno(error_buf);
+        stats_add(STAT_FEEDS_FAILED, 1);
+        return -1;
+    }
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if (feed->known && feed->size == (int64_t)st.st_size && feed->mtime_ns == mtime_ns) {
+        stats_add(STAT_FEEDS_UNCHANGED, 1);
+        return 0;
+    }
+
+    // First look at this feed in this process: the on-disk state may still be current
+    int use_cache = settings->cache_dir[0] != '\0';
+    int first = !feed->known;
+    FeedStateFile cached;
+    char key[64];
+    feed_key(feed, key, sizeof(key));
+    int have_state = first && use_cache && read_state_file(settings->cache_dir, key, &cached) == 0;
+    if (have_state && cached.size == (int64_t)st.st_size && cached.mtime_ns == mtime_ns &&
+        load_feed_cache(settings, feed, v4, v6) == 0) {
+        feed->size = cached.size;
+        feed->mtime_ns = cached.mtime_ns;
+        feed->content_hash = cached.content_hash;
+        feed->known = 1;
+        stats_add(STAT_FEEDS_UNCHANGED, 1);
+        log_info("Feed %s: %zu IPv4, %zu IPv6 prefixes (unchanged, cached)\n", feed->path, v4->count, v6->count);
+        return 1;
+    }
+
+    MappedFile file;
+    if (map_file(feed->path, &file) == -1) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Failed to read feed '%s'", feed->path);
+        log_errno(error_buf);
+        stats_add(STAT_FEEDS_FAILED, 1);
+        return -1;
+    }
+    uint64_t hash = fnv1a64(FNV1A64_INIT, file.data, file.size);
+    int same_content = have_state ? hash == cached.content_hash : feed->known && hash == feed->content_hash;
+    feed->size = (int64_t)file.size;
+    feed->mtime_ns = mtime_ns;
+    feed->content_hash = hash;
+    feed->known = 1;
+
+    if (same_content && !first) {
+        unmap_file(&file);
+        stats_add(STAT_FEEDS_UNCHANGED, 1);
+        return 0; // Touched but not changed
+    }
+    if (same_content && use_cache && load_feed_cache(settings, feed, v4, v6) == 0) {
+        unmap_file(&file);
+        write_state_file(settings->cache_dir, key, feed); // Remember the new mtime
+        stats_add(STAT_FEEDS_UNCHANGED, 1);
+        log_info("Feed %s: %zu IPv4, %zu IPv6 prefixes (content unchanged, cached)\n", feed->path, v4->count, v6->count);
+        return 1;
+    }
+    parse_feed(feed->path, &file, v4, v6);
+    stats_add(STAT_FEEDS_PARSED, 1);
+    unmap_file(&file);
+    if (use_cache) store_feed_cache(settings, feed, v4, v6);
+    log_info("Feed %s: %zu IPv4, %zu IPv6 prefixes\n", feed->path, v4->count, v6->count);
+    return 1;
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6, INET6_ADDRSTRLEN
+#include <sys/wait.h>    // For WIFEXITED, WEXITSTATUS
+#include <time.h>
+#include <pthread.h>
+
+#include "ipban.h"
+
+#define BGPQ_COMMAND "bgpq4" // Or "bgpq3" if you use that
+
+// --- ASN Prefix Fetching ---
+
+// One bgpq4 invocation: a single ASN and address family
+typedef struct {
+    const char *asn;        // ASN as written in the config
+    const char *asn_num;    // Numeric part passed to bgpq4
+    int asn_index;          // Position in the ASN list
+    int family;
+    PrefixList prefixes;    // Parsed output (or cached data)
+    int status;             // Number of prefixes, or -1 if the command could not be run
+    int exit_ok;            // Command ran and exited with status 0
+    int from_cache;         // Fresh cache entry used, no fetch needed
+    double seconds;         // Time the fetch took
+    int have_cached;        // `cached` holds stale data to fall back to
+    PrefixList cached;
+    CacheInfo cache_info;
+} FetchJob;
+
+typedef struct {
+    FetchJob **jobs;        // Jobs that need a fetch
+    size_t count;
+    size_t next;            // Next job to hand out
+    pthread_mutex_t lock;
+} FetchQueue;
+
+// Return the numeric part of "AS1234"/"as1234"/"1234", or NULL if invalid
+const char *asn_number(const char *asn) {
+    const char *digits = (strncmp(asn, "AS", 2) == 0 || strncmp(asn, "as", 2) == 0) ? asn + 2 : asn;
+    if (*digits == '\0') return NULL;
+    for (const char *p = digits; *p; p++) {
+        if (*p < '0' || *p > '9') return NULL;
+    }
+    return digits;
+}
+
+// Report how a popen()ed command terminated. Returns 1 if it exited with status 0.
+static int report_pclose(const char *cmd, int pclose_ret) {
+    if (pclose_ret == -1) {
+        log_errno("pclose failed after prefix fetch");
+    } else if (WIFEXITED(pclose_ret)) {
+        int exit_status = WEXITSTATUS(pclose_ret);
+        if (exit_status == 0) return 1;
+        log_warn("Command '%s' exited with status %d\n", cmd, exit_status);
+    } else if (WIFSIGNALED(pclose_ret)) {
+        log_warn("Command '%s' terminated by signal %d\n", cmd, WTERMSIG(pclose_ret));
+    } else {
+        log_warn("Command '%s' terminated abnormally (raw return: %d)\n", cmd, pclose_ret);
+    }
+    return 0;
+}
+
+// Run bgpq4 for one ASN and family and collect the prefixes it prints (plain output)
+static void run_fetch_job(FetchJob *job) {
+    char cmd[512];
+    // Increased buffer size slightly just in case of weird long lines from bgpq4/popen
+    char prefix_buffer[INET6_ADDRSTRLEN + 20];
+    const char *label = job->family == AF_INET ? "IPv4" : "IPv6";
+
+    // Use -A for aggregation and -F for plain format. Note escaped format string.
+    snprintf(cmd, sizeof(cmd), "%s -%c -A -F '%%n/%%l\\n' AS%s", BGPQ_COMMAND,
+             job->family == AF_INET ? '4' : '6', job->asn_num);
+
+    double start = stats_now();
+    stats_add(STAT_FETCHES, 1);
+    FILE *fp = popen(cmd, "r");
+    if (fp == NULL) {
+        log_error("Failed to run command: %s\n", cmd);
+        log_errno("popen failed");
+        job->status = -1;
+        stats_add(STAT_FETCHES_FAILED, 1);
+        return;
+    }
+
+    while (fgets(prefix_buffer, sizeof(prefix_buffer), fp) != NULL) {
+        prefix_buffer[strcspn(prefix_buffer, "\n")] = 0; // Remove trailing newline
+        char *trimmed_prefix = trim_whitespace(prefix_buffer);
+        if (!trimmed_prefix || strlen(trimmed_prefix) == 0 || !strchr(trimmed_prefix, '/')) {
+            continue; // Not a prefix line
+        }
+        Prefix prefix;
+        if (parse_prefix(trimmed_prefix, job->family, &prefix) == -1) {
+            log_warn("  Skipping invalid %s prefix from AS%s: %s\n", label, job->asn_num, trimmed_prefix);
+            continue;
+        }
+        prefix_list_push(&job->prefixes, &prefix);
+    }
+    job->exit_ok = report_pclose(cmd, pclose(fp));
+    job->status = (int)job->prefixes.count;
+    job->seconds = stats_now() - start;
+    if (!job->exit_ok) stats_add(STAT_FETCHES_FAILED, 1);
+}
+
+// Worker thread: take jobs from the shared queue until it is empty
+static void *fetch_worker(void *arg) {
+    FetchQueue *queue = (FetchQueue *)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t idx = queue->next < queue->count ? queue->next++ : queue->count;
+        pthread_mutex_unlock(&queue->lock);
+        if (idx == queue->count) return NULL;
+        run_fetch_job(queue->jobs[idx]);
+    }
+}
+
+// Run the queued jobs on up to settings->fetch_jobs bgpq4 processes at once
+static void fetch_bgpq_jobs(FetchQueue *queue, const Settings *settings) {
+    int jobs = settings->fetch_jobs;
+    if (jobs < 1) jobs = 1;
+    if ((size_t)jobs > queue->count) jobs = (int)queue->count;
+    pthread_t *threads = (pthread_t*)malloc((jobs > 0 ? jobs : 1) * sizeof(pthread_t));
+    if (!threads) {
+        log_errno("Failed to allocate memory for fetch threads");
+        exit(EXIT_FAILURE);
+    }
+    int started = 0;
+    for (int t = 0; t < jobs; t++) {
+        if (pthread_create(&threads[t], NULL, fetch_worker, queue) != 0) {
+            log_errno("pthread_create failed for fetch worker");
+            break;
+        }
+        started++;
+    }
+    if (started == 0) fetch_worker(queue); // Fall back to fetching in this thread
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+// Resolve the queued jobs with pipelined queries to settings->irr_server
+static void fetch_irr_jobs(FetchQueue *queue, const Settings *settings) {
+    if (queue->count == 0) return;
+    IrrQuery *queries = (IrrQuery*)calloc(queue->count, sizeof(IrrQuery));
+    if (!queries) {
+        log_errno("Failed to allocate memory for IRR queries");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < queue->count; i++) {
+        queries[i].asn_num = queue->jobs[i]->asn_num;
+        queries[i].family = queue->jobs[i]->family;
+        queries[i].prefixes = &queue->jobs[i]->prefixes;
+    }
+    log_info("Querying %s for %zu ASN/family pairs over one connection...\n", settings->irr_server, queue->count);
+    stats_add(STAT_FETCHES, queue->count);
+    size_t answered = irr_query(settings->irr_server, settings->irr_sources, queries, queue->count);
+    stats_add(STAT_FETCHES_FAILED, queue->count - answered);
+    for (size_t i = 0; i < queue->count; i++) {
+        FetchJob *job = queue->jobs[i];
+        job->exit_ok = queries[i].ok;
+        job->status = (int)job->prefixes.count;
+        job->seconds = queries[i].seconds;
+    }
+    free(queries);
+}
+
+// Look up the cache entry of a job: a fresh one replaces the fetch, a stale one
+// is kept as fallback in case the fetch fails
+static void load_cached_job(FetchJob *job, const Settings *settings, int64_t now) {
+    char key[64];
+    snprintf(key, sizeof(key), "AS%s", job->asn_num);
+    init_prefix_list(&job->cached, 64);
+    if (cache_load(settings->cache_dir, key, job->family, &job->cached, &job->cache_info) == -1) {
+        stats_add(STAT_CACHE_MISSES, 1);
+        return;
+    }
+
+    if (now - job->cache_info.fetched_at < settings->cache_ttl) {
+        PrefixList tmp = job->prefixes; // Use the cached list directly
+        job->prefixes = job->cached;
+        job->cached = tmp;
+        job->from_cache = 1;
+        job->status = (int)job->prefixes.count;
+        stats_add(STAT_CACHE_HITS, 1);
+    } else {
+        job->have_cached = 1;
+        stats_add(STAT_CACHE_MISSES, 1);
+    }
+}
+
+// After a fetch: store good results in the cache, or fall back to older cached data
+static void finish_job(FetchJob *job, const Settings *settings, int64_t now) {
+    char key[64];
+    snprintf(key, sizeof(key), "AS%s", job->asn_num);
+    if (job->status >= 0 && job->exit_ok) {
+        cache_store(settings->cache_dir, key, job->family, job->prefixes.items, job->prefixes.count, now);
+    } else if (job->have_cached) {
+        log_warn("Using cached %s prefixes for AS%s fetched %lld seconds ago.\n",
+                 job->family == AF_INET ? "IPv4" : "IPv6", job->asn_num,
+                 (long long)(now - job->cache_info.fetched_at));
+        stats_add(STAT_CACHE_STALE, 1);
+        PrefixList tmp = job->prefixes;
+        job->prefixes = job->cached;
+        job->cached = tmp;
+    }
+}
+
+// Fetch the IPv4 and IPv6 prefixes of all ASNs, running up to settings->fetch_jobs
+// bgpq4 processes at once, or over one connection to settings->irr_server.
+// ASN/family pairs with a fresh cache entry are not fetched at all; when a fetch
+// fails, the last good cached data is used instead. out[i] receives the sorted,
+// unique prefixes of asns->asns[i] (empty for invalid ASNs). Returns the number
+// of prefixes fetched.
+int fetch_asn_sets(const AsnArray *asns, const Settings *settings, AsnPrefixes *out, FetchSummary *summary) {
+    FetchJob *all_jobs = (FetchJob*)calloc(asns->count > 0 ? asns->count * 2 : 1, sizeof(FetchJob));
+    FetchQueue queue = { .count = 0, .next = 0 };
+    queue.jobs = (FetchJob**)calloc(asns->count > 0 ? asns->count * 2 : 1, sizeof(FetchJob*));
+    if (!all_jobs || !queue.jobs) {
+        log_errno("Failed to allocate memory for fetch jobs");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+    int use_cache = settings->cache_dir[0] != '\0';
+    int64_t now = (int64_t)time(NULL);
+
+    size_t job_count = 0;
+    for (int i = 0; i < asns->count; i++) {
+        init_prefix_list(&out[i].v4, 16);
+        init_prefix_list(&out[i].v6, 16);
+        out[i].failed = 0;
+        out[i].cached = 0;
+        out[i].seconds = 0;
+        const char *asn_num = asn_number(asns->asns[i]);
+        if (!asn_num) {
+            log_warn("Invalid ASN format '%s', skipping fetch.\n", asns->asns[i]);
+            continue;
+        }
+        for (int f = 0; f < 2; f++) {
+            FetchJob *job = &all_jobs[job_count++];
+            job->asn = asns->asns[i];
+            job->asn_num = asn_num;
+            job->asn_index = i;
+            job->family = f == 0 ? AF_INET : AF_INET6;
+            init_prefix_list(&job->prefixes, 64);
+            if (use_cache) load_cached_job(job, settings, now);
+            if (!job->from_cache) queue.jobs[queue.count++] = job;
+        }
+    }
+
+    if (settings->irr_server[0] != '\0') {
+        fetch_irr_jobs(&queue, settings);
+    } else {
+        fetch_bgpq_jobs(&queue, settings);
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    // Collect in config order so output and results do not depend on scheduling
+    int total_fetched = 0;
+    memset(summary, 0, sizeof(*summary));
+    for (size_t j = 0; j < job_count; j += 2) {
+        int asn_failed = 0, asn_stale = 0, asn_cached = 1;
+        double asn_seconds = 0;
+        AsnPrefixes *result = &out[all_jobs[j].asn_index];
+        for (size_t k = j; k < j + 2; k++) {
+            FetchJob *job = &all_jobs[k];
+            asn_seconds += job->seconds;
+            if (!job->from_cache) {
+                asn_cached = 0;
+                if (job->status == -1 || !job->exit_ok) {
+                    asn_failed = 1;
+                    if (job->have_cached) asn_stale = 1;
+                }
+                if (use_cache) finish_job(job, settings, now);
+            }
+            PrefixList *target = job->family == AF_INET ? &result->v4 : &result->v6;
+            free_prefix_list(target);
+            *target = job->prefixes; // Hand the list over
+            prefix_list_sort_unique(target);
+            total_fetched += (int)target->count;
+            if (use_cache) free_prefix_list(&job->cached);
+        }
+        log_debug("Fetched prefixes for AS%s%s\n", all_jobs[j].asn_num, asn_cached ? " (cached)" : "");
+        if (asn_failed) {
+            log_warn("Failed to fetch prefixes for %s. Continuing...\n", all_jobs[j].asn);
+            result->failed = 1;
+            summary->failed_asns++;
+            if (asn_stale) summary->stale_asns++;
+        } else if (result->v4.count + result->v6.count == 0) {
+            // This message might appear if the ASN is valid but has no public routes
+            log_info("  No valid prefixes found or added for AS%s via %s.\n", all_jobs[j].asn_num,
+                     settings->irr_server[0] ? settings->irr_server : BGPQ_COMMAND);
+        }
+        if (asn_cached) summary->cached_asns++;
+        result->cached = asn_cached;
+        result->seconds = asn_seconds;
+    }
+    free(queue.jobs);
+    free(all_jobs);
+    return total_fetched;
+}
+
+// Free the prefix lists of fetch results
+void free_asn_prefixes(AsnPrefixes *sets, int count) {
+    for (int i = 0; i < count; i++) {
+        free_prefix_list(&sets[i].v4);
+        free_prefix_list(&sets[i].v6);
+    }
+}
+
+// Fetch the prefixes of all ASNs and merge them into the route arrays. If keep
+// is not NULL, the per-ASN results are left there for the caller.
+int fetch_asn_prefixes(const AsnArray *asns, const Settings *settings, RouteArray *routes_v4,
+                       RouteArray *routes_v6, FetchSummary *summary, AsnPrefixes *keep) {
+    AsnPrefixes *sets = keep ? keep : (AsnPrefixes*)calloc(asns->count > 0 ? asns->count : 1, sizeof(AsnPrefixes));
+    if (!sets) {
+        log_errno("Failed to allocate memory for fetch results");
+        exit(EXIT_FAILURE);
+    }
+    int total_added = fetch_asn_sets(asns, settings, sets, summary);
+    for (int i = 0; i < asns->count; i++) {
+        stats_source("asn", asns->asns[i], sets[i].v4.count, sets[i].v6.count, sets[i].seconds,
+                     sets[i].cached, sets[i].failed);
+        for (int f = 0; f < 2; f++) {
+            const PrefixList *list = f == 0 ? &sets[i].v4 : &sets[i].v6;
+            RouteArray *target = f == 0 ? routes_v4 : routes_v6;
+            int debug = log_enabled(LOG_LEVEL_DEBUG);
+            for (size_t p = 0; p < list->count; p++) {
+                if (debug) {
+                    char text[PREFIX_STRLEN];
+                    log_debug("  Adding %s prefix from %s: %s\n", f == 0 ? "IPv4" : "IPv6",
+                              asns->asns[i], format_prefix(&list->items[p], text, sizeof(text)));
+                }
+                add_prefix(target, &list->items[p]);
+            }
+        }
+    }
+    if (!keep) {
+        free_asn_prefixes(sets, asns->count);
+        free(sets);
+    }
+    return total_added;
+}
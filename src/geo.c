@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <arpa/inet.h>   // For inet_pton
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- Country blocking ---
+//
+// The [geo_block] countries are resolved from RIR delegated(-extended) stats
+// files kept on disk, one record per allocation:
+//
+//   ripencc|FR|ipv4|2.0.0.0|1048576|20100712|allocated|...
+//   ripencc|FR|ipv6|2001:660::|32|19990625|allocated|...
+//
+// IPv4 records are a start address and an address count, which need not be a
+// power of two; consecutive records of a country are joined and each range is
+// split into the fewest CIDRs covering it. IPv6 records are already prefixes.
+// Files are mapped and scanned field by field; the country code is checked
+// first, so records of other countries cost little more than finding the end
+// of the line. With a cache directory the prefixes of each country are stored
+// keyed by the content hash of the file, so an unchanged file is not parsed again.
+// Entries of file contents that are no longer current are removed.
+
+#define GEO_MAX_COUNTRIES (26 * 26)
+
+typedef struct {
+    PrefixList v4;
+    PrefixList v6;
+    uint64_t range_start;   // IPv4 range being joined
+    uint64_t range_end;     // Exclusive, 0 = none
+    int parse;              // Not found in the cache, taken from the file
+} GeoCountry;
+
+// Table slot of a two-letter country code, or -1
+static int country_slot(const char *cc, size_t len) {
+    if (len != 2 || cc[0] < 'A' || cc[0] > 'Z' || cc[1] < 'A' || cc[1] > 'Z') return -1;
+    return (cc[0] - 'A') * 26 + (cc[1] - 'A');
+}
+
+int parse_country(const char *text, char out[3]) {
+    if (strlen(text) != 2) return -1;
+    out[0] = (char)(text[0] & ~0x20); // Upper case
+    out[1] = (char)(text[1] & ~0x20);
+    out[2] = '\0';
+    return country_slot(out, 2) == -1 ? -1 : 0;
+}
+
+// Append the fewest CIDRs covering [start, end) (IPv4, end at most 2^32)
+static void push_range_v4(PrefixList *out, uint64_t start, uint64_t end) {
+    while (start < end) {
+        int len = start ? 32 - __builtin_ctzll(start) : 0; // Largest block aligned at start
+        while (start + (1ULL << (32 - len)) > end) len++;
+        Prefix prefix;
+        memset(&prefix, 0, sizeof(prefix));
+        prefix.family = AF_INET;
+        prefix.len = (unsigned char)len;
+        prefix.addr[0] = (unsigned char)(start >> 24);
+        prefix.addr[1] = (unsigned char)(start >> 16);
+        prefix.addr[2] = (unsigned char)(start >> 8);
+        prefix.addr[3] = (unsigned char)start;
+        prefix_list_push(out, &prefix);
+        start += 1ULL << (32 - len);
+    }
+}
+
+static void flush_range(GeoCountry *country) {
+    if (country->range_end == 0) return;
+    push_range_v4(&country->v4, country->range_start, country->range_end);
+    country->range_end = 0;
+}
+
+// Split a line into its '|' separated fields. Returns the number found (up to max).
+static int split_fields(const char *p, const char *end, const char **fields, size_t *lens, int max) {
+    int n = 0;
+    while (n < max) {
+        const char *bar = (const char *)memchr(p, '|', end - p);
+        fields[n] = p;
+        lens[n] = (bar ? bar : end) - p;
+        n++;
+        if (!bar) break;
+        p = bar + 1;
+    }
+    return n;
+}
+
+// Add one record (the fields after the country code) to country. Records of
+// other types and unused address space are skipped. Returns -1 if malformed.
+static int parse_record(const char *p, const char *end, GeoCountry *country) {
+    // type|start|value|date|status|...
+    const char *fields[5];
+    size_t lens[5];
+    if (end > p && end[-1] == '\r') end--;
+    if (split_fields(p, end, fields, lens, 5) < 5) return -1;
+    int v4 = lens[0] == 4 && memcmp(fields[0], "ipv4", 4) == 0;
+    int v6 = lens[0] == 4 && memcmp(fields[0], "ipv6", 4) == 0;
+    if (!v4 && !v6) return 0; // asn records
+    // Only address space in use; available and reserved blocks have no country anyway
+    if (!(lens[4] == 9 && memcmp(fields[4], "allocated", 9) == 0) &&
+        !(lens[4] == 8 && memcmp(fields[4], "assigned", 8) == 0)) {
+        return 0;
+    }
+    char addr[INET6_ADDRSTRLEN], value[16];
+    if (lens[1] >= sizeof(addr) || lens[2] == 0 || lens[2] >= sizeof(value)) return -1;
+    memcpy(addr, fields[1], lens[1]);
+    addr[lens[1]] = '\0';
+    memcpy(value, fields[2], lens[2]);
+    value[lens[2]] = '\0';
+    char *value_end;
+    unsigned long long n = strtoull(value, &value_end, 10);
+    if (*value_end != '\0') return -1;
+
+    if (v6) {
+        char text[PREFIX_STRLEN];
+        Prefix prefix;
+        snprintf(text, sizeof(text), "%s/%llu", addr, n);
+        if (n > 128 || parse_prefix(text, AF_INET6, &prefix) == -1) return -1;
+        prefix_list_push(&country->v6, &prefix);
+        return 0;
+    }
+    unsigned char bytes[4];
+    if (inet_pton(AF_INET, addr, bytes) != 1) return -1;
+    uint64_t start = (uint64_t)bytes[0] << 24 | (uint64_t)bytes[1] << 16 | (uint64_t)bytes[2] << 8 | bytes[3];
+    if (n == 0 || n > (1ULL << 32) - start) return -1;
+    if (country->range_end != start) {
+        flush_range(country);
+        country->range_start = start;
+    }
+    country->range_end = start + n;
+    return 0;
+}
+
+// Add the records of the countries marked for parsing in slots to their lists
+static void parse_delegated(const char *path, const MappedFile *file, GeoCountry **slots) {
+    const char *p = file->data, *end = file->data + file->size;
+    int line_num = 0, invalid = 0;
+    while (p < end) {
+        const char *line_end = (const char *)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        const char *line = p;
+        p = line_end + 1;
+        line_num++;
+
+        // registry|cc|...: only the country code is looked at for other countries
+        const char *cc = (const char *)memchr(line, '|', line_end - line);
+        if (!cc || line_end - ++cc < 3 || cc[2] != '|') continue; // Comment, header or summary
+        int slot = country_slot(cc, 2);
+        if (slot == -1 || !slots[slot] || !slots[slot]->parse) continue;
+        if (parse_record(cc + 3, line_end, slots[slot]) == -1 && invalid++ < MAX_INVALID_REPORTED) {
+            log_warn("Invalid record in %s line %d\n", path, line_num);
+        }
+    }
+    if (invalid > MAX_INVALID_REPORTED) {
+        log_warn("%d invalid records in %s\n", invalid, path);
+    }
+}
+
+// Cache key of the prefixes of one country taken from a file with this content
+static void geo_key(uint64_t hash, const char *cc, char *buf, size_t buf_len) {
+    snprintf(buf, buf_len, "geo-%016llx-%s", (unsigned long long)hash, cc);
+}
+
+// Remove the cache entries of file contents other than the current ones
+static void prune_geo_cache(const char *dir, const uint64_t *hashes, int count) {
+    DIR *dp = opendir(dir);
+    if (!dp) return;
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL) {
+        char *end;
+        if (strncmp(entry->d_name, "geo-", 4) != 0) continue;
+        uint64_t hash = strtoull(entry->d_name + 4, &end, 16);
+        if (end != entry->d_name + 20 || *end != '-') continue;
+        int current = 0;
+        for (int i = 0; i < count && !current; i++) current = hashes[i] == hash;
+        if (current) continue;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dp);
+}
+
+// Resolve the countries from one file into out and set its content hash.
+// Returns 0, or -1 if it cannot be read.
+static int load_geo_file(const char *path, const StringArray *countries, const Settings *settings,
+                         GeoCountry *work, GeoCountry **slots, PrefixList *out, uint64_t *file_hash) {
+    MappedFile file;
+    if (map_file(path, &file) == -1) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Failed to read delegated stats file '%s'", path);
+        log_errno(error_buf);
+        stats_add(STAT_GEO_FAILED, 1);
+        return -1;
+    }
+    int use_cache = settings->cache_dir[0] != '\0';
+    uint64_t hash = fnv1a64(FNV1A64_INIT, file.data, file.size);
+    *file_hash = hash;
+    int to_parse = 0;
+    for (int i = 0; i < countries->count; i++) {
+        GeoCountry *country = &work[i];
+        char key[64];
+        geo_key(hash, countries->items[i], key, sizeof(key));
+        country->v4.count = 0;
+        country->v6.count = 0;
+        country->range_end = 0;
+        country->parse = !use_cache || cache_load(settings->cache_dir, key, AF_INET, &country->v4, NULL) == -1 ||
+                         cache_load(settings->cache_dir, key, AF_INET6, &country->v6, NULL) == -1;
+        if (country->parse) {
+            country->v4.count = 0;
+            country->v6.count = 0;
+            to_parse++;
+        }
+    }
+    if (to_parse > 0) {
+        parse_delegated(path, &file, slots);
+        stats_add(STAT_GEO_PARSED, 1);
+    } else {
+        stats_add(STAT_GEO_UNCHANGED, 1);
+    }
+    unmap_file(&file);
+
+    for (int i = 0; i < countries->count; i++) {
+        GeoCountry *country = &work[i];
+        if (country->parse) {
+            flush_range(country);
+            if (use_cache) {
+                char key[64];
+                geo_key(hash, countries->items[i], key, sizeof(key));
+                cache_store(settings->cache_dir, key, AF_INET, country->v4.items, country->v4.count, 0);
+                cache_store(settings->cache_dir, key, AF_INET6, country->v6.items, country->v6.count, 0);
+            }
+        }
+        for (size_t p = 0; p < country->v4.count; p++) prefix_list_push(&out[2 * i], &country->v4.items[p]);
+        for (size_t p = 0; p < country->v6.count; p++) prefix_list_push(&out[2 * i + 1], &country->v6.items[p]);
+    }
+    log_info("Delegated stats %s: %s\n", path, to_parse > 0 ? "parsed" : "unchanged, cached");
+    return 0;
+}
+
+int load_geo(const StringArray *files, const StringArray *countries, const Settings *settings, PrefixList *out) {
+    GeoCountry *slots[GEO_MAX_COUNTRIES] = { NULL };
+    GeoCountry *work = (GeoCountry*)calloc(countries->count > 0 ? countries->count : 1, sizeof(GeoCountry));
+    uint64_t *hashes = (uint64_t*)calloc(files->count > 0 ? files->count : 1, sizeof(uint64_t));
+    if (!work || !hashes) {
+        log_errno("Failed to allocate memory for country prefixes");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < countries->count; i++) {
+        init_prefix_list(&work[i].v4, 1024);
+        init_prefix_list(&work[i].v6, 1024);
+        init_prefix_list(&out[2 * i], 1024);
+        init_prefix_list(&out[2 * i + 1], 1024);
+        slots[country_slot(countries->items[i], 2)] = &work[i];
+    }
+    int failed = 0;
+    for (int f = 0; f < files->count; f++) {
+        if (load_geo_file(files->items[f], countries, settings, work, slots, out, &hashes[f]) == -1) failed++;
+    }
+    // An unreadable file keeps its entries for the next run
+    if (!failed && settings->cache_dir[0]) prune_geo_cache(settings->cache_dir, hashes, files->count);
+    for (int i = 0; i < countries->count; i++) {
+        prefix_list_sort_unique(&out[2 * i]);
+        prefix_list_sort_unique(&out[2 * i + 1]);
+        free_prefix_list(&work[i].v4);
+        free_prefix_list(&work[i].v6);
+    }
+    free(work);
+    free(hashes);
+    return failed;
+}
@@ -4,92 +4,21 @@
 #include <ctype.h>       // For isspace
 #include <netinet/in.h>  // For INET6_ADDRSTRLEN
 #include <arpa/inet.h>   // For inet_pton and inet_ntop
-#include <unistd.h>      // For popen/pclose
-#include <sys/wait.h>    // For WIFEXITED, WEXITSTATUS
+#include <getopt.h>      // For getopt_long
+#include <linux/rtnetlink.h> // For RTM_NEWROUTE/RTM_DELROUTE
 
-#define BGPQ_COMMAND "bgpq4" // Or "bgpq3" if you use that
-#define CONFIG_FILE "/etc/ipban/routes.toml"
-
-// --- Dynamic array for storing routes ---
-typedef struct {
-    char **routes;
-    int count;
-    int capacity;
-} RouteArray;
-
-// Initialize route array
-void init_route_array(RouteArray *array, int initial_capacity) {
-    if (initial_capacity <= 0) initial_capacity = 10; // Ensure positive capacity
-    array->routes = (char**)malloc(initial_capacity * sizeof(char*));
-    if (!array->routes) {
-        perror("Failed to allocate memory for route array");
-        exit(EXIT_FAILURE);
-    }
-    array->count = 0;
-    array->capacity = initial_capacity;
-}
+#include "ipban.h"
 
-// Add route to array
-void add_route(RouteArray *array, const char *route) {
-    // Check for duplicates (optional, but good practice)
-    for (int i = 0; i < array->count; i++) {
-        if (strcmp(array->routes[i], route) == 0) {
-            //printf("Debug: Duplicate route found, skipping: %s\n", route);
-            return; // Don't add duplicates
-        }
-    }
-
-    // Increase array size if necessary
-    if (array->count >= array->capacity) {
-        int new_capacity = array->capacity * 2;
-        if (new_capacity < array->count + 1) new_capacity = array->count + 10; // Ensure growth
-        char **new_routes = (char**)realloc(array->routes, new_capacity * sizeof(char*));
-        if (!new_routes) {
-            perror("Failed to reallocate memory for route array");
-            fprintf(stderr, "Warning: Could not expand route array capacity.\n");
-            // Consider exiting or handling memory exhaustion more gracefully
-            return;
-        }
-        array->routes = new_routes;
-        array->capacity = new_capacity;
-    }
-
-    // Copy route
-    array->routes[array->count] = strdup(route);
-    if (!array->routes[array->count]) {
-        perror("Failed to duplicate route string");
-        // Handle error appropriately
-        return; // Or exit
-    }
-    array->count++;
-}
-
-// Free memory for RouteArray
-void free_route_array(RouteArray *array) {
-    if (array->routes) {
-        for (int i = 0; i < array->count; i++) {
-            free(array->routes[i]);
-        }
-        free(array->routes);
-    }
-    array->routes = NULL;
-    array->count = 0;
-    array->capacity = 0;
-}
+#define CONFIG_FILE "/etc/ipban/routes.toml"
 
 // --- Dynamic array for storing AS numbers ---
-typedef struct {
-    char **asns;
-    int count;
-    int capacity;
-} AsnArray;
 
 // Initialize ASN array
 void init_asn_array(AsnArray *array, int initial_capacity) {
     if (initial_capacity <= 0) initial_capacity = 10; // Ensure positive capacity
     array->asns = (char**)malloc(initial_capacity * sizeof(char*));
     if (!array->asns) {
-        perror("Failed to allocate memory for ASN array");
+        log_errno("Failed to allocate memory for ASN array");
         exit(EXIT_FAILURE);
     }
     array->count = 0;
@@ -111,8 +40,8 @@ void add_asn(AsnArray *array, const char *asn) {
         if (new_capacity < array->count + 1) new_capacity = array->count + 5; // Ensure growth
         char **new_asns = (char**)realloc(array->asns, new_capacity * sizeof(char*));
         if (!new_asns) {
-            perror("Failed to reallocate memory for ASN array");
-            fprintf(stderr, "Warning: Could not expand ASN array capacity.\n");
+            log_errno("Failed to reallocate memory for ASN array");
+            log_warn("Could not expand ASN array capacity.\n");
             return; // Or exit
         }
         array->asns = new_asns;
@@ -122,7 +51,7 @@ void add_asn(AsnArray *array, const char *asn) {
     // Copy ASN
     array->asns[array->count] = strdup(asn);
     if (!array->asns[array->count]) {
-        perror("Failed to duplicate ASN string");
+        log_errno("Failed to duplicate ASN string");
         return; // Or exit
     }
     array->count++;
@@ -141,6 +70,49 @@ void free_asn_array(AsnArray *array) {
     array->capacity = 0;
 }
 
+// --- Dynamic array of strings ---
+
+void init_string_array(StringArray *array, int initial_capacity) {
+    if (initial_capacity <= 0) initial_capacity = 4;
+    array->items = (char**)malloc(initial_capacity * sizeof(char*));
+    if (!array->items) {
+        log_errno("Failed to allocate memory for string array");
+        exit(EXIT_FAILURE);
+    }
+    array->count = 0;
+    array->capacity = initial_capacity;
+}
+
+void add_string(StringArray *array, const char *str) {
+    for (int i = 0; i < array->count; i++) {
+        if (strcmp(array->items[i], str) == 0) return;
+    }
+    if (array->count >= array->capacity) {
+        int new_capacity = array->capacity * 2;
+        char **new_items = (char**)realloc(array->items, new_capacity * sizeof(char*));
+        if (!new_items) {
+            log_errno("Failed to reallocate memory for string array");
+            exit(EXIT_FAILURE);
+        }
+        array->items = new_items;
+        array->capacity = new_capacity;
+    }
+    array->items[array->count] = strdup(str);
+    if (!array->items[array->count]) {
+        log_errno("Failed to duplicate string");
+        exit(EXIT_FAILURE);
+    }
+    array->count++;
+}
+
+void free_string_array(StringArray *array) {
+    for (int i = 0; i < array->count; i++) free(array->items[i]);
+    free(array->items);
+    array->items = NULL;
+    array->count = 0;
+    array->capacity = 0;
+}
+
 
 // --- Helper Functions ---
 
@@ -165,441 +137,597 @@ char *trim_whitespace(char *str) {
     return str;
 }
 
+// --- Route Application ---
 
-// Function to execute system command
-void execute_command(const char *cmd) {
-    printf("Executing: %s\n", cmd);
-    int ret = system(cmd); // system() returns format related to wait() status
+// Whether build_desired aggregates. The nftables sets reject overlapping
+// elements, so that backend always needs it.
+int aggregate_enabled(const Settings *settings) {
+    return settings->aggregate || strcmp(settings->backend, "nftables") == 0;
+}
 
-    if (ret == -1) {
-        perror("system() failed"); // Error invoking shell or command
-    } else if (WIFEXITED(ret)) {
-        int exit_status = WEXITSTATUS(ret);
-        if (exit_status != 0) {
-            // Check if it's a 'del' command and the error might be "No such file or directory" (typical for non-existent route)
-            // ESRCH (No such process) from `ip route del` also maps to exit code 2 in some cases.
-            // Exit code 254 can also indicate object doesn't exist for `ip route del`.
-            if (strstr(cmd, " del ") != NULL && (exit_status == 2 || exit_status == 254)) {
-                fprintf(stderr, "Info: Command likely failed because route didn't exist: %s (exit code: %d)\n", cmd, exit_status);
-            } else {
-                fprintf(stderr, "Error executing command: %s (exit code: %d)\n", cmd, exit_status);
-                // Consider if failure should be fatal depending on the command (e.g., adding routes)
-                // if (strstr(cmd, " add ")) exit(EXIT_FAILURE);
-            }
+// Copy the raw prefix list, aggregate it if enabled and cut out the allowed
+// prefixes. Returns the number of blocks dropped or split for them.
+size_t build_desired(const PrefixList *raw, const Settings *settings, const PrefixList *allow,
+                     PrefixList *out, const char *label) {
+    for (size_t i = 0; i < raw->count; i++) {
+        prefix_list_push(out, &raw->items[i]);
+    }
+    // Collapse covered and adjacent prefixes into as few routes as possible
+    if (aggregate_enabled(settings)) {
+        aggregate_prefix_list(out);
+        log_info("Aggregated %s prefixes: %zu in, %zu out\n", label, raw->count, out->count);
+    }
+    if (allow->count == 0) return 0;
+    PrefixTrie trie;
+    init_prefix_trie(&trie, allow);
+    size_t before = out->count;
+    size_t carved = subtract_prefix_list(out, &trie);
+    log_info("Allowed %s prefixes: %zu blocks dropped or split, %zu in, %zu out\n",
+             label, carved, before, out->count);
+    // Cheap enough to always verify: no remaining block may touch an allowed address
+    for (size_t i = 0; i < out->count; i++) {
+        if (prefix_trie_overlaps(&trie, &out->items[i])) {
+            char text[PREFIX_STRLEN];
+            log_error("%s still overlaps an allowed prefix after subtraction\n",
+                      format_prefix(&out->items[i], text, sizeof(text)));
         }
-        // Exit status 0 means success, do nothing.
-    } else if (WIFSIGNALED(ret)) {
-        fprintf(stderr, "Error: Command terminated by signal %d: %s\n", WTERMSIG(ret), cmd);
+    }
+    free_prefix_trie(&trie);
+    return carved;
+}
+
+// Add or delete a list of blackhole routes over netlink and print a summary
+int apply_prefixes(NlSocket *nl, int cmd, const PrefixList *prefixes, const char *label) {
+    NlResult result = {0};
+    if (prefixes->count == 0) return 0;
+    char phase[32];
+    snprintf(phase, sizeof(phase), "%s_%s", cmd == RTM_NEWROUTE ? "add" : "delete",
+             prefixes->items[0].family == AF_INET ? "ipv4" : "ipv6");
+    double start = stats_now();
+    int ret = nl_route_batch(nl, cmd, prefixes->items, prefixes->count, &result);
+    stats_phase(phase, start, prefixes->count);
+    stats_add(STAT_KERNEL_OPS, prefixes->count);
+    stats_add(STAT_KERNEL_OPS_FAILED, result.failed);
+    stats_add(cmd == RTM_NEWROUTE ? STAT_ROUTES_ADDED : STAT_ROUTES_REMOVED, result.ok);
+    if (cmd == RTM_NEWROUTE) {
+        log_info("  %s: %zu added, %zu already existed, %zu failed\n", label, result.ok, result.exists, result.failed);
     } else {
-        fprintf(stderr, "Error: Command terminated abnormally: %s (raw return: %d)\n", cmd, ret);
+        log_info("  %s: %zu removed, %zu already gone, %zu failed\n", label, result.ok, result.absent, result.failed);
+    }
+    if (result.acks_lost) {
+        log_warn("Netlink receive buffer overflowed, some per-route errors were not reported.\n");
     }
+    return ret == -1 || result.failed > 0 || result.acks_lost ? -1 : 0;
 }
 
-// --- Configuration Reading ---
-
-// Function to read configuration file (routes and ASNs)
-int read_config(const char *filename, const char *route_section_v4, RouteArray *routes_v4,
-                const char *route_section_v6, RouteArray *routes_v6,
-                const char *asn_section, AsnArray *asns) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        char error_buf[512];
-        snprintf(error_buf, sizeof(error_buf), "Failed to open configuration file '%s'", filename);
-        perror(error_buf);
-        return -1;
+// Bring the kernel's blackhole routes for one family in line with the desired set:
+// dump what is installed, then add only what is missing and remove what is no longer wanted.
+// If ACKs were lost on the way, the outcome is only known from a new dump, so the
+// pass is repeated (RESYNC_ATTEMPTS times at most).
+int reconcile_routes(NlSocket *nl, int family, const PrefixList *desired, const char *label) {
+    int failed = 0;
+    for (int attempt = 0; attempt < RESYNC_ATTEMPTS; attempt++) {
+        PrefixList installed, to_add, to_remove;
+        init_prefix_list(&installed, desired->count + 16);
+        double start = stats_now();
+        if (nl_dump_blackholes(nl, family, &installed) == -1) {
+            log_error("Could not read installed %s blackhole routes.\n", label);
+            free_prefix_list(&installed);
+            return -1;
+        }
+        prefix_list_sort_unique(&installed);
+        stats_phase(family == AF_INET ? "dump_ipv4" : "dump_ipv6", start, installed.count);
+
+        init_prefix_list(&to_add, 16);
+        init_prefix_list(&to_remove, 16);
+        diff_prefix_lists(desired, &installed, &to_add, &to_remove);
+        log_info("%s: %zu desired, %zu installed, %zu to add, %zu to remove\n",
+                 label, desired->count, installed.count, to_add.count, to_remove.count);
+
+        // Add first so newly listed prefixes are blocked as early as possible
+        nl->acks_lost = 0;
+        failed = apply_prefixes(nl, RTM_NEWROUTE, &to_add, label) == -1;
+        if (apply_prefixes(nl, RTM_DELROUTE, &to_remove, label) == -1) failed = 1;
+
+        free_prefix_list(&installed);
+        free_prefix_list(&to_add);
+        free_prefix_list(&to_remove);
+        if (!nl->acks_lost) break;
+        if (attempt + 1 < RESYNC_ATTEMPTS) {
+            log_warn("%s: some results were lost, checking the installed routes again.\n", label);
+        }
     }
+    return failed ? -1 : 0;
+}
 
-    char *line = NULL;
-    size_t line_cap = 0;
-    ssize_t line_len;
-    char current_section[256] = "";
-    int line_num = 0;
+// --- Drift audit ---
 
-    while ((line_len = getline(&line, &line_cap, file)) > 0) {
-        line_num++;
+typedef struct {
+    const PrefixList *desired;
+    uint64_t *seen;         // One bit per desired prefix
+    CheckResult *result;
+    int protocol;           // Ours; blackholes of other protocols are foreign
+} CheckIndex;
+
+// Account for one installed blackhole: desired prefixes are looked up by binary
+// search in the sorted desired list and marked in a bitmap, so a dump of any
+// size is checked without keeping a copy of it
+static void check_route(const Prefix *prefix, int protocol, void *ctx) {
+    CheckIndex *index = (CheckIndex *)ctx;
+    const Prefix *found = (const Prefix *)bsearch(prefix, index->desired->items, index->desired->count,
+                                                  sizeof(Prefix), prefix_cmp);
+    if (found) {
+        size_t i = (size_t)(found - index->desired->items);
+        if (!(index->seen[i / 64] & (1ULL << (i % 64)))) {
+            index->seen[i / 64] |= 1ULL << (i % 64);
+            index->result->present++;
+        }
+    } else if (protocol == index->protocol) {
+        index->result->extra++;
+    } else {
+        index->result->foreign++;
+    }
+}
+
+// Compare installed blackholes with the desired set without changing anything
+int check_routes(NlSocket *nl, int family, const PrefixList *desired, CheckResult *result) {
+    CheckIndex index = { desired, NULL, result, nl->protocol };
+    index.seen = (uint64_t*)calloc(desired->count / 64 + 1, sizeof(uint64_t));
+    if (!index.seen) {
+        log_errno("Failed to allocate memory for route check");
+        exit(EXIT_FAILURE);
+    }
+    size_t present_before = result->present;
+    int ret = nl_walk_blackholes(nl, family, check_route, &index);
+    free(index.seen);
+    if (ret == -1) {
+        log_error("Could not read installed %s blackhole routes.\n", family == AF_INET ? "IPv4" : "IPv6");
+        return -1;
+    }
+    result->expected += desired->count;
+    result->missing += desired->count - (result->present - present_before);
+    return 0;
+}
 
-        // Strip comments early
-        char *comment_char = strchr(line, '#');
-        if (comment_char) *comment_char = '\0';
-        comment_char = strchr(line, ';');
-        if (comment_char) *comment_char = '\0';
 
-        // Remove newline and trim whitespace
-        line[strcspn(line, "\n")] = 0;
-        char* trimmed_line = trim_whitespace(line);
-        if (!trimmed_line || strlen(trimmed_line) == 0) {
-            continue; // Skip empty or comment-only lines
+// Append the prefixes of all feeds to the sorted raw lists, bypassing the route
+// store. If keep is not NULL, keep[2 * i] and keep[2 * i + 1] receive the IPv4
+// and IPv6 prefixes of feed i. Returns the number of feeds that could not be read.
+static int load_feeds(const Config *config, PrefixList *raw_v4, PrefixList *raw_v6, PrefixList *keep) {
+    int failed = 0;
+    log_info("\nLoading %d feeds...\n", config->feeds.count);
+    for (int i = 0; i < config->feeds.count; i++) {
+        FeedState feed;
+        PrefixList v4, v6;
+        init_feed_state(&feed, config->feeds.items[i]);
+        init_prefix_list(&v4, 1024);
+        init_prefix_list(&v6, 1024);
+        int ret = load_feed(&feed, &config->settings, &v4, &v6);
+        if (ret == -1) failed++;
+        stats_source("feed", feed.path, v4.count, v6.count, 0, 0, ret == -1);
+        stats_add(STAT_PREFIXES_FEED, v4.count + v6.count);
+        for (size_t p = 0; p < v4.count; p++) prefix_list_push(raw_v4, &v4.items[p]);
+        for (size_t p = 0; p < v6.count; p++) prefix_list_push(raw_v6, &v6.items[p]);
+        if (keep) {
+            keep[2 * i] = v4;
+            keep[2 * i + 1] = v6;
+        } else {
+            free_prefix_list(&v4);
+            free_prefix_list(&v6);
         }
-        line_len = strlen(trimmed_line);
-
-        // Look for section start
-        if (trimmed_line[0] == '[' && trimmed_line[line_len - 1] == ']') {
-            strncpy(current_section, trimmed_line + 1, sizeof(current_section) - 1);
-            current_section[sizeof(current_section) - 1] = '\0';
-            char *closing_bracket = strchr(current_section, ']');
-            if (closing_bracket) *closing_bracket = '\0';
-            trim_whitespace(current_section);
-            continue;
+        free_feed_state(&feed);
+    }
+    prefix_list_sort_unique(raw_v4);
+    prefix_list_sort_unique(raw_v6);
+    return failed;
+}
+
+// Append the prefixes of the [geo_block] countries to the sorted raw lists. If
+// keep is not NULL, keep[2 * i] and keep[2 * i + 1] receive the IPv4 and IPv6
+// prefixes of country i. Returns the number of files that could not be read.
+static int load_countries(const Config *config, PrefixList *raw_v4, PrefixList *raw_v6, PrefixList *keep) {
+    int count = config->geo_countries.count;
+    log_info("\nResolving %d countries from %d delegated stats files...\n", count, config->geo_files.count);
+    if (config->geo_files.count == 0) {
+        log_warn("[geo_block] lists countries but no files to resolve them from.\n");
+        return 0;
+    }
+    PrefixList *lists = keep;
+    if (!lists) lists = (PrefixList*)calloc(2 * count, sizeof(PrefixList));
+    if (!lists) {
+        log_errno("Failed to allocate memory for country prefixes");
+        exit(EXIT_FAILURE);
+    }
+    int failed = load_geo(&config->geo_files, &config->geo_countries, &config->settings, lists);
+    for (int i = 0; i < count; i++) {
+        PrefixList *v4 = &lists[2 * i], *v6 = &lists[2 * i + 1];
+        log_info("Country %s: %zu IPv4, %zu IPv6 prefixes\n", config->geo_countries.items[i], v4->count, v6->count);
+        stats_source("geo", config->geo_countries.items[i], v4->count, v6->count, 0, 0, failed > 0);
+        stats_add(STAT_PREFIXES_GEO, v4->count + v6->count);
+        for (size_t p = 0; p < v4->count; p++) prefix_list_push(raw_v4, &v4->items[p]);
+        for (size_t p = 0; p < v6->count; p++) prefix_list_push(raw_v6, &v6->items[p]);
+    }
+    if (!keep) {
+        for (int i = 0; i < 2 * count; i++) free_prefix_list(&lists[i]);
+        free(lists);
+    }
+    prefix_list_sort_unique(raw_v4);
+    prefix_list_sort_unique(raw_v6);
+    return failed;
+}
+
+// Write the lookup index from the per-source lists kept during the run
+static void write_index(const Config *config, const PrefixList config_lists[2], const AsnPrefixes *asn_sets,
+                        const PrefixList *feed_lists, const PrefixList *geo_lists, const PrefixList *allow_v4,
+                        const PrefixList *allow_v6) {
+    static const PrefixList empty = { NULL, 0, 0 };
+    int geo_first = 2 + config->asns.count + config->feeds.count;
+    int count = geo_first + config->geo_countries.count + 1;
+    IndexSource *sources = (IndexSource*)malloc(count * sizeof(IndexSource));
+    if (!sources) {
+        log_errno("Failed to allocate memory for index sources");
+        exit(EXIT_FAILURE);
+    }
+    sources[0] = (IndexSource){ "config", "ipv4_routes", &config_lists[0], &empty };
+    sources[1] = (IndexSource){ "config", "ipv6_routes", &empty, &config_lists[1] };
+    sources[count - 1] = (IndexSource){ "allow", "config", allow_v4, allow_v6 };
+    for (int i = 0; i < config->asns.count; i++) {
+        sources[2 + i] = (IndexSource){ "asn", config->asns.asns[i], &asn_sets[i].v4, &asn_sets[i].v6 };
+    }
+    for (int i = 0; i < config->feeds.count; i++) {
+        sources[2 + config->asns.count + i] =
+            (IndexSource){ "feed", config->feeds.items[i], &feed_lists[2 * i], &feed_lists[2 * i + 1] };
+    }
+    for (int i = 0; i < config->geo_countries.count; i++) {
+        sources[geo_first + i] =
+            (IndexSource){ "geo", config->geo_countries.items[i], &geo_lists[2 * i], &geo_lists[2 * i + 1] };
+    }
+    double start = stats_now();
+    lpm_write_index(config->settings.index_file, sources, count);
+    stats_phase("index", start, config_lists[0].count + config_lists[1].count);
+    free(sources);
+}
+
+// --check: print a one-line summary per family of one backend (where names its
+// namespace, NULL for our own). Returns the exit code: 0 in sync, 2 on drift, 1
+// if the state could not be read. Foreign blackholes are reported but left to
+// whoever installed them, so they are not drift.
+static int run_check(Backend *backend, const PrefixList *desired[2], const char *where) {
+    if (!backend->check) {
+        log_error("--check is not supported by the '%s' backend.\n", backend->name);
+        return 1;
+    }
+    CheckResult result[2];
+    memset(result, 0, sizeof(result));
+    log_info("\n--- Checking Block Set (%s backend%s%s) ---\n", backend->name, where ? ", " : "", where ? where : "");
+    if (backend->check(backend, desired, result) == -1) return 1;
+    int drift = 0;
+    for (int f = 0; f < 2; f++) {
+        log_info("%s: expected %zu, present %zu, missing %zu, extra %zu, foreign %zu\n", f == 0 ? "IPv4" : "IPv6",
+                 result[f].expected, result[f].present, result[f].missing, result[f].extra, result[f].foreign);
+        if (result[f].missing || result[f].extra) drift = 1;
+    }
+    log_info("%s\n", drift ? "Drift detected." : "In sync.");
+    return drift ? 2 : 0;
+}
+
+// Combine check results: unreadable beats drift beats in sync
+static int worse_check(int a, int b) {
+    if (a == 1 || b == 1) return 1;
+    return a > b ? a : b;
+}
+
+// --flush: remove everything ipban enforces through the configured backend, in
+// our namespace and the [namespaces]. Returns the exit code.
+static int run_flush(const Config *config, const char *timings_file) {
+    Backend backend;
+    if (backend_open(&backend, &config->settings) == -1) {
+        log_error("Failed to set up the '%s' backend. Exiting.\n", config->settings.backend);
+        return 1;
+    }
+    if (!backend.flush) {
+        log_error("--flush is not supported by the '%s' backend.\n", backend.name);
+        backend_close(&backend);
+        return 1;
+    }
+    NetnsSet netns;
+    init_netns_set(&netns);
+    int failed = netns_sync(&netns, &config->namespaces, &config->settings) > 0;
+    log_info("\n--- Flushing Block Set (%s backend) ---\n", backend.name);
+    double start = stats_now();
+    if (backend.flush(&backend) == -1) failed = 1;
+    for (int i = 0; i < netns.count; i++) {
+        if (netns.targets[i].backend.flush(&netns.targets[i].backend) == -1) failed = 1;
+    }
+    stats_phase("flush", start, stats_get(STAT_ROUTES_REMOVED));
+    free_netns_set(&netns);
+    backend_close(&backend);
+    stats_write(config->settings.stats_textfile, timings_file ? timings_file : config->settings.stats_json, !failed);
+    log_info("%s\n", failed ? "Flush incomplete." : "Done.");
+    return failed ? 1 : 0;
+}
+
+// --- Main Function ---
+
+void print_usage(const char *prog) {
+    printf("Usage: %s [-c config_file] [-d | --check | --flush] [-t timings_file]\n", prog);
+    printf("       %s [-c config_file | --index FILE] --lookup [ADDR...]\n", prog);
+    printf("       %s [-c config_file] --scan-logs [FILE...]\n", prog);
+    printf("  -c, --config FILE   Configuration file (default: %s)\n", CONFIG_FILE);
+    printf("  -d, --daemon        Keep running, reload the config on change and apply only the delta\n");
+    printf("      --check         Compare the enforced prefixes with the config without changing them;\n");
+    printf("                      exit 2 if they differ\n");
+    printf("      --flush         Remove all routes (and rules) installed by ipban, leaving others alone\n");
+    printf("  -t, --timings FILE  Write per-phase timings and counters as JSON to FILE\n");
+    printf("  -l, --lookup [ADDR...]\n");
+    printf("                      Show which listed prefix and source block each address (or the first\n");
+    printf("                      field of each line on stdin), using the index_file of the config\n");
+    printf("      --index FILE    Lookup index to use with --lookup instead of index_file\n");
+    printf("      --scan-logs [FILE...]\n");
+    printf("                      Run the [logwatch] patterns over whole files (or stdin) and print the\n");
+    printf("                      addresses with log_threshold or more matching lines\n");
+    printf("  -v, --verbose       Log at debug level, overriding log_level\n");
+    printf("  -q, --quiet         Log only warnings and errors, overriding log_level\n");
+    printf("  -h, --help          Show this help\n");
+}
+
+int main(int argc, char **argv) {
+    const char *config_file = CONFIG_FILE;
+    int daemon_mode = 0;
+    int check_mode = 0;
+    int lookup_mode = 0;
+    int scan_mode = 0;
+    int flush_mode = 0;
+    const char *index_file = NULL;
+    const char *timings_file = NULL;
+    static const struct option long_options[] = {
+        {"config", required_argument, NULL, 'c'},
+        {"daemon", no_argument,       NULL, 'd'},
+        {"check",  no_argument,       NULL, 'K'},
+        {"flush",  no_argument,       NULL, 'F'},
+        {"timings", required_argument, NULL, 't'},
+        {"lookup", no_argument,       NULL, 'l'},
+        {"index",  required_argument, NULL, 'I'},
+        {"scan-logs", no_argument,    NULL, 'S'},
+        {"verbose", no_argument,      NULL, 'v'},
+        {"quiet",  no_argument,       NULL, 'q'},
+        {"help",   no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    log_start();
+    while ((opt = getopt_long(argc, argv, "c:dt:lvqh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': config_file = optarg; break;
+            case 'd': daemon_mode = 1; break;
+            case 'K': check_mode = 1; break;
+            case 'F': flush_mode = 1; break;
+            case 'l': lookup_mode = 1; break;
+            case 'I': index_file = optarg; break;
+            case 'S': scan_mode = 1; break;
+            case 't': timings_file = optarg; break;
+            case 'v': log_pin_level(LOG_LEVEL_DEBUG); break;
+            case 'q': log_pin_level(LOG_LEVEL_WARN); break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
         }
+    }
 
-        // Process key = value lines within sections
-        char *key = strtok(trimmed_line, "=");
-        char *value = strtok(NULL, "=");
+    if (daemon_mode) {
+        return run_daemon(config_file);
+    }
 
-        if (!key || !value) {
-            continue; // Skip lines not in key=value format
+    Config config;
+
+    // stdout carries the results of these modes
+    if (lookup_mode || scan_mode) log_to_stderr();
+
+    if (lookup_mode) {
+        if (index_file) return run_lookup(index_file, argv + optind, argc - optind);
+        if (load_config(config_file, &config) == -1) {
+            log_error("Failed to read or parse configuration file. Exiting.\n");
+            return 1;
+        }
+        log_configure(&config.settings);
+        int ret = 1;
+        if (config.settings.index_file[0] == '\0') {
+            log_error("No index_file in %s, use --index FILE.\n", config_file);
+        } else {
+            ret = run_lookup(config.settings.index_file, argv + optind, argc - optind);
+        }
+        free_config(&config);
+        return ret;
+    }
+
+    if (scan_mode) {
+        if (load_config(config_file, &config) == -1) {
+            log_error("Failed to read or parse configuration file. Exiting.\n");
+            return 1;
         }
+        log_configure(&config.settings);
+        int ret = run_scan_logs(&config, argv + optind, argc - optind);
+        free_config(&config);
+        return ret;
+    }
 
-        key = trim_whitespace(key);
-        value = trim_whitespace(value);
+    if (flush_mode) {
+        if (load_config(config_file, &config) == -1) {
+            log_error("Failed to read or parse configuration file. Exiting.\n");
+            return 1;
+        }
+        log_configure(&config.settings);
+        int ret = run_flush(&config, timings_file);
+        free_config(&config);
+        return ret;
+    }
 
-        if (!key || !value || strlen(key) == 0 || strlen(value) == 0) {
-            continue; // Skip if key or value became empty after trim
+    // Read configuration
+    log_info("Reading configuration from %s...\n", config_file);
+    double start = stats_now();
+    if (load_config(config_file, &config) == -1) {
+        log_error("Failed to read or parse configuration file. Exiting.\n");
+        return 1;
+    }
+    log_configure(&config.settings);
+    stats_phase("config", start, config.routes_v4.count + config.routes_v6.count);
+    stats_set(STAT_PREFIXES_CONFIG, config.routes_v4.count + config.routes_v6.count);
+
+    log_info("Read %zu direct IPv4 routes, %zu direct IPv6 routes, %d ASNs, %d feeds and %d countries to block.\n",
+             config.routes_v4.count, config.routes_v6.count, config.asns.count, config.feeds.count,
+             config.geo_countries.count);
+
+
+    // The lookup index needs the prefixes of every source separately
+    int want_index = config.settings.index_file[0] != '\0' && !check_mode;
+    PrefixList config_lists[2];
+    AsnPrefixes *asn_sets = NULL;
+    PrefixList *feed_lists = NULL;
+    PrefixList *geo_lists = NULL;
+    if (want_index) {
+        init_prefix_list(&config_lists[0], config.routes_v4.count);
+        init_prefix_list(&config_lists[1], config.routes_v6.count);
+        route_array_to_list(&config.routes_v4, &config_lists[0]);
+        route_array_to_list(&config.routes_v6, &config_lists[1]);
+        asn_sets = (AsnPrefixes*)calloc(config.asns.count > 0 ? config.asns.count : 1, sizeof(AsnPrefixes));
+        feed_lists = (PrefixList*)calloc(config.feeds.count > 0 ? 2 * config.feeds.count : 1, sizeof(PrefixList));
+        geo_lists = (PrefixList*)calloc(config.geo_countries.count > 0 ? 2 * config.geo_countries.count : 1,
+                                        sizeof(PrefixList));
+        if (!asn_sets || !feed_lists || !geo_lists) {
+            log_errno("Failed to allocate memory for index sources");
+            exit(EXIT_FAILURE);
         }
+    }
 
+    // Fetch prefixes for specified ASNs, several bgpq4 runs at a time
+    log_info("\nFetching prefixes for %d ASNs specified in config (%d parallel fetches)...\n",
+             config.asns.count, config.settings.fetch_jobs);
+    FetchSummary fetch_summary;
+    start = stats_now();
+    int total_fetched_prefixes = fetch_asn_prefixes(&config.asns, &config.settings,
+                                                    &config.routes_v4, &config.routes_v6, &fetch_summary, asn_sets);
+    if (fetch_summary.cached_asns > 0) {
+        log_info("%d ASNs served from cache (%s).\n", fetch_summary.cached_asns, config.settings.cache_dir);
+    }
+    if (fetch_summary.stale_asns > 0) {
+        log_warn("%d ASNs could not be fetched and use older cached data.\n", fetch_summary.stale_asns);
+    }
+    stats_phase("fetch", start, total_fetched_prefixes);
+    stats_set(STAT_PREFIXES_ASN, total_fetched_prefixes);
+    int asn_fetch_failed = fetch_summary.failed_asns > 0; // Flag if any fetch command failed to run
+    log_info("Finished fetching ASN prefixes. Added %d prefixes from ASN lookups.\n", total_fetched_prefixes);
+
+    if (asn_fetch_failed) {
+        log_warn("One or more ASN prefix lookups failed to execute. Route list may be incomplete.\n");
+        // Optionally exit here if this is critical:
+        // free_config(&config); return 1;
+    }
+
+    // --- Apply Routes ---
 
-        RouteArray* target_routes = NULL;
-        // Determine target based on section and key
-        if (strcmp(current_section, route_section_v4) == 0 && strcmp(key, "routes") == 0) {
-            target_routes = routes_v4;
-        } else if (strcmp(current_section, route_section_v6) == 0 && strcmp(key, "routes") == 0) {
-            target_routes = routes_v6;
-        } else if (strcmp(current_section, asn_section) == 0 && strcmp(key, "as_numbers") == 0) {
-            // Process ASNs list
-            if (strlen(value) >= 2 && value[0] == '[' && value[strlen(value) - 1] == ']') {
-                value[strlen(value) - 1] = '\0'; // Remove ']'
-                value++; // Skip '['
-
-                if (strlen(value) == 0) continue; // Handle empty list "[]"
-
-                char *item_copy = strdup(value);
-                if(!item_copy) { perror("strdup failed for ASN list"); continue; }
-
-                char *token = strtok(item_copy, ",");
-                while (token) {
-                    char* asn_val = trim_whitespace(token);
-                    if (asn_val && strlen(asn_val) > 0) {
-                        if (strlen(asn_val) >= 2 && asn_val[0] == '"' && asn_val[strlen(asn_val) - 1] == '"') {
-                            asn_val[strlen(asn_val) - 1] = '\0';
-                            asn_val++;
-                        }
-                        asn_val = trim_whitespace(asn_val);
-                        if(asn_val && strlen(asn_val) > 0) {
-                            // Basic validation
-                            char *endptr;
-                            const char *check_asn = (strncmp(asn_val, "AS", 2) == 0 || strncmp(asn_val, "as", 2) == 0) ? asn_val + 2 : asn_val;
-                            strtol(check_asn, &endptr, 10);
-
-                            if (*endptr == '\0' && strlen(check_asn) > 0) { // Must be numeric after optional AS and non-empty
-                                add_asn(asns, asn_val); // Add original format (with AS if present)
-                            } else {
-                                fprintf(stderr, "Warning: Invalid ASN format '%s' on line %d\n", asn_val, line_num);
-                            }
-                        }
-                    }
-                    token = strtok(NULL, ",");
-                }
-                free(item_copy);
-            } else {
-                fprintf(stderr, "Warning: Malformed AS number list value on line %d: '%s'\n", line_num, value);
-            }
-            continue; // Handled ASN line
-        } // end ASN processing
-
-        // Process routes list (common logic for v4 and v6)
-        if (target_routes) {
-            if (strlen(value) >= 2 && value[0] == '[' && value[strlen(value) - 1] == ']') {
-                value[strlen(value) - 1] = '\0'; // Remove ']'
-                value++; // Skip '['
-
-                if (strlen(value) == 0) continue; // Handle empty list "[]"
-
-                char *item_copy = strdup(value);
-                if(!item_copy) { perror("strdup failed for route list"); continue; }
-
-                char *token = strtok(item_copy, ",");
-                while (token) {
-                    char* route_val = trim_whitespace(token);
-                    if (route_val && strlen(route_val) > 0) {
-                        if (strlen(route_val) >= 2 && route_val[0] == '"' && route_val[strlen(route_val) - 1] == '"') {
-                            route_val[strlen(route_val) - 1] = '\0';
-                            route_val++;
-                        }
-                        route_val = trim_whitespace(route_val);
-                        if(route_val && strlen(route_val) > 0) {
-                            // Basic validation: check for '/'
-                            if (strchr(route_val, '/')) {
-                                add_route(target_routes, route_val);
-                            } else {
-                                fprintf(stderr, "Warning: Invalid route format (missing '/') '%s' on line %d\n", route_val, line_num);
-                            }
-                        }
-                    }
-                    token = strtok(NULL, ",");
-                }
-                free(item_copy);
-            } else {
-                fprintf(stderr, "Warning: Malformed route list value on line %d: '%s'\n", line_num, value);
-            }
-        } // end route processing
-
-    } // end while getline
-
-    free(line);
-    fclose(file);
-
-    return 0; // Indicate success
-                }
-
-
-                // --- ASN Prefix Fetching ---
-
-                // Function to fetch prefixes for an ASN using bgpq4 and add them to route arrays - CORRECTED for plain output
-                int fetch_and_add_prefixes(const char *asn, RouteArray *routes_v4, RouteArray *routes_v6) {
-                    char cmd[512];
-                    FILE *fp;
-                    // Increased buffer size slightly just in case of weird long lines from bgpq4/popen
-                    char prefix_buffer[INET6_ADDRSTRLEN + 20];
-                    int added_count = 0;
-                    int pclose_ret; // Store return value of pclose
-
-                    // Ensure ASN format is suitable for bgpq4 (remove AS prefix if present)
-                    const char *asn_num_str = asn;
-                    if ((strncmp(asn, "AS", 2) == 0 || strncmp(asn, "as", 2) == 0) && strlen(asn) > 2) {
-                        asn_num_str = asn + 2;
-                    } else {
-                        // Validate if it's just a number
-                        char *endptr;
-                        strtol(asn, &endptr, 10);
-                        if (*endptr != '\0' || strlen(asn) == 0) { // Check if conversion consumed the string and it wasn't empty
-                            fprintf(stderr, "Warning: Invalid ASN format '%s', skipping fetch.\n", asn);
-                            return 0; // Skip this ASN
-                        }
-                        // It's just a number, use it directly
-                        asn_num_str = asn;
-                    }
-
-                    printf("Fetching prefixes for AS%s...\n", asn_num_str);
-
-                    // --- Fetch IPv4 prefixes ---
-                    // Use -A for aggregation and -F for plain format. Note escaped format string.
-                    snprintf(cmd, sizeof(cmd), "%s -4 -A -F '%%n/%%l\\n' AS%s", BGPQ_COMMAND, asn_num_str);
-
-                    fp = popen(cmd, "r");
-                    if (fp == NULL) {
-                        fprintf(stderr, "Error: Failed to run command: %s\n", cmd);
-                        perror("popen failed");
-                        return -1; // Indicate failure to run command
-                    }
-
-                    while (fgets(prefix_buffer, sizeof(prefix_buffer), fp) != NULL) {
-                        prefix_buffer[strcspn(prefix_buffer, "\n")] = 0; // Remove trailing newline
-                        char* trimmed_prefix = trim_whitespace(prefix_buffer);
-                        // Check if it's a valid prefix (contains '/' and isn't empty)
-                        if (trimmed_prefix && strlen(trimmed_prefix) > 0 && strchr(trimmed_prefix, '/')) {
-                            // Further validation could use inet_pton(AF_INET, ...) here if needed
-                            printf("  Adding IPv4 prefix from AS%s: %s\n", asn_num_str, trimmed_prefix);
-                            add_route(routes_v4, trimmed_prefix);
-                            added_count++;
-                        } else if (trimmed_prefix && strlen(trimmed_prefix) > 0) {
-                            // Log unexpected non-prefix output if needed
-                            // fprintf(stderr, "  Skipping non-prefix output (v4) for AS%s: %s\n", asn_num_str, trimmed_prefix);
-                        }
-                    }
-                    pclose_ret = pclose(fp);
-                    if (pclose_ret == -1) {
-                        perror("pclose failed after IPv4 prefix fetch");
-                    } else if (WIFEXITED(pclose_ret)) {
-                        int exit_status = WEXITSTATUS(pclose_ret);
-                        if (exit_status != 0) {
-                            fprintf(stderr, "Warning: Command '%s' exited with status %d\n", cmd, exit_status);
-                        }
-                    } else if (WIFSIGNALED(pclose_ret)) {
-                        fprintf(stderr, "Warning: Command '%s' terminated by signal %d\n", cmd, WTERMSIG(pclose_ret));
-                    } else {
-                        fprintf(stderr, "Warning: Command '%s' terminated abnormally (raw return: %d)\n", cmd, pclose_ret);
-                    }
-
-                    // --- Fetch IPv6 prefixes ---
-                    snprintf(cmd, sizeof(cmd), "%s -6 -A -F '%%n/%%l\\n' AS%s", BGPQ_COMMAND, asn_num_str);
-
-                    fp = popen(cmd, "r");
-                    if (fp == NULL) {
-                        fprintf(stderr, "Error: Failed to run command: %s\n", cmd);
-                        perror("popen failed");
-                        // Decide if this is fatal. Returning -1 indicates *some* part failed.
-                        return -1;
-                    }
-
-                    while (fgets(prefix_buffer, sizeof(prefix_buffer), fp) != NULL) {
-                        prefix_buffer[strcspn(prefix_buffer, "\n")] = 0; // Remove trailing newline
-                        char* trimmed_prefix = trim_whitespace(prefix_buffer);
-                        // Check if it's a valid prefix (contains '/' and isn't empty)
-                        if (trimmed_prefix && strlen(trimmed_prefix) > 0 && strchr(trimmed_prefix, '/')) {
-                            // Further validation could use inet_pton(AF_INET6, ...) here if needed
-                            printf("  Adding IPv6 prefix from AS%s: %s\n", asn_num_str, trimmed_prefix);
-                            add_route(routes_v6, trimmed_prefix);
-                            added_count++;
-                        } else if (trimmed_prefix && strlen(trimmed_prefix) > 0) {
-                            // Log unexpected non-prefix output if needed
-                            // fprintf(stderr, "  Skipping non-prefix output (v6) for AS%s: %s\n", asn_num_str, trimmed_prefix);
-                        }
-                    }
-                    pclose_ret = pclose(fp);
-                    if (pclose_ret == -1) {
-                        perror("pclose failed after IPv6 prefix fetch");
-                    } else if (WIFEXITED(pclose_ret)) {
-                        int exit_status = WEXITSTATUS(pclose_ret);
-                        if (exit_status != 0) {
-                            fprintf(stderr, "Warning: Command '%s' exited with status %d\n", cmd, exit_status);
-                        }
-                    } else if (WIFSIGNALED(pclose_ret)) {
-                        fprintf(stderr, "Warning: Command '%s' terminated by signal %d\n", cmd, WTERMSIG(pclose_ret));
-                    } else {
-                        fprintf(stderr, "Warning: Command '%s' terminated abnormally (raw return: %d)\n", cmd, pclose_ret);
-                    }
-
-
-                    if (added_count == 0) {
-                        // This message might appear if the ASN is valid but has no public routes, or if bgpq4 failed (warning printed above)
-                        printf("  No valid prefixes found or added for AS%s via %s.\n", asn_num_str, BGPQ_COMMAND);
-                    }
-
-                    // Return number of prefixes added (or -1 if popen failed)
-                    return added_count;
-                }
-
-
-                // --- Main Function ---
-
-                int main() {
-                    RouteArray ipv4_routes, ipv6_routes;
-                    AsnArray asns_to_block;
-
-                    init_route_array(&ipv4_routes, 50);
-                    init_route_array(&ipv6_routes, 50);
-                    init_asn_array(&asns_to_block, 10);
-
-                    // Read configuration
-                    printf("Reading configuration from %s...\n", CONFIG_FILE);
-                    if (read_config(CONFIG_FILE, "ipv4_routes", &ipv4_routes,
-                        "ipv6_routes", &ipv6_routes,
-                        "asn_block", &asns_to_block) == -1) {
-                        fprintf(stderr, "Failed to read or parse configuration file. Exiting.\n");
-                    free_route_array(&ipv4_routes);
-                    free_route_array(&ipv6_routes);
-                    free_asn_array(&asns_to_block);
-                    return 1;
-                        }
-
-                        printf("Read %d direct IPv4 routes, %d direct IPv6 routes, and %d ASNs to block.\n",
-                               ipv4_routes.count, ipv6_routes.count, asns_to_block.count);
-
-
-                        // Fetch prefixes for specified ASNs
-                        printf("\nFetching prefixes for ASNs specified in config...\n");
-                        int total_fetched_prefixes = 0;
-                        int asn_fetch_failed = 0; // Flag if any fetch command failed to run
-                        for (int i = 0; i < asns_to_block.count; i++) {
-                            int fetched_count = fetch_and_add_prefixes(asns_to_block.asns[i], &ipv4_routes, &ipv6_routes);
-                            if (fetched_count > 0) {
-                                total_fetched_prefixes += fetched_count;
-                            } else if (fetched_count == -1) {
-                                // Error message already printed by fetch_and_add_prefixes (popen failure)
-                                fprintf(stderr, "Warning: Failed to execute prefix fetch for %s. Continuing...\n", asns_to_block.asns[i]);
-                                asn_fetch_failed = 1; // Mark that at least one fetch failed
-                            }
-                            // If fetched_count is 0, message already printed inside the function.
-                        }
-                        printf("Finished fetching ASN prefixes. Added %d prefixes from ASN lookups.\n", total_fetched_prefixes);
-                        printf("Total unique IPv4 routes to manage: %d\n", ipv4_routes.count);
-                        printf("Total unique IPv6 routes to manage: %d\n", ipv6_routes.count);
-
-                        if (asn_fetch_failed) {
-                            fprintf(stderr, "Warning: One or more ASN prefix lookups failed to execute. Route list may be incomplete.\n");
-                            // Optionally exit here if this is critical:
-                            // free_route_array(&ipv4_routes); free_route_array(&ipv6_routes); free_asn_array(&asns_to_block); return 1;
-                        }
-
-                        // --- Apply Routes ---
-
-                        // Delete existing blackhole routes (Best Effort)
-                        printf("\n--- Deleting Blackhole Routes (Best Effort) ---\n");
-                        if (ipv4_routes.count > 0) {
-                            printf("Attempting to delete %d IPv4 routes...\n", ipv4_routes.count);
-                            for (int i = 0; i < ipv4_routes.count; i++) {
-                                size_t cmd_len = strlen(ipv4_routes.routes[i]) + 30;
-                                char *cmd = (char*)malloc(cmd_len);
-                                if (!cmd) { perror("malloc failed for delete command (IPv4)"); continue; }
-                                snprintf(cmd, cmd_len, "ip -4 route del blackhole %s", ipv4_routes.routes[i]);
-                                execute_command(cmd); // Handles its own error reporting
-                                free(cmd);
-                            }
-                        } else {
-                            printf("No IPv4 routes specified to delete.\n");
-                        }
-
-                        if (ipv6_routes.count > 0) {
-                            printf("Attempting to delete %d IPv6 routes...\n", ipv6_routes.count);
-                            for (int i = 0; i < ipv6_routes.count; i++) {
-                                size_t cmd_len = strlen(ipv6_routes.routes[i]) + 30;
-                                char *cmd = (char*)malloc(cmd_len);
-                                if (!cmd) { perror("malloc failed for delete command (IPv6)"); continue; }
-                                snprintf(cmd, cmd_len, "ip -6 route del blackhole %s", ipv6_routes.routes[i]);
-                                execute_command(cmd); // Handles its own error reporting
-                                free(cmd);
-                            }
-                        } else {
-                            printf("No IPv6 routes specified to delete.\n");
-                        }
-                        printf("---------------------------------------------\n");
-
-
-                        // Add new Blackhole routes
-                        printf("\n--- Adding Blackhole Routes ---\n");
-                        if (ipv4_routes.count > 0) {
-                            printf("Adding %d IPv4 routes...\n", ipv4_routes.count);
-                            for (int i = 0; i < ipv4_routes.count; i++) {
-                                size_t cmd_len = strlen(ipv4_routes.routes[i]) + 30;
-                                char *cmd = (char*)malloc(cmd_len);
-                                if (!cmd) { perror("malloc failed for add command (IPv4)"); continue; }
-                                snprintf(cmd, cmd_len, "ip -4 route add blackhole %s", ipv4_routes.routes[i]);
-                                execute_command(cmd); // Handles its own error reporting
-                                free(cmd);
-                            }
-                        } else {
-                            printf("No IPv4 routes specified to add.\n");
-                        }
-
-                        if (ipv6_routes.count > 0) {
-                            printf("Adding %d IPv6 routes...\n", ipv6_routes.count);
-                            for (int i = 0; i < ipv6_routes.count; i++) {
-                                size_t cmd_len = strlen(ipv6_routes.routes[i]) + 30;
-                                char *cmd = (char*)malloc(cmd_len);
-                                if (!cmd) { perror("malloc failed for add command (IPv6)"); continue; }
-                                snprintf(cmd, cmd_len, "ip -6 route add blackhole %s", ipv6_routes.routes[i]);
-                                execute_command(cmd); // Handles its own error reporting
-                                free(cmd);
-                            }
-                        } else {
-                            printf("No IPv6 routes specified to add.\n");
-                        }
-                        printf("-------------------------------\n");
-
-
-                        // Print final routes (optional)
-                        printf("\n--- Final Routes After Addition Attempt ---\n");
-                        execute_command("ip -4 route show");
-                        execute_command("ip -6 route show");
-                        printf("-----------------------------------------\n");
-
-
-                        // Free memory
-                        printf("\nCleaning up resources...\n");
-                        free_route_array(&ipv4_routes);
-                        free_route_array(&ipv6_routes);
-                        free_asn_array(&asns_to_block);
-
-                        printf("Done.\n");
-                        return 0;
-                }
+    PrefixList raw_v4, raw_v6, v4_prefixes, v6_prefixes;
+    start = stats_now();
+    init_prefix_list(&raw_v4, config.routes_v4.count);
+    init_prefix_list(&raw_v6, config.routes_v6.count);
+    route_array_to_list(&config.routes_v4, &raw_v4);
+    route_array_to_list(&config.routes_v6, &raw_v6);
+    if (config.feeds.count > 0 && load_feeds(&config, &raw_v4, &raw_v6, feed_lists) > 0) {
+        log_warn("One or more feeds could not be read. Route list may be incomplete.\n");
+    }
+    int geo_failed = config.geo_countries.count > 0 && load_countries(&config, &raw_v4, &raw_v6, geo_lists) > 0;
+    if (geo_failed) {
+        log_warn("One or more delegated stats files could not be read. Route list may be incomplete.\n");
+    }
+    stats_phase("collect", start, raw_v4.count + raw_v6.count);
+    log_info("Total unique IPv4 routes to manage: %zu\n", raw_v4.count);
+    log_info("Total unique IPv6 routes to manage: %zu\n", raw_v6.count);
+    start = stats_now();
+    init_prefix_list(&v4_prefixes, raw_v4.count);
+    init_prefix_list(&v6_prefixes, raw_v6.count);
+    PrefixList allow_v4, allow_v6;
+    init_prefix_list(&allow_v4, config.allow_v4.count);
+    init_prefix_list(&allow_v6, config.allow_v6.count);
+    route_array_to_list(&config.allow_v4, &allow_v4);
+    route_array_to_list(&config.allow_v6, &allow_v6);
+    size_t carved = build_desired(&raw_v4, &config.settings, &allow_v4, &v4_prefixes, "IPv4");
+    carved += build_desired(&raw_v6, &config.settings, &allow_v6, &v6_prefixes, "IPv6");
+    stats_phase("aggregate", start, raw_v4.count + raw_v6.count);
+    stats_set(STAT_PREFIXES_DESIRED, v4_prefixes.count + v6_prefixes.count);
+    stats_set(STAT_PREFIXES_ALLOWED, allow_v4.count + allow_v6.count);
+    stats_set(STAT_BLOCKS_CARVED, carved);
+    free_prefix_list(&raw_v4);
+    free_prefix_list(&raw_v6);
+
+    if (want_index) {
+        write_index(&config, config_lists, asn_sets, feed_lists, geo_lists, &allow_v4, &allow_v6);
+        free_prefix_list(&config_lists[0]);
+        free_prefix_list(&config_lists[1]);
+        free_asn_prefixes(asn_sets, config.asns.count);
+        for (int i = 0; i < 2 * config.feeds.count; i++) free_prefix_list(&feed_lists[i]);
+        for (int i = 0; i < 2 * config.geo_countries.count; i++) free_prefix_list(&geo_lists[i]);
+        free(asn_sets);
+        free(feed_lists);
+        free(geo_lists);
+    }
+    free_prefix_list(&allow_v4);
+    free_prefix_list(&allow_v6);
+
+    Backend backend;
+    if (backend_open(&backend, &config.settings) == -1) {
+        log_error("Failed to set up the '%s' backend. Exiting.\n", config.settings.backend);
+        stats_write(config.settings.stats_textfile, timings_file ? timings_file : config.settings.stats_json, 0);
+        free_prefix_list(&v4_prefixes);
+        free_prefix_list(&v6_prefixes);
+        free_config(&config);
+        return 1;
+    }
+
+    // Extra network namespaces get their own route backend each
+    NetnsSet netns;
+    init_netns_set(&netns);
+    int netns_failed = netns_sync(&netns, &config.namespaces, &config.settings);
+
+    const PrefixList *desired[2] = { &v4_prefixes, &v6_prefixes };
+    if (check_mode) {
+        int ret = run_check(&backend, desired, NULL);
+        for (int i = 0; i < netns.count; i++) {
+            char where[4200];
+            snprintf(where, sizeof(where), "netns %s", netns.targets[i].name);
+            ret = worse_check(ret, run_check(&netns.targets[i].backend, desired, where));
+        }
+        if (netns_failed) ret = 1;
+        if (asn_fetch_failed || stats_get(STAT_FEEDS_FAILED) > 0 || geo_failed) {
+            log_warn("Some ASNs, feeds or countries could not be read, the expected set may be incomplete.\n");
+        }
+        free_netns_set(&netns);
+        backend_close(&backend);
+        free_prefix_list(&v4_prefixes);
+        free_prefix_list(&v6_prefixes);
+        free_config(&config);
+        return ret;
+    }
+
+    // Only the difference between the live state and the desired set is applied
+    log_info("\n--- Applying Block Set (%s backend) ---\n", backend.name);
+    start = stats_now();
+    int reconcile_failed = backend.apply(&backend, desired, NULL) == -1;
+    stats_phase("apply", start, v4_prefixes.count + v6_prefixes.count);
+    log_info("------------------------------------\n");
+    netns_failed += netns_apply(&netns, desired, NULL, config.settings.netns_jobs);
+    if (netns_failed) reconcile_failed = 1;
+
+    free_netns_set(&netns);
+    backend_close(&backend);
+
+    // Free memory
+    log_info("\nCleaning up resources...\n");
+    free_prefix_list(&v4_prefixes);
+    free_prefix_list(&v6_prefixes);
+    // Partial: an ASN, a feed, a delegated stats file or some kernel operations failed
+    int complete = !reconcile_failed && !asn_fetch_failed && stats_get(STAT_FEEDS_FAILED) == 0 && !geo_failed &&
+                   stats_get(STAT_KERNEL_OPS_FAILED) == 0;
+    stats_write(config.settings.stats_textfile, timings_file ? timings_file : config.settings.stats_json, complete);
+    free_config(&config);
+
+    log_info("Done.\n");
+    return reconcile_failed ? 1 : 0;
+}
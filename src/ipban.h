@@ -0,0 +1,678 @@
+#ifndef IPBAN_H
+#define IPBAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct pollfd;
+
+// --- Binary prefix representation ---
+typedef struct {
+    unsigned char addr[16]; // Network byte order; IPv4 uses the first 4 bytes
+    unsigned char len;      // Prefix length in bits
+    unsigned char family;   // AF_INET or AF_INET6
+} Prefix;
+
+// Parse "addr/len" text into a Prefix, masking host bits. Returns 0 on success, -1 on error.
+int parse_prefix(const char *text, int family, Prefix *out);
+// Parse one line of a prefix file (feeds, routes_file): an address or prefix,
+// IPv4 or IPv6, after optional blanks and ending at a blank, ',' or a '#'/';'
+// comment; the rest of the line is ignored and a bare address is a host prefix.
+// Returns 1 with out set, 0 for a blank or comment line, -1 if invalid. entry
+// and entry_len are set to the entry's text for messages.
+int parse_prefix_line(const char *line, const char *line_end, Prefix *out, const char **entry, size_t *entry_len);
+#define MAX_INVALID_REPORTED 10 // Invalid lines reported per file, the rest are only counted
+// Format a Prefix as "addr/len" into buf. Returns buf.
+const char *format_prefix(const Prefix *prefix, char *buf, size_t buf_len);
+
+// Order by family, address, then length (qsort compatible)
+int prefix_cmp(const void *a, const void *b);
+
+// Large enough for any formatted IPv6 prefix
+#define PREFIX_STRLEN 64
+
+// --- Dynamic array of binary prefixes (prefix.c) ---
+typedef struct {
+    Prefix *items;
+    size_t count;
+    size_t capacity;
+} PrefixList;
+
+void init_prefix_list(PrefixList *list, size_t initial_capacity);
+void prefix_list_push(PrefixList *list, const Prefix *prefix);
+void prefix_list_sort_unique(PrefixList *list);
+void free_prefix_list(PrefixList *list);
+// Both inputs sorted and unique; appends want\have to to_add and have\want to to_remove
+void diff_prefix_lists(const PrefixList *want, const PrefixList *have,
+                       PrefixList *to_add, PrefixList *to_remove);
+// Index of prefix in a sorted, unique list, or -1
+long prefix_list_find(const PrefixList *list, const Prefix *prefix);
+// Remove, then add the prefixes of two sorted, unique lists, keeping list sorted and unique
+void prefix_list_update(PrefixList *list, const PrefixList *add, const PrefixList *remove);
+
+// Change from one set of prefix lists to the next (index 0 = IPv4, 1 = IPv6)
+typedef struct {
+    PrefixList add[2];
+    PrefixList remove[2];
+} PrefixDelta;
+
+// --- Route store (prefix.c) ---
+// Prefixes of one family kept in a contiguous arena, deduplicated through an
+// open-addressing hash table of arena indices (about 20-25 bytes per prefix).
+typedef struct {
+    Prefix *routes;     // Arena, in insertion order
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;    // Arena index + 1, 0 = empty
+    size_t slot_mask;
+    int family;
+} RouteArray;
+
+// Hash of a prefix's address and length, for hash tables keyed by prefix
+uint32_t prefix_hash(const Prefix *prefix);
+
+void init_route_array(RouteArray *array, int family, size_t initial_capacity);
+// Returns 1 if added, 0 if already present
+int add_prefix(RouteArray *array, const Prefix *prefix);
+// Parse and add "addr/len". Returns 1 if added, 0 if already present, -1 if invalid.
+int add_route(RouteArray *array, const char *route);
+int route_array_contains(const RouteArray *array, const Prefix *prefix);
+// Append all routes to out and sort it
+void route_array_to_list(const RouteArray *array, PrefixList *out);
+void free_route_array(RouteArray *array);
+
+// Drop prefixes covered by a shorter one and merge sibling pairs into their
+// parent. list must be sorted and unique (route_array_to_list) and of one family.
+void aggregate_prefix_list(PrefixList *list);
+// Whether a shorter prefix of the sorted, unique list covers prefix
+int prefix_list_covered(const PrefixList *list, const Prefix *prefix);
+// Whether prefix covers a longer prefix of the sorted, unique list
+int prefix_list_covers(const PrefixList *list, const Prefix *prefix);
+
+// --- Prefix subtraction (prefix.c) ---
+// Binary trie of allowed prefixes of one family, one node per bit
+typedef struct {
+    uint32_t child[2];  // Node index, 0 = none (the root is never a child)
+    unsigned char terminal; // Allowed as a whole
+} PrefixTrieNode;
+
+typedef struct {
+    PrefixTrieNode *nodes; // Root first
+    size_t count;
+    size_t capacity;
+} PrefixTrie;
+
+void init_prefix_trie(PrefixTrie *trie, const PrefixList *prefixes);
+void free_prefix_trie(PrefixTrie *trie);
+// Whether any address of prefix is in the trie
+int prefix_trie_overlaps(const PrefixTrie *trie, const Prefix *prefix);
+// Whether all addresses of prefix are in the trie
+int prefix_trie_covers(const PrefixTrie *trie, const Prefix *prefix);
+// Remove the addresses in the trie from list (of the same family), splitting
+// blocks into the fewest remaining CIDRs. Returns the number of blocks dropped or split.
+size_t subtract_prefix_list(PrefixList *list, const PrefixTrie *allow);
+
+// --- Dynamic array for storing AS numbers (ipban.c) ---
+typedef struct {
+    char **asns;
+    int count;
+    int capacity;
+} AsnArray;
+
+void init_asn_array(AsnArray *array, int initial_capacity);
+void add_asn(AsnArray *array, const char *asn);
+void free_asn_array(AsnArray *array);
+
+// --- Dynamic array of strings: paths, names, patterns (ipban.c) ---
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} StringArray;
+
+void init_string_array(StringArray *array, int initial_capacity);
+// Append a copy of str unless it is already in the array
+void add_string(StringArray *array, const char *str);
+void free_string_array(StringArray *array);
+
+// Trim leading/trailing whitespace from a string in-place
+char *trim_whitespace(char *str);
+
+// --- Reference-counted prefix set (prefix.c) ---
+// Sorted, unique prefixes with the number of sources listing each of them
+typedef struct {
+    PrefixList list;
+    uint32_t *refs;     // Parallel to list.items
+} PrefixMultiset;
+
+void init_prefix_multiset(PrefixMultiset *set);
+// Add (delta = 1) or drop (delta = -1) one reference for each prefix of the
+// sorted, unique list `changes`; prefixes without references are removed
+void prefix_multiset_update(PrefixMultiset *set, const PrefixList *changes, int delta);
+void free_prefix_multiset(PrefixMultiset *set);
+
+// --- Runtime settings ([settings] section) ---
+typedef struct {
+    int aggregate;      // Aggregate prefixes before programming (default on)
+    int fetch_jobs;     // Parallel bgpq4 fetches
+    char cache_dir[256]; // Per-ASN prefix cache, empty to disable
+    long cache_ttl;     // Seconds before a cached ASN is refetched
+    long refresh_interval; // Daemon: seconds between background ASN refreshes
+    char backend[16];   // Enforcement backend: route, nftables, ipset or xdp
+    char set_name[64];  // nftables table / ipset name prefix
+    char stats_textfile[256]; // node_exporter textfile to write stats to, empty to disable
+    char stats_json[256];     // JSON stats file, empty to disable
+    uint32_t swap_tables[2];  // route backend: staging/active table pair, 0 = program the main table
+    uint32_t rule_priority;   // Priority of the policy rule that selects the active table
+    uint32_t route_table;     // route backend: table routes go to without swap_tables (main by default)
+    int route_protocol;       // route backend: rtm_protocol that marks our routes
+    char index_file[256];     // Lookup index written after each apply, empty to disable
+    char irr_server[256];     // "host[:port]" queried directly instead of running bgpq4, empty = bgpq4
+    char irr_sources[128];    // IRR databases to query ("RIPE,RADB"), empty = server default
+    int netns_jobs;           // Namespaces programmed in parallel
+    char xdp_interfaces[256]; // xdp backend: comma-separated interfaces to attach to
+    char xdp_mode[16];        // xdp backend: auto, native or generic
+    char control_socket[108]; // Daemon: Unix socket for runtime bans, empty to disable
+    long ban_ttl;             // Seconds a runtime ban lasts unless the command says otherwise
+    int log_threshold;        // [logwatch]: matching lines within log_window that ban an address
+    long log_window;          // [logwatch]: sliding window length in seconds
+    int log_level;            // LOG_LEVEL_*: messages above it are dropped
+    int log_json;             // Log JSON lines instead of plain text
+} Settings;
+
+// --- Configuration (config.c) ---
+typedef struct {
+    RouteArray routes_v4;   // Direct routes from [ipv4_routes]
+    RouteArray routes_v6;   // Direct routes from [ipv6_routes]
+    AsnArray asns;          // [asn_block]
+    StringArray feeds;      // [feeds] file paths (resolved against the config directory)
+    RouteArray allow_v4;    // [allow]: never blocked, subtracted from the block set
+    RouteArray allow_v6;
+    StringArray namespaces; // [namespaces] names ("*" = all in /run/netns)
+    StringArray log_files;  // [logwatch] files (resolved against the config directory)
+    StringArray log_patterns; // [logwatch] patterns, plain substrings
+    StringArray geo_countries; // [geo_block] country codes, upper case
+    StringArray geo_files;  // [geo_block] delegated-stats files (resolved against the config directory)
+    Settings settings;      // [settings]
+} Config;
+
+// Initialize config and read filename into it. Returns 0, or -1 on error (config is freed).
+int load_config(const char *filename, Config *config);
+void free_config(Config *config);
+
+// Whole file mapped read-only (data is NULL for an empty file)
+typedef struct {
+    const char *data;
+    size_t size;
+} MappedFile;
+
+// Returns 0, or -1 with errno set
+int map_file(const char *path, MappedFile *file);
+void unmap_file(MappedFile *file);
+
+// Add the prefixes of a plain-text file (one per line, '#' comments) to routes
+// (IPv6 ones to routes_v6 if not NULL).
+// Returns the number of new prefixes, or -1 if the file cannot be read.
+int load_prefix_file(const char *path, RouteArray *routes, RouteArray *routes_v6);
+
+// --- On-disk prefix cache (cache.c) ---
+typedef struct {
+    int64_t fetched_at; // Unix time the cached data was fetched
+    uint64_t hash;      // Content hash of the cached prefixes
+    size_t count;
+} CacheInfo;
+
+#define FNV1A64_INIT 0xCBF29CE484222325ULL
+uint64_t fnv1a64(uint64_t h, const void *data, size_t len);
+// Append cached prefixes for key/family to out. Returns 0, or -1 if missing or invalid.
+int cache_load(const char *dir, const char *key, int family, PrefixList *out, CacheInfo *info);
+// Atomically replace the cache entry for key/family. Returns 0 or -1.
+int cache_store(const char *dir, const char *key, int family, const Prefix *prefixes, size_t count,
+                int64_t fetched_at);
+
+// --- Local prefix feeds (feeds.c) ---
+// Change detection state of one feed file
+typedef struct {
+    char *path;
+    int64_t size;           // Size and mtime seen last
+    int64_t mtime_ns;
+    uint64_t content_hash;  // FNV-1a of the file contents
+    int known;              // The fields above are valid
+} FeedState;
+
+void init_feed_state(FeedState *feed, const char *path);
+void free_feed_state(FeedState *feed);
+// Read a feed if it changed since the last call. Returns 1 if v4/v6 received the
+// new contents (sorted, unique), 0 if the file is unchanged, -1 on error.
+int load_feed(FeedState *feed, const Settings *settings, PrefixList *v4, PrefixList *v6);
+
+// --- Country blocking from RIR delegated-stats files (geo.c) ---
+// Normalize a two-letter country code ("cn" -> "CN"). Returns 0, or -1 if invalid.
+int parse_country(const char *text, char out[3]);
+// Resolve countries from the delegated-stats files. out[2 * i] and out[2 * i + 1]
+// (initialized here) receive the sorted, unique IPv4 and IPv6 prefixes of
+// countries->items[i]. Returns the number of files that could not be read.
+int load_geo(const StringArray *files, const StringArray *countries, const Settings *settings, PrefixList *out);
+
+// --- ASN prefix fetching (fetch.c) ---
+typedef struct {
+    int failed_asns;    // ASNs for which at least one fetch failed
+    int cached_asns;    // ASNs served entirely from a fresh cache entry
+    int stale_asns;     // Failed ASNs for which older cached data was used instead
+} FetchSummary;
+
+// Prefixes of one ASN
+typedef struct {
+    PrefixList v4;      // Sorted, unique
+    PrefixList v6;
+    int failed;         // At least one fetch failed (data may be stale or missing)
+    int cached;         // Both families came from fresh cache entries
+    double seconds;     // Time spent fetching
+} AsnPrefixes;
+
+// Numeric part of "AS1234"/"1234", or NULL if not a valid ASN
+const char *asn_number(const char *asn);
+// Fetch IPv4 and IPv6 prefixes of all ASNs (fresh cache entries are used as is,
+// up to settings->fetch_jobs fetches in flight) and merge them into the route
+// arrays. keep (asns->count entries or NULL) receives the per-ASN prefixes too.
+// Returns the number of prefixes fetched.
+int fetch_asn_prefixes(const AsnArray *asns, const Settings *settings, RouteArray *routes_v4,
+                       RouteArray *routes_v6, FetchSummary *summary, AsnPrefixes *keep);
+// Same, but keep the prefixes per ASN: out[i] (asns->count entries) receives the
+// prefixes of asns->asns[i]. Release with free_asn_prefixes().
+int fetch_asn_sets(const AsnArray *asns, const Settings *settings, AsnPrefixes *out, FetchSummary *summary);
+void free_asn_prefixes(AsnPrefixes *sets, int count);
+
+// --- rtnetlink route programming (netlink.c) ---
+typedef struct {
+    int fd;
+    uint32_t seq;        // Next sequence number to use
+    uint32_t port_id;    // Our netlink port id
+    size_t batch_msgs;   // Max messages per sendmsg(), sized to the receive buffer
+    uint32_t table;      // Routing table routes are added to and dumped from (main by default)
+    unsigned char protocol; // rtm_protocol our routes are added, deleted and dumped with
+    int acks_lost;       // Set when ACKs were dropped: the table has to be dumped to know its state
+    char *send_buf;
+    char *recv_buf;
+} NlSocket;
+
+typedef struct {
+    size_t ok;      // Operations acknowledged by the kernel (not counted for batches that lost ACKs)
+    size_t failed;  // Operations rejected with an unexpected error
+    size_t absent;  // Deletes of routes that did not exist (ESRCH)
+    size_t exists;  // Adds of routes that already existed (EEXIST)
+    int acks_lost;  // Receive buffer overflowed, per-route errors may be missing
+} NlResult;
+
+int nl_open(NlSocket *nl);
+void nl_close(NlSocket *nl);
+// Add (RTM_NEWROUTE) or delete (RTM_DELROUTE) blackhole routes for all prefixes,
+// packing many requests per sendmsg(). Returns 0, or -1 if the socket failed.
+int nl_route_batch(NlSocket *nl, int cmd, const Prefix *prefixes, size_t count, NlResult *result);
+// Append every blackhole route of nl->table with nl->protocol for family to out. Returns 0 or -1.
+int nl_dump_blackholes(NlSocket *nl, int family, PrefixList *out);
+// Called for each blackhole route of a dump with the protocol that installed it (RTPROT_*)
+typedef void (*NlRouteFn)(const Prefix *prefix, int protocol, void *ctx);
+// Dump the blackhole routes of nl->table without storing them. Returns 0 or -1.
+int nl_walk_blackholes(NlSocket *nl, int family, NlRouteFn fn, void *ctx);
+// Add (RTM_NEWRULE) or delete (RTM_DELRULE) the policy rule "priority lookup table". Returns 0 or -1.
+int nl_rule(NlSocket *nl, int cmd, int family, uint32_t priority, uint32_t table);
+// Tables looked up by the rules of family at priority (up to max). Returns the count, or -1.
+int nl_rule_tables(NlSocket *nl, int family, uint32_t priority, uint32_t *tables, int max);
+
+// Attach (prog_fd >= 0) or detach (-1) the XDP program of an interface (XDP_FLAGS_*). Returns 0 or -1.
+int nl_xdp_attach(NlSocket *nl, int ifindex, int prog_fd, uint32_t flags);
+
+// --- XDP drop program (xdp.c) ---
+typedef struct {
+    int map_fd[2];      // LPM tries of blocked source prefixes per family, value = packets dropped
+    int drops_fd;       // Per-CPU array: total packets dropped
+    int prog_fd;
+    int cpus;           // Possible CPUs (values per per-CPU map entry)
+    int no_batch;       // Kernel lacks batch operations on the tries
+} XdpState;
+
+// Open the maps pinned in pin_dir (created and pinned if missing) and load the
+// program that uses them. Returns 0 or -1.
+int xdp_open(XdpState *xdp, const char *pin_dir);
+void xdp_close(XdpState *xdp);
+// Append the prefixes in the trie of family to out. Returns 0 or -1.
+int xdp_dump(XdpState *xdp, int family, PrefixList *out);
+// Insert (add set) or delete prefixes of one family, counting the results as
+// for netlink. Deletes go in batches, and so do inserts when absent is set (the
+// prefixes are known to be missing from the trie); other inserts go one by one
+// so the counters of prefixes already there are kept. Returns 0, or -1 if any
+// operation failed.
+int xdp_update(XdpState *xdp, int add, int absent, const Prefix *prefixes, size_t count, NlResult *result);
+// Packets dropped so far, summed over all CPUs
+uint64_t xdp_dropped(const XdpState *xdp);
+
+// --- Route application (ipban.c) ---
+// Whether build_desired aggregates with these settings
+int aggregate_enabled(const Settings *settings);
+// Copy sorted, unique raw prefixes into out, aggregated if enabled in settings,
+// minus the allowed prefixes (sorted, same family, may be empty). Returns the
+// number of blocks dropped or split for allowed prefixes.
+size_t build_desired(const PrefixList *raw, const Settings *settings, const PrefixList *allow,
+                     PrefixList *out, const char *label);
+// Add or delete prefixes in nl->table and print a summary. Returns 0, or -1 if any operation failed.
+int apply_prefixes(NlSocket *nl, int cmd, const PrefixList *prefixes, const char *label);
+// Dump-and-apply passes made when netlink ACKs are lost
+#define RESYNC_ATTEMPTS 3
+// Dump installed blackholes of family and apply the difference to desired. Returns 0, or -1
+// if the dump or any kernel operation failed.
+int reconcile_routes(NlSocket *nl, int family, const PrefixList *desired, const char *label);
+
+// Result of comparing the enforced state with the desired set
+typedef struct {
+    size_t expected;    // Desired prefixes
+    size_t present;     // Desired prefixes that are enforced
+    size_t missing;     // Desired prefixes that are not enforced
+    size_t extra;       // Prefixes we installed that are no longer desired
+    size_t foreign;     // Undesired blackholes installed by something else
+} CheckResult;
+
+// Compare the installed blackholes of family with desired (sorted, unique),
+// adding the counts to result. Returns 0 or -1.
+int check_routes(NlSocket *nl, int family, const PrefixList *desired, CheckResult *result);
+
+// --- Enforcement backends (backend.c) ---
+typedef struct Backend {
+    const char *name;
+    // Make the enforced set equal to desired (index 0 = IPv4, 1 = IPv6). delta is
+    // the change from what was last applied by this process, or NULL to sync from scratch.
+    int (*apply)(struct Backend *backend, const PrefixList *desired[2], const PrefixDelta *delta);
+    void (*close)(struct Backend *backend);
+    // Compare the enforced set with desired without changing it (NULL if unsupported)
+    int (*check)(struct Backend *backend, const PrefixList *desired[2], CheckResult result[2]);
+    // Remove everything this backend enforces, whatever the configuration (NULL if unsupported)
+    int (*flush)(struct Backend *backend);
+    NlSocket nl;            // route backend
+    uint32_t swap_tables[2];  // route backend with table swapping (0 = off)
+    uint32_t rule_priority;
+    uint32_t route_table;   // route backend without table swapping
+    int rule_added;         // Rule for a route_table other than main is in place
+    uint32_t active_table[2]; // Table the rule points to per family, 0 = unknown
+    char set_name[64];      // nftables/ipset backends
+    size_t set_maxelem[2];  // ipset backend: maxelem of the live sets, 0 = not known
+    XdpState xdp;           // xdp backend
+    char interfaces[256];   // xdp backend: comma-separated interfaces the program is attached to
+    uint32_t xdp_flags;
+    char label[2][96];      // Per family in messages: "IPv4", or with the namespace
+} Backend;
+
+// Set up the backend selected in settings. Returns 0, or -1 on error.
+int backend_open(Backend *backend, const Settings *settings);
+void backend_close(Backend *backend);
+
+// --- Network namespaces (netns.c) ---
+// One route backend per extra namespace, its netlink socket opened inside it
+typedef struct {
+    char *name;         // As resolved: /run/netns/<name> or a path such as /proc/<pid>/ns/net
+    Backend backend;
+    int synced;         // Last apply succeeded, the next delta is enough
+    int failed;         // Last apply failed
+    double seconds;     // Duration of the last apply
+} NetnsTarget;
+
+typedef struct {
+    NetnsTarget *targets;
+    int count;
+    int capacity;
+} NetnsSet;
+
+void init_netns_set(NetnsSet *set);
+// Make the targets match the configured names ("*" = every namespace in
+// /run/netns): close removed ones and open new ones. Returns the number of
+// names that could not be opened.
+int netns_sync(NetnsSet *set, const StringArray *names, const Settings *settings);
+// Apply desired in all namespaces, up to jobs at once, then print and record a
+// summary per namespace. delta as for Backend.apply; targets whose last apply
+// failed always sync from scratch. Returns the number of namespaces that failed.
+int netns_apply(NetnsSet *set, const PrefixList *desired[2], const PrefixDelta *delta, int jobs);
+void free_netns_set(NetnsSet *set);
+
+// --- Dynamic bans with expiry (bans.c) ---
+#define BAN_WHEEL_LEVELS 4
+#define BAN_WHEEL_SLOTS 256
+#define BAN_MAX_TTL (1U << 30) // Seconds
+
+typedef struct BanEntry BanEntry;
+
+typedef struct {
+    BanEntry *entries;      // Pool, linked by index + 1 (0 = none)
+    uint32_t capacity;
+    uint32_t used;          // Pool entries handed out so far
+    uint32_t free_list;
+    size_t stored;          // Entries in the hash table (banned, or ended since the last collect)
+    uint32_t *buckets;      // Hash chains
+    uint32_t bucket_mask;
+    uint32_t wheel[BAN_WHEEL_LEVELS][BAN_WHEEL_SLOTS];
+    uint32_t now;           // Current tick (seconds since the store was created)
+    uint32_t *touched;      // Entries changed since the last ban_collect()
+    size_t touched_count;
+    size_t touched_capacity;
+    size_t active[2];       // Banned prefixes per family
+} BanStore;
+
+void init_ban_store(BanStore *store);
+// Ban prefix for ttl seconds; banning it again keeps the later expiry. Returns 1 if newly banned.
+int ban_add(BanStore *store, const Prefix *prefix, uint32_t ttl);
+// Returns 1 if the prefix was banned
+int ban_remove(BanStore *store, const Prefix *prefix);
+// Advance the clock to tick now, expiring due bans. Returns the number expired.
+size_t ban_advance(BanStore *store, uint32_t now);
+// Append the net changes since the last call to add/remove (per family, sorted
+// and unique). Returns the number of changes.
+size_t ban_collect(BanStore *store, PrefixList add[2], PrefixList remove[2]);
+void free_ban_store(BanStore *store);
+
+// --- Daemon control socket (control.c) ---
+#define CONTROL_MAX_CLIENTS 64
+
+typedef struct {
+    int fd;
+    char line[256];         // Partial command line
+    size_t len;
+    int flush_wait;         // Answer "ok" after the next apply
+    char *rest;             // Input after that "flush", handled once it is answered
+    size_t rest_len;
+} ControlClient;
+
+typedef struct {
+    int listen_fd;          // -1 if disabled
+    char path[108];
+    ControlClient clients[CONTROL_MAX_CLIENTS];
+    int client_count;
+    int pending;            // Bans changed since the last apply
+    int flush_requested;    // A client waits for the next apply
+} ControlServer;
+
+// Listen on a Unix socket at path (replacing a stale one). Returns 0 or -1.
+int control_open(ControlServer *server, const char *path);
+void control_close(ControlServer *server);
+// Fill fds with the listening socket and the clients. Returns the count (0 if disabled).
+int control_pollfds(const ControlServer *server, struct pollfd *fds);
+// Accept clients and run the commands they sent against bans (ttl = default ban duration)
+void control_handle(ControlServer *server, const struct pollfd *fds, BanStore *bans, long ttl);
+// Answer the clients waiting for "flush" and handle what they sent after it
+void control_flushed(ControlServer *server, BanStore *bans, long ttl);
+
+// --- Log watching (logwatch.c) ---
+typedef struct HitCounter HitCounter;
+
+// Hit counts per address over a sliding window
+typedef struct {
+    HitCounter *slots;      // Open addressing, keyed by address
+    size_t mask;
+    size_t count;
+    uint32_t pruned;        // Window number of the last cleanup
+} HitTable;
+
+typedef struct {
+    char *path;
+    const char *name;       // Last path component, as inotify reports it
+    int wd;                 // Watch on the directory, -1 if none
+    int fd;                 // -1 while the file does not exist
+    uint64_t dev;           // Identity of the open file, to notice rotation
+    uint64_t ino;
+    int64_t offset;         // Bytes read, to notice truncation
+    char *buf;              // Read buffer, starts with the partial last line
+    size_t len;
+    int dirty;              // Written to since it was last read
+} LogFile;
+
+typedef struct {
+    LogFile *files;
+    int count;
+    int capacity;
+    StringArray patterns;   // A line matches if it contains any of them (any line if none)
+    size_t *pattern_lens;
+    const char **next_hit;  // Scanner state per pattern
+    HitTable hits;
+    int threshold;
+    long window;
+    int inotify_fd;         // Directory watches, -1 if none
+} LogWatch;
+
+void init_log_watch(LogWatch *watch);
+// Follow files (new ones from their end) and switch to the patterns and limits of the config
+void log_watch_sync(LogWatch *watch, const StringArray *files, const StringArray *patterns, const Settings *settings);
+// Read the files inotify reported as written to. Returns the number of new bans.
+size_t log_watch_events(LogWatch *watch, BanStore *bans, uint32_t now, long ttl);
+// Once a second: check all files for writes, rotation and truncation. Returns the number of new bans.
+size_t log_watch_tick(LogWatch *watch, BanStore *bans, uint32_t now, long ttl);
+void free_log_watch(LogWatch *watch);
+// Scan files (or stdin) with the [logwatch] patterns of config and print the addresses reaching
+// log_threshold. Returns exit code.
+int run_scan_logs(const Config *config, char **paths, int count);
+
+// --- Logging (log.c) ---
+enum { LOG_LEVEL_ERROR, LOG_LEVEL_WARN, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG };
+
+// Start the background writer; until then messages are written directly
+void log_start(void);
+// Apply log_level/log_format of settings (a level pinned on the command line stays)
+void log_configure(const Settings *settings);
+void log_pin_level(int level);
+// Send all messages to stderr, for modes that print results on stdout
+void log_to_stderr(void);
+// "error", "warn", "info" or "debug" to LOG_LEVEL_*, -1 if unknown
+int parse_log_level(const char *name);
+// Whether messages of level are kept; check it before preparing costly arguments
+int log_enabled(int level);
+void log_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_warn(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_info(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_debug(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+// Like perror(), as an error message
+void log_errno(const char *what);
+// Wait until everything logged so far is written
+void log_flush(void);
+
+// --- Run statistics (stats.c) ---
+enum {
+    // Counters (totals since start)
+    STAT_KERNEL_OPS,
+    STAT_KERNEL_OPS_FAILED,
+    STAT_ROUTES_ADDED,
+    STAT_ROUTES_REMOVED,
+    STAT_FETCHES,
+    STAT_FETCHES_FAILED,
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    STAT_CACHE_STALE,
+    STAT_FEEDS_PARSED,
+    STAT_FEEDS_UNCHANGED,
+    STAT_FEEDS_FAILED,
+    STAT_GEO_PARSED,
+    STAT_GEO_UNCHANGED,
+    STAT_GEO_FAILED,
+    STAT_BANS_ADDED,
+    STAT_BANS_EXPIRED,
+    STAT_LOG_BYTES,
+    STAT_LOG_MATCHES,
+    STAT_LOG_BANS,
+    // Gauges (current values)
+    STAT_PREFIXES_CONFIG,
+    STAT_PREFIXES_ASN,
+    STAT_PREFIXES_FEED,
+    STAT_PREFIXES_GEO,
+    STAT_PREFIXES_DESIRED,
+    STAT_PREFIXES_ALLOWED,
+    STAT_BLOCKS_CARVED,
+    STAT_XDP_DROPPED,
+    STAT_BANS_ACTIVE,
+    STAT_COUNT
+};
+
+void stats_add(int stat, uint64_t n);   // Thread safe
+void stats_set(int stat, uint64_t value);
+uint64_t stats_get(int stat);
+// Monotonic time in seconds; pass it to stats_phase() when the phase is done
+double stats_now(void);
+void stats_phase(const char *name, double start, uint64_t items);
+// Record (or replace) the contribution of an ASN or feed ("asn"/"feed")
+void stats_source(const char *type, const char *name, size_t v4, size_t v6, double fetch_seconds,
+                  int cached, int failed);
+void stats_remove_source(const char *type, const char *name);
+// Write node_exporter textfile and/or JSON (NULL or empty paths are skipped). Returns 0 or -1.
+int stats_write(const char *textfile, const char *json_file, int success);
+
+// --- IRR whois client (irr.c) ---
+// One ASN and family to ask the IRR server for
+typedef struct {
+    const char *asn_num;    // Numeric ASN
+    int family;
+    PrefixList *prefixes;   // Receives the announced prefixes
+    int ok;                 // Answered (an unknown ASN is answered with no prefixes)
+    double seconds;         // Time from sending the batch until the answer arrived
+} IrrQuery;
+
+// Resolve all queries over one persistent, pipelined connection to server
+// ("host[:port]", port 43 by default). Returns the number of queries answered.
+size_t irr_query(const char *server, const char *sources, IrrQuery *queries, size_t count);
+
+// --- Longest-prefix-match index (lpm.c) ---
+// Listed prefixes of one source, for the lookup index
+typedef struct {
+    const char *type;       // "config", "asn", "feed" or "allow" (exempts its prefixes)
+    const char *name;       // Section, ASN or feed path
+    const PrefixList *v4;   // Sorted, unique
+    const PrefixList *v6;
+} IndexSource;
+
+struct LpmNode6;
+
+// A mapped index file
+typedef struct {
+    MappedFile file;
+    const uint32_t *tbl24;  // IPv4 DIR-24-8 tables
+    const uint32_t *tbl8;
+    const struct LpmNode6 *v6_nodes; // IPv6 path-compressed trie, root first
+    const void *matches;
+    const uint32_t *source_ids;
+    const void *sources;
+    const char *strings;
+    uint32_t match_count;
+    int64_t built_at;
+} LpmIndex;
+
+// Compile the prefixes of all sources into an index file (replaced atomically). Returns 0 or -1.
+int lpm_write_index(const char *path, const IndexSource *sources, int count);
+int lpm_open(const char *path, LpmIndex *index);
+void lpm_close(LpmIndex *index);
+// Index of the longest listed prefix containing addr (network order), or -1
+long lpm_lookup(const LpmIndex *index, int family, const unsigned char *addr);
+// Whether the match is an allowed prefix rather than a block
+int lpm_match_allowed(const LpmIndex *index, long match);
+// "prefix<TAB>type:name,..." for a match. Returns buf.
+const char *lpm_describe(const LpmIndex *index, long match, char *buf, size_t buf_len);
+// Classify addresses from argv (or the first field of each stdin line) and print the results. Returns exit code.
+int run_lookup(const char *index_file, char **addrs, int count);
+
+// --- Daemon mode (daemon.c) ---
+// Load state once, then watch the config file and apply only deltas. Returns exit code.
+int run_daemon(const char *config_file);
+
+#endif // IPBAN_H
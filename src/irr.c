@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- IRR whois client ---
+//
+// Speaks the IRRd "!" protocol (as bgpq4 does) on one TCP connection: "!!"
+// keeps the connection open, then one "!gAS<n>" (IPv4) or "!6AS<n>" (IPv6)
+// query per ASN and family is sent without waiting for the answers, which come
+// back in query order:
+//
+//   A<len>\n<len bytes of space-separated prefixes>C\n    prefixes
+//   C\n                                                   no prefixes
+//   D\n                                                   unknown ASN
+//   F <message>\n                                         error
+//
+// If the connection breaks, the unanswered queries are sent again once on a
+// new one.
+
+#define IRR_DEFAULT_PORT "43"
+#define IRR_TIMEOUT_MS 30000
+#define IRR_ATTEMPTS 2
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} IrrBuf;
+
+static void buf_reserve(IrrBuf *buf, size_t extra) {
+    if (buf->len + extra <= buf->capacity) return;
+    size_t new_capacity = buf->capacity ? buf->capacity * 2 : 65536;
+    while (new_capacity < buf->len + extra) new_capacity *= 2;
+    char *new_data = (char*)realloc(buf->data, new_capacity);
+    if (!new_data) {
+        log_errno("Failed to allocate memory for IRR data");
+        exit(EXIT_FAILURE);
+    }
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+}
+
+// Append a query line (short: ASNs and source lists)
+static void buf_printf(IrrBuf *buf, const char *fmt, ...) {
+    va_list ap;
+    buf_reserve(buf, 256);
+    va_start(ap, fmt);
+    int n = vsnprintf(buf->data + buf->len, 256, fmt, ap);
+    va_end(ap);
+    if (n > 0) buf->len += n < 256 ? (size_t)n : 255;
+}
+
+// Connect to "host[:port]" ("[v6addr]:port" for IPv6 literals). Returns a
+// non-blocking socket, or -1 on error.
+static int irr_connect(const char *server) {
+    char host[256];
+    const char *port = IRR_DEFAULT_PORT;
+    snprintf(host, sizeof(host), "%s", server);
+    char *colon = strrchr(host, ':');
+    if (host[0] == '[') {
+        char *close_bracket = strchr(host, ']');
+        if (close_bracket) {
+            *close_bracket = '\0';
+            if (close_bracket[1] == ':') port = close_bracket + 2;
+            memmove(host, host + 1, strlen(host + 1) + 1);
+        }
+    } else if (colon && strchr(host, ':') == colon) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host, port, &hints, &res);
+    if (rc != 0) {
+        log_error("Cannot resolve IRR server '%s': %s\n", server, gai_strerror(rc));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        struct timeval tv = { IRR_TIMEOUT_MS / 1000, 0 }; // Bounds connect()
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        char error_buf[300];
+        snprintf(error_buf, sizeof(error_buf), "Failed to connect to IRR server %s", server);
+        log_errno(error_buf);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Parse the space-separated prefixes of an A response into the query
+static void parse_prefixes(IrrQuery *query, char *data, size_t len) {
+    data[len] = '\0';
+    char *save = NULL;
+    for (char *token = strtok_r(data, " \t\r\n", &save); token; token = strtok_r(NULL, " \t\r\n", &save)) {
+        Prefix prefix;
+        if (parse_prefix(token, query->family, &prefix) == -1) {
+            log_warn("  Skipping invalid %s prefix from AS%s: %s\n",
+                     query->family == AF_INET ? "IPv4" : "IPv6", query->asn_num, token);
+            continue;
+        }
+        prefix_list_push(query->prefixes, &prefix);
+    }
+}
+
+// Take one complete response off the front of in. Returns the bytes consumed,
+// 0 if the response is not complete yet, or -1 on a protocol error. *status is
+// set to 1 for a successful answer, 0 for an F error.
+static long take_response(IrrBuf *in, IrrQuery *query, int *status) {
+    char *nl = (char *)memchr(in->data, '\n', in->len);
+    if (!nl) return 0;
+    size_t line_len = nl - in->data + 1;
+    switch (in->data[0]) {
+        case 'C':
+        case 'D':
+            *status = 1;
+            return (long)line_len;
+        case 'F': {
+            *nl = '\0';
+            log_warn("IRR server error for AS%s: %s\n",
+                     query ? query->asn_num : "-", in->data + 1 + (in->data[1] == ' '));
+            *status = 0;
+            return (long)line_len;
+        }
+        case 'A': {
+            char *end;
+            unsigned long data_len = strtoul(in->data + 1, &end, 10);
+            if (end == in->data + 1 || (*end != '\n' && *end != '\r')) return -1;
+            size_t data_start = line_len;
+            if (in->len < data_start + data_len) return 0;
+            // The data is followed by the C line
+            char *c_line = in->data + data_start + data_len;
+            char *c_end = (char *)memchr(c_line, '\n', in->len - data_start - data_len);
+            if (!c_end) return 0;
+            if (c_line[0] != 'C') return -1;
+            if (query) parse_prefixes(query, in->data + data_start, data_len); // Overwrites the C line
+            *status = 1;
+            return (long)(c_end - in->data + 1);
+        }
+        default:
+            return -1;
+    }
+}
+
+// Send all queries from first on over one connection and read the answers.
+// Returns the index of the first query that has no answer.
+static size_t irr_session(const char *server, const char *sources, IrrQuery *queries, size_t first, size_t count) {
+    int fd = irr_connect(server);
+    if (fd < 0) return first;
+
+    IrrBuf out = { NULL, 0, 0 }, in = { NULL, 0, 0 };
+    int preamble = 0; // Answers expected before the first query
+    buf_printf(&out, "!!\n");
+    buf_printf(&out, "!nipban\n");
+    preamble++;
+    if (sources && sources[0]) {
+        buf_printf(&out, "!s%s\n", sources);
+        preamble++;
+    }
+    for (size_t i = first; i < count; i++) {
+        buf_printf(&out, queries[i].family == AF_INET ? "!gAS%s\n" : "!6AS%s\n", queries[i].asn_num);
+    }
+    buf_printf(&out, "!q\n");
+
+    double start = stats_now();
+    size_t sent = 0, next = first;
+    int error = 0;
+    while (next < count && !error) {
+        struct pollfd pfd = { fd, POLLIN | (sent < out.len ? POLLOUT : 0), 0 };
+        int ready = poll(&pfd, 1, IRR_TIMEOUT_MS);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            log_errno("poll failed on IRR connection");
+            break;
+        }
+        if (ready == 0) {
+            log_error("IRR server %s did not answer for %d seconds\n", server, IRR_TIMEOUT_MS / 1000);
+            break;
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(fd, out.data + sent, out.len - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                log_errno("Failed to send IRR queries");
+                break;
+            }
+            if (n > 0) sent += (size_t)n;
+        }
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        buf_reserve(&in, 65536);
+        ssize_t n = recv(fd, in.data + in.len, in.capacity - in.len, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            log_errno("Failed to read IRR answers");
+            break;
+        }
+        if (n == 0) {
+            log_error("IRR server %s closed the connection with %zu queries unanswered\n",
+                      server, count - next);
+            break;
+        }
+        in.len += (size_t)n;
+
+        // Consume every complete answer in the buffer
+        size_t pos = 0;
+        while (next < count) {
+            IrrBuf view = { in.data + pos, in.len - pos, 0 };
+            IrrQuery *query = preamble > 0 ? NULL : &queries[next];
+            int status = 0;
+            long used = take_response(&view, query, &status);
+            if (used < 0) {
+                log_error("Unexpected answer from IRR server %s\n", server);
+                error = 1;
+                break;
+            }
+            if (used == 0) break;
+            pos += (size_t)used;
+            if (preamble > 0) {
+                preamble--;
+                continue;
+            }
+            query->ok = status;
+            query->seconds = stats_now() - start;
+            next++;
+        }
+        memmove(in.data, in.data + pos, in.len - pos);
+        in.len -= pos;
+    }
+    close(fd);
+    free(out.data);
+    free(in.data);
+    return next;
+}
+
+// Resolve all queries over one persistent, pipelined connection (a second one
+// for the rest if it breaks). Returns the number of queries answered.
+size_t irr_query(const char *server, const char *sources, IrrQuery *queries, size_t count) {
+    size_t next = 0;
+    for (int attempt = 0; attempt < IRR_ATTEMPTS && next < count; attempt++) {
+        if (attempt > 0) log_warn("Retrying %zu IRR queries on a new connection...\n", count - next);
+        next = irr_session(server, sources, queries, next, count);
+    }
+    size_t answered = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (queries[i].ok) answered++;
+    }
+    return answered;
+}
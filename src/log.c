@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "ipban.h"
+
+// --- Logging ---
+//
+// Messages are formatted by the calling thread and appended to a buffer per
+// output stream; a writer thread hands whole batches to write(), so a slow
+// consumer (journald, a pipe) does not cost a system call per line on the
+// apply path. A producer only waits if a stream has LOG_BUF_MAX bytes queued.
+// Messages above the configured level are dropped before they are formatted.
+//
+// Text output is the messages as they are, info and debug on stdout and
+// warnings and errors on stderr, where the formatter puts "Warning: " or
+// "Error: " in front (after any leading blank lines and indentation); call
+// sites never spell out the level. JSON output is one object per message on
+// stdout: {"ts": "...", "level": "...", "msg": "..."}.
+
+#define LOG_LINE_MAX 4096           // Longer messages are cut
+#define LOG_BUF_MAX (1024 * 1024)   // Per stream
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} LogBuf;
+
+static const char *level_names[] = { "error", "warn", "info", "debug" };
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // Writer: something was queued
+    pthread_cond_t drained;     // Producers: a batch was written
+    LogBuf queued[2];           // stdout, stderr
+    int writing;                // The writer holds a batch
+    int running;                // Writer thread started
+    int stopping;
+    pthread_t thread;
+    int level;
+    int pinned;                 // Level given on the command line, settings do not override it
+    int json;
+    int to_stderr;              // Everything on stderr (stdout carries results)
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+    .level = LOG_LEVEL_INFO,
+};
+
+static void write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; // Nowhere to report it
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void buf_append(LogBuf *buf, const char *text, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        size_t new_capacity = buf->capacity ? buf->capacity * 2 : 65536;
+        while (new_capacity < buf->len + len) new_capacity *= 2;
+        char *data = (char*)realloc(buf->data, new_capacity);
+        if (!data) return; // Drop the message rather than fail the caller
+        buf->data = data;
+        buf->capacity = new_capacity;
+    }
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+}
+
+static void *log_writer(void *arg) {
+    (void)arg;
+    LogBuf batch[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+    pthread_mutex_lock(&logger.lock);
+    for (;;) {
+        while (!logger.queued[0].len && !logger.queued[1].len && !logger.stopping) {
+            pthread_cond_wait(&logger.wake, &logger.lock);
+        }
+        if (!logger.queued[0].len && !logger.queued[1].len) break;
+        for (int s = 0; s < 2; s++) {
+            LogBuf tmp = batch[s];
+            batch[s] = logger.queued[s];
+            logger.queued[s] = tmp;
+            logger.queued[s].len = 0;
+        }
+        logger.writing = 1;
+        pthread_mutex_unlock(&logger.lock);
+        for (int s = 0; s < 2; s++) {
+            if (batch[s].len) write_all(s == 0 ? STDOUT_FILENO : STDERR_FILENO, batch[s].data, batch[s].len);
+        }
+        pthread_mutex_lock(&logger.lock);
+        logger.writing = 0;
+        pthread_cond_broadcast(&logger.drained);
+    }
+    pthread_mutex_unlock(&logger.lock);
+    free(batch[0].data);
+    free(batch[1].data);
+    return NULL;
+}
+
+// Write everything queued and stop the writer (at exit)
+static void log_stop(void) {
+    pthread_mutex_lock(&logger.lock);
+    if (!logger.running) {
+        pthread_mutex_unlock(&logger.lock);
+        return;
+    }
+    logger.stopping = 1;
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.lock);
+    if (pthread_equal(pthread_self(), logger.thread)) return;
+    pthread_join(logger.thread, NULL);
+    logger.running = 0;
+}
+
+void log_start(void) {
+    if (logger.running) return;
+    // The writer never takes signals; the daemon blocks SIGTERM/SIGINT/SIGHUP
+    // later in the main thread and reads them from a signalfd
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret = pthread_create(&logger.thread, NULL, log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0) {
+        // Messages are then written directly
+        write_all(STDERR_FILENO, "Warning: Cannot start the log writer thread.\n", 46);
+        return;
+    }
+    logger.running = 1;
+    atexit(log_stop);
+}
+
+int parse_log_level(const char *name) {
+    for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++) {
+        if (strcmp(name, level_names[i]) == 0) return i;
+    }
+    if (strcmp(name, "warning") == 0) return LOG_LEVEL_WARN;
+    return -1;
+}
+
+void log_pin_level(int level) {
+    logger.level = level;
+    logger.pinned = 1;
+}
+
+void log_to_stderr(void) {
+    logger.to_stderr = 1;
+}
+
+void log_configure(const Settings *settings) {
+    if (!logger.pinned) logger.level = settings->log_level;
+    logger.json = settings->log_json;
+}
+
+int log_enabled(int level) {
+    return level <= logger.level;
+}
+
+// Append s to out as the contents of a JSON string. Returns the new length.
+static size_t json_escape(char *out, size_t len, size_t max, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    for (; *s && len + 7 < max; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out[len++] = '\\';
+            out[len++] = (char)c;
+        } else if (c == '\n') {
+            out[len++] = '\\';
+            out[len++] = 'n';
+        } else if (c == '\t') {
+            out[len++] = '\\';
+            out[len++] = 't';
+        } else if (c < 0x20) {
+            len += (size_t)snprintf(out + len, max - len, "\\u00%c%c", hex[c >> 4], hex[c & 15]);
+        } else {
+            out[len++] = (char)c;
+        }
+    }
+    return len;
+}
+
+static void log_emit(int level, const char *fmt, va_list ap) {
+    char msg[LOG_LINE_MAX];
+    char line[LOG_LINE_MAX * 2];
+    size_t len;
+    int n = vsnprintf(msg, sizeof(msg), fmt, ap);
+    if (n < 0) return;
+    if ((size_t)n >= sizeof(msg)) {
+        n = sizeof(msg) - 1;
+        msg[n - 1] = '\n';
+    }
+    int stream = logger.to_stderr || (!logger.json && level <= LOG_LEVEL_WARN) ? 1 : 0;
+    if (logger.json) {
+        // One object per message; the blank lines and newlines of the text format are dropped
+        char *text = msg;
+        while (*text == '\n') text++;
+        while (n > 0 && msg[n - 1] == '\n') msg[--n] = '\0';
+        if (*text == '\0') return;
+        struct timespec now;
+        struct tm tm;
+        clock_gettime(CLOCK_REALTIME, &now);
+        gmtime_r(&now.tv_sec, &tm);
+        len = strftime(line, sizeof(line), "{\"ts\": \"%Y-%m-%dT%H:%M:%S", &tm);
+        len += (size_t)snprintf(line + len, sizeof(line) - len, ".%03ldZ\", \"level\": \"%s\", \"msg\": \"",
+                                now.tv_nsec / 1000000, level_names[level]);
+        len = json_escape(line, len, sizeof(line) - 3, text);
+        memcpy(line + len, "\"}\n", 3);
+        len += 3;
+    } else {
+        size_t lead = level <= LOG_LEVEL_WARN ? strspn(msg, "\n ") : 0;
+        const char *prefix = level == LOG_LEVEL_ERROR ? "Error: " : level == LOG_LEVEL_WARN ? "Warning: " : "";
+        len = (size_t)snprintf(line, sizeof(line), "%.*s%s%s", (int)lead, msg, prefix, msg + lead);
+    }
+
+    pthread_mutex_lock(&logger.lock);
+    if (!logger.running || logger.stopping) {
+        pthread_mutex_unlock(&logger.lock);
+        write_all(stream == 0 ? STDOUT_FILENO : STDERR_FILENO, line, len);
+        return;
+    }
+    while (logger.queued[stream].len + len > LOG_BUF_MAX && logger.running && !logger.stopping) {
+        pthread_cond_wait(&logger.drained, &logger.lock);
+    }
+    int was_empty = !logger.queued[0].len && !logger.queued[1].len;
+    buf_append(&logger.queued[stream], line, len);
+    if (was_empty) pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+#define LOG_FUNCTION(name, msg_level)               \
+    void name(const char *fmt, ...) {               \
+        if (msg_level > logger.level) return;       \
+        va_list ap;                                 \
+        va_start(ap, fmt);                          \
+        log_emit(msg_level, fmt, ap);               \
+        va_end(ap);                                 \
+    }
+
+LOG_FUNCTION(log_error, LOG_LEVEL_ERROR)
+LOG_FUNCTION(log_warn, LOG_LEVEL_WARN)
+LOG_FUNCTION(log_info, LOG_LEVEL_INFO)
+LOG_FUNCTION(log_debug, LOG_LEVEL_DEBUG)
+
+void log_errno(const char *what) {
+    int saved_errno = errno;
+    log_error("%s: %s\n", what, strerror(saved_errno));
+    errno = saved_errno;
+}
+
+void log_flush(void) {
+    pthread_mutex_lock(&logger.lock);
+    while ((logger.queued[0].len || logger.queued[1].len || logger.writing) && logger.running && !logger.stopping) {
+        pthread_cond_wait(&logger.drained, &logger.lock);
+    }
+    pthread_mutex_unlock(&logger.lock);
+}
@@ -0,0 +1,517 @@
+#define _GNU_SOURCE // For memmem(), memrchr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>          // For dirname/basename
+#include <arpa/inet.h>       // For inet_pton
+#include <netinet/in.h>      // For AF_INET/AF_INET6
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "ipban.h"
+
+// --- Log watching ---
+//
+// The daemon follows the files of the [logwatch] section like `tail -F`: a
+// directory watch reports writes, and every file is also checked once a second,
+// which catches rotation (the path now names another inode: the old file is
+// read to its end first) and truncation (copytruncate). Files are read in large
+// chunks and only whole lines are scanned.
+//
+// Lines are selected without regular expressions: each pattern is searched
+// across the whole chunk with memmem(), which glibc vectorizes, and the pattern
+// hits are merged in file order, so lines without a match are never looked at
+// individually. A matching line is searched for its first IPv4 or IPv6
+// address, and the address scores a hit in a sliding window: each address
+// keeps the count of the current and of the previous window, and the estimate
+// is the current count plus the previous one weighted by the part of the window
+// still overlapping it. An address reaching log_threshold is banned for
+// ban_ttl seconds and its count starts over.
+
+#define LOG_BUF_SIZE (256 * 1024)   // Per file; a longer line is dropped
+#define LOG_ADDR_MAX 64             // Longest address token considered
+#define HIT_TABLE_MIN 1024
+
+struct HitCounter {
+    Prefix addr;            // family 0 = free slot
+    uint16_t cur;           // Hits in window number `window`
+    uint16_t prev;          // Hits in the window before it
+    uint32_t window;
+};
+
+// What to do with matching lines: ban (daemon) or report (--scan-logs)
+typedef struct {
+    LogWatch *watch;
+    uint32_t now;
+    BanStore *bans;         // Daemon: ban addresses reaching the threshold
+    long ttl;
+    RouteArray *reported;   // --scan-logs: addresses printed so far, per family
+    size_t matches;
+    size_t banned;
+} LogScan;
+
+// --- Sliding window counters ---
+
+static void init_hit_table(HitTable *table, size_t capacity) {
+    table->slots = (HitCounter*)calloc(capacity, sizeof(HitCounter));
+    if (!table->slots) {
+        log_errno("Failed to allocate memory for log hit counters");
+        exit(EXIT_FAILURE);
+    }
+    table->mask = capacity - 1;
+    table->count = 0;
+}
+
+static HitCounter *hit_slot(HitTable *table, const Prefix *addr) {
+    size_t pos = prefix_hash(addr) & table->mask;
+    while (table->slots[pos].addr.family && prefix_cmp(&table->slots[pos].addr, addr) != 0) {
+        pos = (pos + 1) & table->mask;
+    }
+    return &table->slots[pos];
+}
+
+// Rebuild the table without counters older than the previous window, at a size
+// that leaves room for as many new addresses again
+static void prune_hits(HitTable *table, uint32_t window) {
+    size_t live = 0;
+    for (size_t i = 0; i <= table->mask; i++) {
+        const HitCounter *c = &table->slots[i];
+        if (c->addr.family && c->window + 1 >= window && (c->cur || c->prev)) live++;
+    }
+    size_t capacity = HIT_TABLE_MIN;
+    while (capacity < live * 4) capacity *= 2;
+    HitTable old = *table;
+    init_hit_table(table, capacity);
+    for (size_t i = 0; i <= old.mask; i++) {
+        const HitCounter *c = &old.slots[i];
+        if (!c->addr.family || c->window + 1 < window || !(c->cur || c->prev)) continue;
+        *hit_slot(table, &c->addr) = *c;
+        table->count++;
+    }
+    free(old.slots);
+    table->pruned = window;
+}
+
+// Count a hit for addr at time now. Returns 1 if the address reached the threshold.
+static int count_hit(LogWatch *watch, const Prefix *addr, uint32_t now) {
+    HitTable *table = &watch->hits;
+    uint32_t window = now / (uint32_t)watch->window;
+    uint32_t into = now % (uint32_t)watch->window;
+    if ((table->count + 1) * 4 > (table->mask + 1) * 3) prune_hits(table, window);
+    HitCounter *c = hit_slot(table, addr);
+    if (!c->addr.family) {
+        memset(c, 0, sizeof(*c));
+        c->addr = *addr;
+        c->window = window;
+        table->count++;
+    }
+    if (c->window != window) {
+        c->prev = c->window + 1 == window ? c->cur : 0;
+        c->cur = 0;
+        c->window = window;
+    }
+    if (c->cur < UINT16_MAX) c->cur++;
+    uint64_t estimate = c->cur + (uint64_t)c->prev * (watch->window - into) / watch->window;
+    if (estimate < (uint64_t)watch->threshold) return 0;
+    c->cur = c->prev = 0;
+    return 1;
+}
+
+// --- Line scanner ---
+
+static int is_addr_char(unsigned char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') || c == '.' || c == ':';
+}
+
+static int is_word_char(unsigned char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+// Parse one run of address characters as an IPv4 or IPv6 address. Handles
+// "addr:port" and trailing punctuation. Returns 0 or -1.
+static int parse_log_addr(const char *text, size_t len, Prefix *out) {
+    char buf[LOG_ADDR_MAX];
+    const char *dot = memchr(text, '.', len);
+    const char *colon = memchr(text, ':', len);
+    if (!dot && !colon) return -1;
+    if (dot && colon && colon > dot) len = colon - text;     // 192.0.2.1:443
+    if (len > 0 && text[len - 1] == '.') len--;             // End of a sentence
+    if (len > 1 && text[len - 1] == ':' && text[len - 2] != ':') len--;
+    if (len < 2 || len >= sizeof(buf)) return -1;
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    memset(out, 0, sizeof(*out));
+    if (!memchr(buf, ':', len)) {
+        if (inet_pton(AF_INET, buf, out->addr) != 1) return -1;
+        out->family = AF_INET;
+        out->len = 32;
+        return 0;
+    }
+    if (inet_pton(AF_INET6, buf, out->addr) != 1) return -1;
+    static const unsigned char v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    if (memcmp(out->addr, v4_mapped, sizeof(v4_mapped)) == 0) {
+        memmove(out->addr, out->addr + 12, 4);
+        memset(out->addr + 4, 0, 12);
+        out->family = AF_INET;
+        out->len = 32;
+        return 0;
+    }
+    out->family = AF_INET6;
+    out->len = 128;
+    return 0;
+}
+
+// First address in a line that stands on its own (not inside a word).
+// Returns 0 or -1.
+static int find_log_addr(const char *line, const char *end, Prefix *out) {
+    const char *p = line;
+    while (p < end) {
+        if (!is_addr_char((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        const char *start = p;
+        while (p < end && is_addr_char((unsigned char)*p)) p++;
+        if ((start > line && is_word_char((unsigned char)start[-1])) || (p < end && is_word_char((unsigned char)*p))) {
+            continue;
+        }
+        if (p - start <= LOG_ADDR_MAX && parse_log_addr(start, p - start, out) == 0) return 0;
+    }
+    return -1;
+}
+
+static void handle_match(LogScan *scan, const char *line, const char *end) {
+    Prefix addr;
+    scan->matches++;
+    if (find_log_addr(line, end, &addr) == -1) return;
+    if (!count_hit(scan->watch, &addr, scan->now)) return;
+    if (scan->bans) {
+        if (ban_add(scan->bans, &addr, scan->ttl > (long)BAN_MAX_TTL ? BAN_MAX_TTL : (uint32_t)scan->ttl)) {
+            stats_add(STAT_BANS_ADDED, 1);
+            stats_add(STAT_LOG_BANS, 1);
+            scan->banned++;
+        }
+    } else if (add_prefix(&scan->reported[addr.family == AF_INET ? 0 : 1], &addr) == 1) {
+        char text[PREFIX_STRLEN];
+        format_prefix(&addr, text, sizeof(text));
+        *strchr(text, '/') = '\0';
+        printf("%s\n", text);
+        scan->banned++;
+    }
+}
+
+// Handle every line of data[0, len) that contains a pattern (every line if
+// there are no patterns)
+static void scan_lines(LogScan *scan, const char *data, size_t len) {
+    LogWatch *watch = scan->watch;
+    const char *end = data + len;
+    int count = watch->patterns.count;
+    if (count == 0) {
+        for (const char *p = data; p < end; ) {
+            const char *nl = (const char *)memchr(p, '\n', end - p);
+            const char *line_end = nl ? nl : end;
+            if (line_end > p) handle_match(scan, p, line_end);
+            p = line_end + 1;
+        }
+        return;
+    }
+    const char **next = watch->next_hit;
+    for (int k = 0; k < count; k++) {
+        next[k] = (const char *)memmem(data, len, watch->patterns.items[k], watch->pattern_lens[k]);
+    }
+    for (;;) {
+        const char *hit = NULL;
+        for (int k = 0; k < count; k++) {
+            if (next[k] && (!hit || next[k] < hit)) hit = next[k];
+        }
+        if (!hit) break;
+        const char *line = (const char *)memrchr(data, '\n', hit - data);
+        line = line ? line + 1 : data;
+        const char *line_end = (const char *)memchr(hit, '\n', end - hit);
+        if (!line_end) line_end = end;
+        handle_match(scan, line, line_end);
+        // Patterns matching the same line again do not count twice
+        const char *resume = line_end < end ? line_end + 1 : end;
+        for (int k = 0; k < count; k++) {
+            if (next[k] && next[k] < resume) {
+                next[k] = (const char *)memmem(resume, end - resume, watch->patterns.items[k], watch->pattern_lens[k]);
+            }
+        }
+    }
+}
+
+// --- Following files ---
+
+// Read and scan what was appended to file since the last call. A partial last
+// line is kept for the next call.
+static void read_log(LogFile *file, LogScan *scan) {
+    for (;;) {
+        ssize_t n = read(file->fd, file->buf + file->len, LOG_BUF_SIZE - file->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        file->offset += n;
+        file->len += (size_t)n;
+        stats_add(STAT_LOG_BYTES, (uint64_t)n);
+        const char *last_nl = (const char *)memrchr(file->buf, '\n', file->len);
+        if (!last_nl) {
+            if (file->len == LOG_BUF_SIZE) file->len = 0; // Line too long
+            continue;
+        }
+        size_t done = (size_t)(last_nl - file->buf) + 1;
+        scan_lines(scan, file->buf, done);
+        memmove(file->buf, file->buf + done, file->len - done);
+        file->len -= done;
+    }
+}
+
+// Open the file at its path, at its end or (after rotation) at its start.
+// Returns 0, or -1 if it does not exist (yet).
+static int open_log(LogFile *file, int at_end) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (file->fd >= 0) close(file->fd);
+    file->fd = fd;
+    file->dev = (uint64_t)st.st_dev;
+    file->ino = (uint64_t)st.st_ino;
+    file->offset = at_end ? (int64_t)lseek(fd, 0, SEEK_END) : 0;
+    file->len = 0;
+    return 0;
+}
+
+// Catch up with one file, following rotation and truncation
+static void follow_log(LogFile *file, LogScan *scan) {
+    if (file->fd >= 0) read_log(file, scan);
+    struct stat st;
+    if (stat(file->path, &st) == 0 && (file->fd < 0 || (uint64_t)st.st_dev != file->dev ||
+                                       (uint64_t)st.st_ino != file->ino)) {
+        // Created or rotated: the old file was read to its end, start the new one from the top
+        if (open_log(file, 0) == 0) {
+            log_info("Following %s from its start (new file).\n", file->path);
+            read_log(file, scan);
+        }
+    } else if (file->fd >= 0 && fstat(file->fd, &st) == 0 && st.st_size < file->offset) {
+        log_info("%s was truncated, reading it from the start.\n", file->path);
+        lseek(file->fd, 0, SEEK_SET);
+        file->offset = 0;
+        file->len = 0;
+        read_log(file, scan);
+    }
+}
+
+void init_log_watch(LogWatch *watch) {
+    memset(watch, 0, sizeof(*watch));
+    init_string_array(&watch->patterns, 4);
+    init_hit_table(&watch->hits, HIT_TABLE_MIN);
+    watch->threshold = 5;
+    watch->window = 600;
+    watch->inotify_fd = -1;
+}
+
+static void close_log(LogWatch *watch, int i) {
+    LogFile *file = &watch->files[i];
+    int shared = 0;
+    for (int j = 0; j < watch->count && !shared; j++) shared = j != i && watch->files[j].wd == file->wd;
+    if (!shared && file->wd >= 0) inotify_rm_watch(watch->inotify_fd, file->wd);
+    if (file->fd >= 0) close(file->fd);
+    free(file->path);
+    free(file->buf);
+    watch->files[i] = watch->files[--watch->count];
+}
+
+// Use patterns; empty ones would match every position and are skipped
+static void set_patterns(LogWatch *watch, const StringArray *patterns) {
+    free_string_array(&watch->patterns);
+    init_string_array(&watch->patterns, patterns->count + 1);
+    for (int i = 0; i < patterns->count; i++) {
+        if (patterns->items[i][0] == '\0') {
+            log_warn("Ignoring empty [logwatch] pattern.\n");
+            continue;
+        }
+        add_string(&watch->patterns, patterns->items[i]);
+    }
+    free(watch->pattern_lens);
+    free(watch->next_hit);
+    watch->pattern_lens = (size_t*)malloc((watch->patterns.count + 1) * sizeof(size_t));
+    watch->next_hit = (const char **)malloc((watch->patterns.count + 1) * sizeof(const char *));
+    if (!watch->pattern_lens || !watch->next_hit) {
+        log_errno("Failed to allocate memory for log patterns");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < watch->patterns.count; i++) watch->pattern_lens[i] = strlen(watch->patterns.items[i]);
+}
+
+void log_watch_sync(LogWatch *watch, const StringArray *files, const StringArray *patterns, const Settings *settings) {
+    set_patterns(watch, patterns);
+    if (settings->log_threshold != watch->threshold || settings->log_window != watch->window) {
+        // Counts of another window length cannot be carried over
+        free(watch->hits.slots);
+        init_hit_table(&watch->hits, HIT_TABLE_MIN);
+    }
+    watch->threshold = settings->log_threshold;
+    watch->window = settings->log_window;
+
+    for (int i = 0; i < watch->count; ) {
+        int still_listed = 0;
+        for (int j = 0; j < files->count && !still_listed; j++) {
+            still_listed = strcmp(files->items[j], watch->files[i].path) == 0;
+        }
+        if (still_listed) {
+            i++;
+            continue;
+        }
+        log_info("No longer following %s.\n", watch->files[i].path);
+        close_log(watch, i);
+    }
+    if (files->count > 0 && watch->inotify_fd < 0) {
+        watch->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (watch->inotify_fd < 0) log_errno("Failed to set up log file watches, checking them once a second");
+    }
+    for (int j = 0; j < files->count; j++) {
+        int known = 0;
+        for (int i = 0; i < watch->count && !known; i++) known = strcmp(watch->files[i].path, files->items[j]) == 0;
+        if (known) continue;
+        if (watch->count == watch->capacity) {
+            int new_capacity = watch->capacity ? watch->capacity * 2 : 8;
+            LogFile *new_files = (LogFile*)realloc(watch->files, new_capacity * sizeof(LogFile));
+            if (!new_files) {
+                log_errno("Failed to allocate memory for log files");
+                exit(EXIT_FAILURE);
+            }
+            watch->files = new_files;
+            watch->capacity = new_capacity;
+        }
+        LogFile *file = &watch->files[watch->count++];
+        memset(file, 0, sizeof(*file));
+        file->fd = -1;
+        file->wd = -1;
+        file->path = strdup(files->items[j]);
+        file->buf = (char*)malloc(LOG_BUF_SIZE);
+        if (!file->path || !file->buf) {
+            log_errno("Failed to allocate memory for log file");
+            exit(EXIT_FAILURE);
+        }
+        file->name = strrchr(file->path, '/') ? strrchr(file->path, '/') + 1 : file->path;
+        if (watch->inotify_fd >= 0) {
+            char dir_buf[4096];
+            snprintf(dir_buf, sizeof(dir_buf), "%s", file->path);
+            file->wd = inotify_add_watch(watch->inotify_fd, dirname(dir_buf),
+                                         IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+            if (file->wd < 0) {
+                char error_buf[4200];
+                snprintf(error_buf, sizeof(error_buf), "Failed to watch the directory of %s", file->path);
+                log_errno(error_buf);
+            }
+        }
+        // Only lines written from now on count
+        if (open_log(file, 1) == 0) {
+            log_info("Following %s.\n", file->path);
+        } else {
+            log_info("Waiting for %s to appear.\n", file->path);
+        }
+    }
+}
+
+size_t log_watch_events(LogWatch *watch, BanStore *bans, uint32_t now, long ttl) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(watch->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (const char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            for (int i = 0; i < watch->count && ev->len > 0; i++) {
+                if (watch->files[i].wd == ev->wd && strcmp(watch->files[i].name, ev->name) == 0) {
+                    watch->files[i].dirty = 1;
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    LogScan scan = { watch, now, bans, ttl, NULL, 0, 0 };
+    for (int i = 0; i < watch->count; i++) {
+        if (!watch->files[i].dirty) continue;
+        watch->files[i].dirty = 0;
+        follow_log(&watch->files[i], &scan);
+    }
+    stats_add(STAT_LOG_MATCHES, scan.matches);
+    return scan.banned;
+}
+
+size_t log_watch_tick(LogWatch *watch, BanStore *bans, uint32_t now, long ttl) {
+    LogScan scan = { watch, now, bans, ttl, NULL, 0, 0 };
+    for (int i = 0; i < watch->count; i++) follow_log(&watch->files[i], &scan);
+    stats_add(STAT_LOG_MATCHES, scan.matches);
+    uint32_t window = now / (uint32_t)watch->window;
+    if (window != watch->hits.pruned && watch->hits.count > 0) prune_hits(&watch->hits, window);
+    return scan.banned;
+}
+
+void free_log_watch(LogWatch *watch) {
+    while (watch->count > 0) close_log(watch, watch->count - 1);
+    free(watch->files);
+    free_string_array(&watch->patterns);
+    free(watch->pattern_lens);
+    free(watch->next_hit);
+    free(watch->hits.slots);
+    if (watch->inotify_fd >= 0) close(watch->inotify_fd);
+    memset(watch, 0, sizeof(*watch));
+    watch->inotify_fd = -1;
+}
+
+// --scan-logs: run the [logwatch] patterns over whole files (or stdin) as one
+// window and print each address once it reaches log_threshold.
+// Returns the exit code.
+int run_scan_logs(const Config *config, char **paths, int count) {
+    LogWatch watch;
+    init_log_watch(&watch);
+    set_patterns(&watch, &config->log_patterns);
+    watch.threshold = config->settings.log_threshold;
+    watch.window = BAN_MAX_TTL; // Everything falls into the first window
+    RouteArray reported[2];
+    init_route_array(&reported[0], AF_INET, 1024);
+    init_route_array(&reported[1], AF_INET6, 1024);
+    LogScan scan = { &watch, 0, NULL, 0, reported, 0, 0 };
+
+    LogFile file;
+    memset(&file, 0, sizeof(file));
+    file.buf = (char*)malloc(LOG_BUF_SIZE);
+    if (!file.buf) {
+        log_errno("Failed to allocate memory for log input");
+        exit(EXIT_FAILURE);
+    }
+    int ret = 0;
+    uint64_t bytes = 0;
+    double start = stats_now();
+    for (int i = 0; i < (count > 0 ? count : 1); i++) {
+        file.fd = count > 0 ? open(paths[i], O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        if (file.fd < 0) {
+            char error_buf[4200];
+            snprintf(error_buf, sizeof(error_buf), "Failed to open log file '%s'", paths[i]);
+            log_errno(error_buf);
+            ret = 1;
+            continue;
+        }
+        file.offset = 0;
+        file.len = 0;
+        read_log(&file, &scan);
+        if (file.len > 0) scan_lines(&scan, file.buf, file.len); // Last line without a newline
+        bytes += (uint64_t)file.offset;
+        if (count > 0) close(file.fd);
+    }
+    fflush(stdout);
+    double seconds = stats_now() - start;
+    log_info("%.1f MB in %.3f s (%.0f MB/s), %zu matching lines, %zu addresses with %d or more\n",
+             bytes / 1e6, seconds, seconds > 0 ? bytes / 1e6 / seconds : 0.0, scan.matches, scan.banned,
+             watch.threshold);
+    free(file.buf);
+    free_route_array(&reported[0]);
+    free_route_array(&reported[1]);
+    free_log_watch(&watch);
+    return ret;
+}
@@ -0,0 +1,708 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>   // For inet_pton
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+
+#include "ipban.h"
+
+// --- Longest-prefix-match index ---
+//
+// The listed (not aggregated) prefixes of all sources are compiled into one
+// file that is used through mmap without any parsing:
+//
+//   header | tbl24 | tbl8 groups | IPv6 nodes | matches | source ids | sources | strings
+//
+// IPv4 uses DIR-24-8: tbl24 has one entry per /24, either a match or the index
+// of a group of 256 tbl8 entries for /25../32 prefixes, so a lookup is one or
+// two memory reads. IPv6 uses a path-compressed binary trie. Both store match
+// index + 1 (0 = not listed); a match is the listed prefix and the sources
+// (config section, ASN or feed) that list it. tbl24 is written sparsely, so a
+// small block set does not take 64 MB on disk. Allowed prefixes are compiled
+// in as matches of the "allow" source, and blocks inside them are left out, so
+// the longest match of an allowed address is always its allow entry.
+
+#define LPM_MAGIC "IPBANX1"
+#define LPM_VERSION 1
+#define LPM_PAGE 4096
+#define TBL24_ENTRIES (1u << 24)
+#define TBL8_FLAG 0x80000000u
+#define LOOKUP_CHUNK (8 * 1024 * 1024)
+#define MAX_LOOKUP_THREADS 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t tbl8_groups;
+    uint32_t v6_nodes;
+    uint32_t match_count;
+    uint32_t source_id_count;
+    uint32_t source_count;
+    uint32_t strings_size;
+    uint32_t reserved;
+    int64_t built_at;
+    uint64_t tbl24_offset;
+    uint64_t tbl8_offset;
+    uint64_t v6_offset;
+    uint64_t match_offset;
+    uint64_t source_id_offset;
+    uint64_t source_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+} LpmHeader;
+
+// IPv6 trie node: the prefix it stands for, the match for exactly that prefix
+// and the children for the next bit (0 = none; the root is never a child)
+struct LpmNode6 {
+    unsigned char key[16];
+    uint32_t match;
+    uint32_t child[2];
+    unsigned char len;
+    unsigned char pad[3];
+};
+
+typedef struct {
+    unsigned char addr[16];
+    unsigned char len;
+    unsigned char family;
+    uint16_t source_count;
+    uint32_t source_offset;  // Into the source id array
+} LpmMatch;
+
+typedef struct {
+    uint32_t name_offset;    // Into the string table
+    uint32_t type_offset;
+} LpmSource;
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+static int addr_bit(const unsigned char *addr, int bit) {
+    return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+// Whether the first len bits of addr equal key
+static int key_matches(const unsigned char *addr, const unsigned char *key, int len) {
+    int bytes = len / 8;
+    if (memcmp(addr, key, bytes) != 0) return 0;
+    if (len % 8 == 0) return 1;
+    unsigned char mask = (unsigned char)(0xFF << (8 - len % 8));
+    return ((addr[bytes] ^ key[bytes]) & mask) == 0;
+}
+
+// Number of leading bits a and b have in common, at most max
+static int common_bits(const unsigned char *a, const unsigned char *b, int max) {
+    int bits = 0;
+    for (int i = 0; i < 16 && bits < max; i++) {
+        unsigned char x = a[i] ^ b[i];
+        if (x) {
+            bits += __builtin_clz((unsigned int)x) - 24;
+            break;
+        }
+        bits += 8;
+    }
+    return bits < max ? bits : max;
+}
+
+// --- Building ---
+
+// A listed prefix with one source that lists it
+typedef struct {
+    Prefix prefix;
+    uint32_t source;
+} SourcedPrefix;
+
+static int sourced_prefix_cmp(const void *a, const void *b) {
+    const SourcedPrefix *pa = (const SourcedPrefix *)a, *pb = (const SourcedPrefix *)b;
+    int c = prefix_cmp(&pa->prefix, &pb->prefix);
+    if (c != 0) return c;
+    return pa->source < pb->source ? -1 : pa->source > pb->source;
+}
+
+typedef struct {
+    uint32_t *tbl24;
+    uint32_t *tbl8;
+    uint32_t tbl8_groups;
+    uint32_t tbl8_capacity;
+    struct LpmNode6 *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+} LpmBuild;
+
+static void *grow(void *items, uint32_t *capacity, size_t item_size, uint32_t needed) {
+    if (needed <= *capacity) return items;
+    uint32_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *new_items = realloc(items, (size_t)new_capacity * item_size);
+    if (!new_items) {
+        log_errno("Failed to allocate memory for the lookup index");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return new_items;
+}
+
+// Paint an IPv4 prefix into the tables. Prefixes must come shortest first, so
+// that longer ones overwrite the entries of the shorter ones they are inside.
+static void insert_v4(LpmBuild *b, const Prefix *prefix, uint32_t value) {
+    uint32_t addr = ((uint32_t)prefix->addr[0] << 24) | ((uint32_t)prefix->addr[1] << 16) |
+                    ((uint32_t)prefix->addr[2] << 8) | prefix->addr[3];
+    if (prefix->len <= 24) {
+        uint32_t first = addr >> 8, count = 1u << (24 - prefix->len);
+        for (uint32_t i = 0; i < count; i++) b->tbl24[first + i] = value;
+        return;
+    }
+    uint32_t *entry = &b->tbl24[addr >> 8];
+    if (!(*entry & TBL8_FLAG)) {
+        // First prefix longer than /24 in this /24: expand it into a group
+        b->tbl8 = (uint32_t*)grow(b->tbl8, &b->tbl8_capacity, 256 * sizeof(uint32_t), b->tbl8_groups + 1);
+        for (int i = 0; i < 256; i++) b->tbl8[(size_t)b->tbl8_groups * 256 + i] = *entry;
+        *entry = TBL8_FLAG | b->tbl8_groups++;
+    }
+    uint32_t *group = &b->tbl8[(size_t)(*entry & ~TBL8_FLAG) * 256];
+    uint32_t first = addr & 0xFF, count = 1u << (32 - prefix->len);
+    for (uint32_t i = 0; i < count; i++) group[first + i] = value;
+}
+
+static uint32_t new_node(LpmBuild *b, const unsigned char *key, int len, uint32_t value) {
+    b->nodes = (struct LpmNode6*)grow(b->nodes, &b->node_capacity, sizeof(struct LpmNode6), b->node_count + 1);
+    struct LpmNode6 *node = &b->nodes[b->node_count];
+    memset(node, 0, sizeof(*node));
+    for (int bit = 0; bit < len; bit++) {
+        if (addr_bit(key, bit)) node->key[bit / 8] |= (unsigned char)(0x80 >> (bit % 8));
+    }
+    node->len = (unsigned char)len;
+    node->match = value;
+    return b->node_count++;
+}
+
+// Insert an IPv6 prefix into the trie (any order)
+static void insert_v6(LpmBuild *b, const Prefix *prefix, uint32_t value) {
+    uint32_t cur = 0; // Root, ::/0
+    if (prefix->len == 0) {
+        b->nodes[0].match = value;
+        return;
+    }
+    for (;;) {
+        int bit = addr_bit(prefix->addr, b->nodes[cur].len);
+        uint32_t child = b->nodes[cur].child[bit];
+        if (!child) {
+            uint32_t leaf = new_node(b, prefix->addr, prefix->len, value);
+            b->nodes[cur].child[bit] = leaf;
+            return;
+        }
+        int child_len = b->nodes[child].len;
+        int common = common_bits(prefix->addr, b->nodes[child].key,
+                                 prefix->len < child_len ? prefix->len : child_len);
+        if (common == child_len) {
+            if (child_len == prefix->len) {
+                b->nodes[child].match = value;
+                return;
+            }
+            cur = child; // The child covers the prefix, descend
+            continue;
+        }
+        if (common == prefix->len) {
+            // The prefix covers the child: put it in between
+            uint32_t node = new_node(b, prefix->addr, prefix->len, value);
+            b->nodes[node].child[addr_bit(b->nodes[child].key, common)] = child;
+            b->nodes[cur].child[bit] = node;
+            return;
+        }
+        // They diverge below the child's prefix: add a branching node
+        uint32_t branch = new_node(b, prefix->addr, common, 0);
+        uint32_t leaf = new_node(b, prefix->addr, prefix->len, value);
+        b->nodes[branch].child[addr_bit(b->nodes[child].key, common)] = child;
+        b->nodes[branch].child[addr_bit(prefix->addr, common)] = leaf;
+        b->nodes[cur].child[bit] = branch;
+        return;
+    }
+}
+
+// Write buf at offset, leaving all-zero pages as holes
+static int write_sparse(int fd, const void *buf, size_t len, uint64_t offset) {
+    static const unsigned char zero[LPM_PAGE];
+    const unsigned char *p = (const unsigned char *)buf;
+    for (size_t done = 0; done < len; done += LPM_PAGE) {
+        size_t n = len - done < LPM_PAGE ? len - done : LPM_PAGE;
+        if (memcmp(p + done, zero, n) == 0) continue;
+        if (pwrite(fd, p + done, n, (off_t)(offset + done)) != (ssize_t)n) return -1;
+    }
+    return 0;
+}
+
+static int write_at(int fd, const void *buf, size_t len, uint64_t offset) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Compile the prefixes of all sources into an index file, replaced atomically.
+// Returns 0, or -1 on error.
+int lpm_write_index(const char *path, const IndexSource *sources, int count) {
+    // Pair every prefix with its source, then group equal prefixes into matches
+    size_t total = 0;
+    for (int s = 0; s < count; s++) total += sources[s].v4->count + sources[s].v6->count;
+    SourcedPrefix *pairs = (SourcedPrefix*)malloc((total ? total : 1) * sizeof(SourcedPrefix));
+    if (!pairs) {
+        log_errno("Failed to allocate memory for the lookup index");
+        exit(EXIT_FAILURE);
+    }
+    // Blocks that are allowed as a whole are never the answer
+    PrefixTrie allowed[2];
+    PrefixList allow_lists[2];
+    init_prefix_list(&allow_lists[0], 16);
+    init_prefix_list(&allow_lists[1], 16);
+    for (int s = 0; s < count; s++) {
+        if (strcmp(sources[s].type, "allow") != 0) continue;
+        for (size_t i = 0; i < sources[s].v4->count; i++) prefix_list_push(&allow_lists[0], &sources[s].v4->items[i]);
+        for (size_t i = 0; i < sources[s].v6->count; i++) prefix_list_push(&allow_lists[1], &sources[s].v6->items[i]);
+    }
+    init_prefix_trie(&allowed[0], &allow_lists[0]);
+    init_prefix_trie(&allowed[1], &allow_lists[1]);
+    free_prefix_list(&allow_lists[0]);
+    free_prefix_list(&allow_lists[1]);
+
+    size_t n = 0;
+    for (int s = 0; s < count; s++) {
+        int allow = strcmp(sources[s].type, "allow") == 0;
+        for (int f = 0; f < 2; f++) {
+            const PrefixList *list = f == 0 ? sources[s].v4 : sources[s].v6;
+            for (size_t i = 0; i < list->count; i++) {
+                if (!allow && prefix_trie_covers(&allowed[f], &list->items[i])) continue;
+                pairs[n].prefix = list->items[i];
+                pairs[n++].source = (uint32_t)s;
+            }
+        }
+    }
+    qsort(pairs, n, sizeof(SourcedPrefix), sourced_prefix_cmp);
+    free_prefix_trie(&allowed[0]);
+    free_prefix_trie(&allowed[1]);
+
+    LpmMatch *matches = (LpmMatch*)calloc(n ? n : 1, sizeof(LpmMatch));
+    uint32_t *source_ids = (uint32_t*)malloc((n ? n : 1) * sizeof(uint32_t));
+    LpmSource *source_table = (LpmSource*)calloc(count ? count : 1, sizeof(LpmSource));
+    LpmBuild b;
+    memset(&b, 0, sizeof(b));
+    b.tbl24 = (uint32_t*)calloc(TBL24_ENTRIES, sizeof(uint32_t));
+    if (!matches || !source_ids || !source_table || !b.tbl24) {
+        log_errno("Failed to allocate memory for the lookup index");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t match_count = 0, id_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || prefix_cmp(&pairs[i].prefix, &pairs[i - 1].prefix) != 0) {
+            LpmMatch *m = &matches[match_count++];
+            memcpy(m->addr, pairs[i].prefix.addr, sizeof(m->addr));
+            m->len = pairs[i].prefix.len;
+            m->family = pairs[i].prefix.family;
+            m->source_offset = id_count;
+        }
+        else if (pairs[i].source == pairs[i - 1].source) continue; // Listed twice by one source
+        if (matches[match_count - 1].source_count < UINT16_MAX) {
+            source_ids[id_count++] = pairs[i].source;
+            matches[match_count - 1].source_count++;
+        }
+    }
+    free(pairs);
+
+    // IPv4, shortest prefixes first (counting sort by length)
+    uint32_t by_len[34] = {0};
+    for (uint32_t m = 0; m < match_count; m++) {
+        if (matches[m].family == AF_INET) by_len[matches[m].len + 1]++;
+    }
+    for (int len = 1; len < 34; len++) by_len[len] += by_len[len - 1];
+    uint32_t *order = (uint32_t*)malloc((by_len[33] ? by_len[33] : 1) * sizeof(uint32_t));
+    if (!order) {
+        log_errno("Failed to allocate memory for the lookup index");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t m = 0; m < match_count; m++) {
+        if (matches[m].family == AF_INET) order[by_len[matches[m].len]++] = m;
+    }
+    uint32_t v4_count = by_len[32];
+    for (uint32_t i = 0; i < v4_count; i++) {
+        Prefix prefix;
+        memcpy(prefix.addr, matches[order[i]].addr, sizeof(prefix.addr));
+        prefix.len = matches[order[i]].len;
+        prefix.family = AF_INET;
+        insert_v4(&b, &prefix, order[i] + 1);
+    }
+    free(order);
+
+    // IPv6
+    static const unsigned char any[16];
+    new_node(&b, any, 0, 0); // Root, ::/0
+    for (uint32_t m = 0; m < match_count; m++) {
+        if (matches[m].family != AF_INET6) continue;
+        Prefix prefix;
+        memcpy(prefix.addr, matches[m].addr, sizeof(prefix.addr));
+        prefix.len = matches[m].len;
+        prefix.family = AF_INET6;
+        insert_v6(&b, &prefix, m + 1);
+    }
+
+    // String table: "type\0name\0" per source
+    size_t strings_size = 0;
+    for (int s = 0; s < count; s++) strings_size += strlen(sources[s].type) + strlen(sources[s].name) + 2;
+    char *strings = (char*)malloc(strings_size ? strings_size : 1);
+    if (!strings) {
+        log_errno("Failed to allocate memory for the lookup index");
+        exit(EXIT_FAILURE);
+    }
+    size_t pos = 0;
+    for (int s = 0; s < count; s++) {
+        source_table[s].type_offset = (uint32_t)pos;
+        pos += (size_t)sprintf(strings + pos, "%s", sources[s].type) + 1;
+        source_table[s].name_offset = (uint32_t)pos;
+        pos += (size_t)sprintf(strings + pos, "%s", sources[s].name) + 1;
+    }
+
+    LpmHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LPM_MAGIC, sizeof(hdr.magic));
+    hdr.version = LPM_VERSION;
+    hdr.tbl8_groups = b.tbl8_groups;
+    hdr.v6_nodes = b.node_count;
+    hdr.match_count = match_count;
+    hdr.source_id_count = id_count;
+    hdr.source_count = (uint32_t)count;
+    hdr.strings_size = (uint32_t)strings_size;
+    hdr.built_at = (int64_t)time(NULL);
+    hdr.tbl24_offset = LPM_PAGE;
+    hdr.tbl8_offset = hdr.tbl24_offset + (uint64_t)TBL24_ENTRIES * sizeof(uint32_t);
+    hdr.v6_offset = align_up(hdr.tbl8_offset + (uint64_t)b.tbl8_groups * 256 * sizeof(uint32_t), 64);
+    hdr.match_offset = align_up(hdr.v6_offset + (uint64_t)b.node_count * sizeof(struct LpmNode6), 64);
+    hdr.source_id_offset = align_up(hdr.match_offset + (uint64_t)match_count * sizeof(LpmMatch), 64);
+    hdr.source_offset = align_up(hdr.source_id_offset + (uint64_t)id_count * sizeof(uint32_t), 64);
+    hdr.strings_offset = align_up(hdr.source_offset + (uint64_t)count * sizeof(LpmSource), 64);
+    hdr.file_size = hdr.strings_offset + strings_size;
+
+    char tmp_path[4200];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+    int ret = -1;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_errno(tmp_path);
+    } else {
+        int ok = ftruncate(fd, (off_t)hdr.file_size) == 0 &&
+                 write_at(fd, &hdr, sizeof(hdr), 0) == 0 &&
+                 write_sparse(fd, b.tbl24, (size_t)TBL24_ENTRIES * sizeof(uint32_t), hdr.tbl24_offset) == 0 &&
+                 write_at(fd, b.tbl8, (size_t)b.tbl8_groups * 256 * sizeof(uint32_t), hdr.tbl8_offset) == 0 &&
+                 write_at(fd, b.nodes, (size_t)b.node_count * sizeof(struct LpmNode6), hdr.v6_offset) == 0 &&
+                 write_at(fd, matches, (size_t)match_count * sizeof(LpmMatch), hdr.match_offset) == 0 &&
+                 write_at(fd, source_ids, (size_t)id_count * sizeof(uint32_t), hdr.source_id_offset) == 0 &&
+                 write_at(fd, source_table, (size_t)count * sizeof(LpmSource), hdr.source_offset) == 0 &&
+                 write_at(fd, strings, strings_size, hdr.strings_offset) == 0;
+        if (close(fd) != 0) ok = 0;
+        if (!ok || rename(tmp_path, path) < 0) {
+            log_errno("Failed to write lookup index");
+            unlink(tmp_path);
+        } else {
+            log_info("Wrote lookup index %s: %u prefixes from %d sources, %u tbl8 groups, %u IPv6 nodes\n",
+                     path, match_count, count, b.tbl8_groups, b.node_count);
+            ret = 0;
+        }
+    }
+
+    free(b.tbl24);
+    free(b.tbl8);
+    free(b.nodes);
+    free(matches);
+    free(source_ids);
+    free(source_table);
+    free(strings);
+    return ret;
+}
+
+// --- Lookup ---
+
+// Map an index file and check its layout. Returns 0, or -1 on error.
+int lpm_open(const char *path, LpmIndex *index) {
+    memset(index, 0, sizeof(*index));
+    if (map_file(path, &index->file) == -1) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Failed to open lookup index '%s'", path);
+        log_errno(error_buf);
+        return -1;
+    }
+    const LpmHeader *hdr = (const LpmHeader *)index->file.data;
+    int ok = index->file.size >= sizeof(LpmHeader) &&
+             memcmp(hdr->magic, LPM_MAGIC, sizeof(hdr->magic)) == 0 &&
+             hdr->version == LPM_VERSION &&
+             hdr->file_size == index->file.size &&
+             hdr->strings_offset + hdr->strings_size <= index->file.size &&
+             hdr->source_offset + (uint64_t)hdr->source_count * sizeof(LpmSource) <= hdr->strings_offset &&
+             hdr->source_id_offset + (uint64_t)hdr->source_id_count * sizeof(uint32_t) <= hdr->source_offset &&
+             hdr->match_offset + (uint64_t)hdr->match_count * sizeof(LpmMatch) <= hdr->source_id_offset &&
+             hdr->v6_offset + (uint64_t)hdr->v6_nodes * sizeof(struct LpmNode6) <= hdr->match_offset &&
+             hdr->tbl8_offset + (uint64_t)hdr->tbl8_groups * 256 * sizeof(uint32_t) <= hdr->v6_offset &&
+             hdr->v6_nodes > 0;
+    if (!ok) {
+        log_error("%s is not a valid lookup index\n", path);
+        unmap_file(&index->file);
+        return -1;
+    }
+    const char *base = index->file.data;
+    index->tbl24 = (const uint32_t *)(base + hdr->tbl24_offset);
+    index->tbl8 = (const uint32_t *)(base + hdr->tbl8_offset);
+    index->v6_nodes = (const struct LpmNode6 *)(base + hdr->v6_offset);
+    index->matches = base + hdr->match_offset;
+    index->source_ids = (const uint32_t *)(base + hdr->source_id_offset);
+    index->sources = base + hdr->source_offset;
+    index->strings = base + hdr->strings_offset;
+    index->match_count = hdr->match_count;
+    index->built_at = hdr->built_at;
+    return 0;
+}
+
+void lpm_close(LpmIndex *index) {
+    unmap_file(&index->file);
+}
+
+// Longest listed prefix containing addr (network byte order). Returns the match
+// index, or -1 if the address is not listed.
+long lpm_lookup(const LpmIndex *index, int family, const unsigned char *addr) {
+    if (family == AF_INET) {
+        uint32_t a = ((uint32_t)addr[0] << 24) | ((uint32_t)addr[1] << 16) | ((uint32_t)addr[2] << 8) | addr[3];
+        uint32_t entry = index->tbl24[a >> 8];
+        if (entry & TBL8_FLAG) entry = index->tbl8[(size_t)(entry & ~TBL8_FLAG) * 256 + (a & 0xFF)];
+        return (long)entry - 1;
+    }
+    uint32_t best = 0, n = 0;
+    for (;;) {
+        const struct LpmNode6 *node = &index->v6_nodes[n];
+        if (!key_matches(addr, node->key, node->len)) break;
+        if (node->match) best = node->match;
+        if (node->len == 128) break;
+        n = node->child[addr_bit(addr, node->len)];
+        if (!n) break;
+    }
+    return (long)best - 1;
+}
+
+// Whether a match is an allowed prefix (allowed addresses are not blocked)
+int lpm_match_allowed(const LpmIndex *index, long match) {
+    const LpmMatch *m = &((const LpmMatch *)index->matches)[match];
+    const LpmSource *sources = (const LpmSource *)index->sources;
+    for (uint32_t i = 0; i < m->source_count; i++) {
+        const LpmSource *source = &sources[index->source_ids[m->source_offset + i]];
+        if (strcmp(index->strings + source->type_offset, "allow") == 0) return 1;
+    }
+    return 0;
+}
+
+// Format a match as "prefix<TAB>type:name,type:name" into buf. Returns buf.
+const char *lpm_describe(const LpmIndex *index, long match, char *buf, size_t buf_len) {
+    const LpmMatch *m = &((const LpmMatch *)index->matches)[match];
+    const LpmSource *sources = (const LpmSource *)index->sources;
+    Prefix prefix;
+    memcpy(prefix.addr, m->addr, sizeof(prefix.addr));
+    prefix.len = m->len;
+    prefix.family = m->family;
+    char text[PREFIX_STRLEN];
+    size_t pos = (size_t)snprintf(buf, buf_len, "%s\t", format_prefix(&prefix, text, sizeof(text)));
+    for (uint32_t i = 0; i < m->source_count && pos < buf_len; i++) {
+        const LpmSource *source = &sources[index->source_ids[m->source_offset + i]];
+        pos += (size_t)snprintf(buf + pos, buf_len - pos, "%s%s:%s", i ? "," : "",
+                                index->strings + source->type_offset, index->strings + source->name_offset);
+    }
+    return buf;
+}
+
+// --- Bulk lookup (--lookup) ---
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} OutBuf;
+
+static void out_append(OutBuf *out, const char *text, size_t len) {
+    if (out->len + len > out->capacity) {
+        size_t new_capacity = out->capacity ? out->capacity * 2 : 65536;
+        while (new_capacity < out->len + len) new_capacity *= 2;
+        char *new_data = (char*)realloc(out->data, new_capacity);
+        if (!new_data) {
+            log_errno("Failed to allocate memory for lookup output");
+            exit(EXIT_FAILURE);
+        }
+        out->data = new_data;
+        out->capacity = new_capacity;
+    }
+    memcpy(out->data + out->len, text, len);
+    out->len += len;
+}
+
+typedef struct {
+    const LpmIndex *index;
+    const char *start;      // Whole lines
+    const char *end;
+    OutBuf out;
+    size_t lookups;
+    size_t blocked;
+    size_t invalid;
+} LookupSlice;
+
+// Classify one address (the first field of a log line) and append the result line
+static void classify(LookupSlice *slice, const char *text, size_t len) {
+    char addr_text[INET6_ADDRSTRLEN + 2], line[1024];
+    unsigned char addr[16];
+    size_t out_len;
+    // Accept "[v6addr]" as written in some log formats
+    const char *a = text;
+    size_t a_len = len;
+    if (a_len >= 2 && a[0] == '[' && a[a_len - 1] == ']') {
+        a++;
+        a_len -= 2;
+    }
+    int family = memchr(a, ':', a_len) ? AF_INET6 : AF_INET;
+    int ok = a_len < sizeof(addr_text);
+    if (ok) {
+        memcpy(addr_text, a, a_len);
+        addr_text[a_len] = '\0';
+        ok = inet_pton(family, addr_text, addr) == 1;
+    }
+    slice->lookups++;
+    if (!ok) {
+        slice->invalid++;
+        out_len = (size_t)snprintf(line, sizeof(line), "%.*s\tinvalid\t-\n", (int)(len > 256 ? 256 : len), text);
+    } else {
+        long match = lpm_lookup(slice->index, family, addr);
+        if (match < 0) {
+            out_len = (size_t)snprintf(line, sizeof(line), "%s\t-\t-\n", addr_text);
+        } else {
+            char desc[900];
+            if (!lpm_match_allowed(slice->index, match)) slice->blocked++;
+            out_len = (size_t)snprintf(line, sizeof(line), "%s\t%s\n", addr_text,
+                                       lpm_describe(slice->index, match, desc, sizeof(desc)));
+        }
+    }
+    out_append(&slice->out, line, out_len < sizeof(line) ? out_len : sizeof(line) - 1);
+}
+
+static void *lookup_worker(void *arg) {
+    LookupSlice *slice = (LookupSlice *)arg;
+    const char *p = slice->start;
+    while (p < slice->end) {
+        const char *line_end = (const char *)memchr(p, '\n', slice->end - p);
+        if (!line_end) line_end = slice->end;
+        while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+        const char *field = p;
+        while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        if (p > field) classify(slice, field, p - field);
+        p = line_end + 1;
+    }
+    return NULL;
+}
+
+// Classify the lines in buf[0, len) on up to `threads` threads and write the
+// results to stdout in input order
+static void lookup_chunk(const LpmIndex *index, const char *buf, size_t len, int threads, LookupSlice *totals) {
+    LookupSlice slices[MAX_LOOKUP_THREADS];
+    pthread_t ids[MAX_LOOKUP_THREADS];
+    int started[MAX_LOOKUP_THREADS];
+    if (len < 65536) threads = 1; // Not worth the threads
+    const char *p = buf, *end = buf + len;
+    for (int t = 0; t < threads; t++) {
+        memset(&slices[t], 0, sizeof(slices[t]));
+        slices[t].index = index;
+        slices[t].start = p;
+        const char *slice_end = t == threads - 1 ? end : buf + len / threads * (t + 1);
+        if (slice_end < p) slice_end = p;
+        const char *nl = slice_end < end ? (const char *)memchr(slice_end, '\n', end - slice_end) : NULL;
+        slices[t].end = nl ? nl + 1 : end;
+        p = slices[t].end;
+        started[t] = t > 0 && pthread_create(&ids[t], NULL, lookup_worker, &slices[t]) == 0;
+    }
+    lookup_worker(&slices[0]);
+    for (int t = 0; t < threads; t++) {
+        if (t > 0 && started[t]) {
+            pthread_join(ids[t], NULL);
+        } else if (t > 0) {
+            lookup_worker(&slices[t]); // Thread could not be started
+        }
+        fwrite(slices[t].out.data ? slices[t].out.data : "", 1, slices[t].out.len, stdout);
+        totals->lookups += slices[t].lookups;
+        totals->blocked += slices[t].blocked;
+        totals->invalid += slices[t].invalid;
+        free(slices[t].out.data);
+    }
+}
+
+// --lookup: classify the addresses given as arguments, or the first field of
+// every line on stdin if there are none. Prints one line per address:
+// "address<TAB>prefix<TAB>sources", with "-" for addresses that are not listed
+// and the allow entry for allowed ones.
+// Returns the exit code.
+int run_lookup(const char *index_file, char **addrs, int count) {
+    LpmIndex index;
+    if (lpm_open(index_file, &index) == -1) return 1;
+    time_t built_at = (time_t)index.built_at;
+    char when[64];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&built_at));
+    log_info("Index %s: %u prefixes, built %s\n", index_file, index.match_count, when);
+
+    LookupSlice totals;
+    memset(&totals, 0, sizeof(totals));
+    double start = stats_now();
+    int threads = 1;
+    if (count > 0) {
+        for (int i = 0; i < count; i++) {
+            lookup_chunk(&index, addrs[i], strlen(addrs[i]), 1, &totals);
+        }
+    } else {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 1 ? 1 : cpus > MAX_LOOKUP_THREADS ? MAX_LOOKUP_THREADS : (int)cpus;
+        char *buf = (char*)malloc(LOOKUP_CHUNK);
+        if (!buf) {
+            log_errno("Failed to allocate memory for lookup input");
+            exit(EXIT_FAILURE);
+        }
+        size_t len = 0;
+        for (;;) {
+            ssize_t n = read(STDIN_FILENO, buf + len, LOOKUP_CHUNK - len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                log_errno("Failed to read addresses from stdin");
+                break;
+            }
+            len += (size_t)n;
+            if (n == 0 || len == LOOKUP_CHUNK) {
+                // Process whole lines, keep a partial last line for the next round
+                const char *last_nl = NULL;
+                for (size_t i = len; i > 0 && !last_nl; i--) {
+                    if (buf[i - 1] == '\n') last_nl = buf + i - 1;
+                }
+                size_t done = n == 0 || !last_nl ? len : (size_t)(last_nl - buf) + 1;
+                lookup_chunk(&index, buf, done, threads, &totals);
+                memmove(buf, buf + done, len - done);
+                len -= done;
+            }
+            if (n == 0) break;
+        }
+        free(buf);
+    }
+    fflush(stdout);
+    double seconds = stats_now() - start;
+    log_info("%zu addresses (%zu listed, %zu invalid) in %.3f s, %.0f lookups/s on %d threads\n",
+             totals.lookups, totals.blocked, totals.invalid, seconds,
+             seconds > 0 ? totals.lookups / seconds : 0.0, threads);
+    lpm_close(&index);
+    return 0;
+}
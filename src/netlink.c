@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>       // For AF_INET/AF_INET6
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/fib_rules.h>
+#include <linux/if_link.h>    // For IFLA_XDP
+
+#include "ipban.h"
+
+#define NL_SEND_BUF_SIZE (128 * 1024)      // Must stay below the socket send buffer
+#define NL_RECV_BUF_SIZE (64 * 1024)
+#define NL_RCVBUF_WANTED (8 * 1024 * 1024) // Room for error ACKs of a whole batch
+#define NL_ACK_COST 1024                   // Approximate receive buffer cost of one ACK
+#define NL_ACK_TIMEOUT_MS 10000            // The kernel handles a batch within sendto(), so ACKs are queued by then
+#define NL_LOST_TIMEOUT_MS 200             // After an overflow, the barrier ACK may have been dropped too
+#define NL_ROUTE_MSG_MAX (NLMSG_SPACE(sizeof(struct rtmsg)) + RTA_SPACE(16) + RTA_SPACE(4))
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+// --- Socket setup ---
+
+// Open and bind a NETLINK_ROUTE socket
+int nl_open(NlSocket *nl) {
+    memset(nl, 0, sizeof(*nl));
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl->fd < 0) {
+        log_errno("Failed to open rtnetlink socket");
+        return -1;
+    }
+
+    // Keep ACKs small (no echoed request) - best effort, older kernels lack it
+    int one = 1;
+    setsockopt(nl->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+    // Let the kernel apply the table/protocol/type filters of route dumps (4.20+);
+    // older kernels send everything and the filters are applied here instead
+    setsockopt(nl->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+
+    // Large buffers let us pack thousands of requests per sendmsg(). The FORCE
+    // variants need CAP_NET_ADMIN, which we also have inside a user+net namespace.
+    int size = NL_RCVBUF_WANTED;
+    if (setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+        setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    size = 2 * NL_SEND_BUF_SIZE;
+    if (setsockopt(nl->fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) < 0) {
+        setsockopt(nl->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+    if (bind(nl->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_errno("Failed to bind rtnetlink socket");
+        close(nl->fd);
+        return -1;
+    }
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(nl->fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        log_errno("getsockname failed for rtnetlink socket");
+        close(nl->fd);
+        return -1;
+    }
+    nl->port_id = addr.nl_pid;
+
+    // Size batches so that error ACKs for a whole batch fit in the receive buffer
+    int rcvbuf = 0;
+    socklen_t opt_len = sizeof(rcvbuf);
+    getsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &opt_len);
+    nl->batch_msgs = (size_t)rcvbuf / NL_ACK_COST;
+    if (nl->batch_msgs < 64) nl->batch_msgs = 64;
+    if (nl->batch_msgs > NL_SEND_BUF_SIZE / NL_ROUTE_MSG_MAX) nl->batch_msgs = NL_SEND_BUF_SIZE / NL_ROUTE_MSG_MAX;
+
+    nl->send_buf = (char*)malloc(NL_SEND_BUF_SIZE);
+    nl->recv_buf = (char*)malloc(NL_RECV_BUF_SIZE);
+    if (!nl->send_buf || !nl->recv_buf) {
+        log_errno("Failed to allocate netlink buffers");
+        nl_close(nl);
+        return -1;
+    }
+    nl->seq = (uint32_t)time(NULL);
+    nl->table = RT_TABLE_MAIN;
+    nl->protocol = RTPROT_BOOT; // As `ip route add`
+    return 0;
+}
+
+// Close socket and free buffers
+void nl_close(NlSocket *nl) {
+    if (nl->fd >= 0) close(nl->fd);
+    free(nl->send_buf);
+    free(nl->recv_buf);
+    nl->fd = -1;
+    nl->send_buf = NULL;
+    nl->recv_buf = NULL;
+}
+
+// --- Route messages ---
+
+// Append an attribute to the message in buf
+static void add_attr(struct nlmsghdr *nlh, unsigned short type, const void *data, size_t len) {
+    struct rtattr *rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = (unsigned short)RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+// Append one RTM_NEWROUTE/RTM_DELROUTE request for a blackhole route to buf, returns its size.
+// Deletes carry the protocol too, so the kernel only removes a route we added.
+static size_t build_route_msg(char *buf, int cmd, const Prefix *prefix, uint32_t table, unsigned char protocol,
+                              uint32_t seq) {
+    size_t addr_len = prefix->family == AF_INET ? 4 : 16;
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    memset(buf, 0, NL_ROUTE_MSG_MAX);
+
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    nlh->nlmsg_type = (uint16_t)cmd;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    if (cmd == RTM_NEWROUTE) nlh->nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL; // Same as `ip route add`
+    nlh->nlmsg_seq = seq;
+
+    struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+    rtm->rtm_family = prefix->family;
+    rtm->rtm_dst_len = prefix->len;
+    rtm->rtm_table = table < 256 ? (unsigned char)table : RT_TABLE_UNSPEC; // Large ids only fit RTA_TABLE
+    rtm->rtm_protocol = protocol;
+    rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+    rtm->rtm_type = RTN_BLACKHOLE;
+
+    add_attr(nlh, RTA_DST, prefix->addr, addr_len);
+    if (table >= 256) add_attr(nlh, RTA_TABLE, &table, sizeof(table));
+
+    return NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+// Record the outcome of one request. Only the first failure recorded in result
+// (so once per operation, whatever the number of batches) is logged as an error,
+// the others at debug level; the caller prints the counts.
+static void record_error(int cmd, const Prefix *prefix, int error, NlResult *result) {
+    char text[PREFIX_STRLEN];
+    if (cmd == RTM_DELROUTE && error == ESRCH) {
+        result->absent++; // Route didn't exist, nothing to delete
+        return;
+    }
+    if (cmd == RTM_NEWROUTE && error == EEXIST) {
+        result->exists++;
+    } else {
+        result->failed++;
+    }
+    if (result->failed == 1 && error != EEXIST) {
+        log_error("Failed to %s blackhole route %s: %s\n",
+                  cmd == RTM_NEWROUTE ? "add" : "delete",
+                  format_prefix(prefix, text, sizeof(text)), strerror(error));
+    } else if (log_enabled(LOG_LEVEL_DEBUG)) {
+        log_debug("Failed to %s blackhole route %s: %s\n",
+                  cmd == RTM_NEWROUTE ? "add" : "delete",
+                  format_prefix(prefix, text, sizeof(text)), strerror(error));
+    }
+}
+
+// Read ACKs until the ACK for barrier_seq arrives. Errors are mapped back to
+// prefixes[seq - base_seq]. Once the receive buffer overflowed, the barrier may
+// be among the dropped ACKs: reading stops when nothing more arrives, and the
+// caller has to find out the outcome by dumping. Returns 0 if every error of the
+// batch was seen, 1 if some may have been dropped, or -1 on socket failure or timeout.
+static int drain_acks(NlSocket *nl, int cmd, const Prefix *prefixes, size_t count,
+                      uint32_t base_seq, uint32_t barrier_seq, NlResult *result) {
+    int lost = 0;
+    for (;;) {
+        struct pollfd pfd = { .fd = nl->fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, result->acks_lost ? NL_LOST_TIMEOUT_MS : NL_ACK_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready == 0 && result->acks_lost) return 1;
+        if (ready <= 0) {
+            if (ready == 0) errno = ETIMEDOUT;
+            log_errno("Waiting for rtnetlink ACKs failed");
+            return -1;
+        }
+        ssize_t len = recv(nl->fd, nl->recv_buf, NL_RECV_BUF_SIZE, MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            if (errno == ENOBUFS) {
+                // Some ACKs were dropped; keep reading for the barrier
+                result->acks_lost = 1;
+                lost = 1;
+                continue;
+            }
+            log_errno("recv failed on rtnetlink socket");
+            return -1;
+        }
+
+        int remaining = (int)len;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)nl->recv_buf; NLMSG_OK(nlh, remaining);
+             nlh = NLMSG_NEXT(nlh, remaining)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR || nlh->nlmsg_pid != nl->port_id) continue;
+            const struct nlmsgerr *err = (const struct nlmsgerr *)NLMSG_DATA(nlh);
+            uint32_t idx = nlh->nlmsg_seq - base_seq;
+            if (idx < count && err->error != 0) {
+                record_error(cmd, &prefixes[idx], -err->error, result);
+            }
+            if (nlh->nlmsg_seq == barrier_seq) return lost;
+        }
+    }
+}
+
+// Program blackhole routes in batches. Only the last request of each batch asks
+// for an ACK; the kernel still reports every failure, so successes cost nothing
+// on the receive side and the barrier ACK tells us the batch is complete.
+int nl_route_batch(NlSocket *nl, int cmd, const Prefix *prefixes, size_t count, NlResult *result) {
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    size_t i = 0;
+
+    while (i < count) {
+        size_t start = i;
+        size_t len = 0;
+        uint32_t base_seq = nl->seq;
+        struct nlmsghdr *last = NULL;
+
+        while (i < count && i - start < nl->batch_msgs) {
+            last = (struct nlmsghdr *)(nl->send_buf + len);
+            len += build_route_msg(nl->send_buf + len, cmd, &prefixes[i], nl->table, nl->protocol, base_seq + (uint32_t)(i - start));
+            i++;
+        }
+        last->nlmsg_flags |= NLM_F_ACK;
+        nl->seq += (uint32_t)(i - start);
+
+        ssize_t sent;
+        do {
+            sent = sendto(nl->fd, nl->send_buf, len, 0, (struct sockaddr *)&kernel, sizeof(kernel));
+        } while (sent < 0 && errno == EINTR);
+        if (sent < 0) {
+            log_errno("sendto failed on rtnetlink socket");
+            result->failed += count - start;
+            return -1;
+        }
+
+        size_t errors_before = result->failed + result->absent + result->exists;
+        int drained = drain_acks(nl, cmd, prefixes + start, i - start, base_seq, last->nlmsg_seq, result);
+        size_t batch_errors = result->failed + result->absent + result->exists - errors_before;
+        if (drained == -1) {
+            // Requests of this batch without an error reported are not known to be done
+            result->failed += (count - start) - batch_errors;
+            return -1;
+        }
+        // With ACKs dropped, errors may be missing too: the resync dump tells what was done
+        if (drained == 0) result->ok += (i - start) - batch_errors;
+    }
+    if (result->acks_lost) nl->acks_lost = 1;
+    return 0;
+}
+
+
+// --- Dumps ---
+
+// Called for each message of a dump; returns -1 to abort the dump
+typedef int (*NlMsgFn)(const struct nlmsghdr *nlh, void *ctx);
+
+// Route dump filter: only blackholes of one table, and of one protocol unless 0
+typedef struct {
+    uint32_t table;
+    unsigned char protocol;
+} RouteFilter;
+
+// Request a dump of type (RTM_GETROUTE/RTM_GETRULE) for family and pass every
+// reply message to fn. A route filter is passed on to the kernel, which only
+// honours it with strict checking; fn has to check the routes itself.
+// Returns 0, or -1 on error.
+static int nl_dump(NlSocket *nl, int type, int family, const RouteFilter *filter, NlMsgFn fn, void *ctx) {
+    struct {
+        struct nlmsghdr nlh;
+        struct rtmsg rtm;   // Same layout as fib_rule_hdr for the family field
+        char attrs[RTA_SPACE(4)];
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.nlh.nlmsg_type = (uint16_t)type;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = nl->seq++;
+    req.rtm.rtm_family = (unsigned char)family;
+    if (filter) {
+        req.rtm.rtm_table = filter->table < 256 ? (unsigned char)filter->table : RT_TABLE_UNSPEC;
+        req.rtm.rtm_protocol = filter->protocol;
+        req.rtm.rtm_type = RTN_BLACKHOLE;
+        if (filter->table >= 256) add_attr(&req.nlh, RTA_TABLE, &filter->table, sizeof(filter->table));
+    }
+
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if (sendto(nl->fd, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        log_errno("sendto failed for netlink dump");
+        return -1;
+    }
+
+    int ret = 0;
+    for (;;) {
+        ssize_t len = recv(nl->fd, nl->recv_buf, NL_RECV_BUF_SIZE, 0);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            log_errno("recv failed during netlink dump");
+            return -1;
+        }
+
+        int remaining = (int)len;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)nl->recv_buf; NLMSG_OK(nlh, remaining);
+             nlh = NLMSG_NEXT(nlh, remaining)) {
+            if (nlh->nlmsg_seq != req.nlh.nlmsg_seq || nlh->nlmsg_pid != nl->port_id) continue;
+            if (nlh->nlmsg_type == NLMSG_DONE) return ret;
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = (const struct nlmsgerr *)NLMSG_DATA(nlh);
+                // A filtered IPv4 dump of a table that does not exist yet
+                if (filter && err->error == -ENOENT) return ret;
+                log_error("Netlink dump failed: %s\n", strerror(-err->error));
+                return -1;
+            }
+            // Keep reading after an abort so the rest of the dump does not
+            // end up in the replies to later requests
+            if (ret == 0 && fn(nlh, ctx) == -1) ret = -1;
+        }
+    }
+}
+
+// Extract a blackhole route of the given table from an RTM_NEWROUTE dump entry.
+// Returns 1 if it is one, with the protocol that installed it in *protocol.
+static int parse_blackhole(const struct nlmsghdr *nlh, int family, uint32_t want_table, Prefix *out, int *protocol) {
+    const struct rtmsg *rtm = (const struct rtmsg *)NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_family != family) return 0;
+    if (rtm->rtm_type != RTN_BLACKHOLE || (rtm->rtm_flags & RTM_F_CLONED)) return 0;
+
+    uint32_t table = rtm->rtm_table;
+    size_t addr_len = family == AF_INET ? 4 : 16;
+    memset(out, 0, sizeof(*out));
+    out->family = (unsigned char)family;
+    out->len = rtm->rtm_dst_len;
+    *protocol = rtm->rtm_protocol;
+
+    int attr_len = (int)RTM_PAYLOAD(nlh);
+    for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, attr_len); rta = RTA_NEXT(rta, attr_len)) {
+        if (rta->rta_type == RTA_TABLE && RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+            memcpy(&table, RTA_DATA(rta), sizeof(uint32_t));
+        } else if (rta->rta_type == RTA_DST && RTA_PAYLOAD(rta) >= addr_len) {
+            memcpy(out->addr, RTA_DATA(rta), addr_len);
+        }
+    }
+    return table == want_table;
+}
+
+typedef struct {
+    int family;
+    RouteFilter filter;
+    NlRouteFn fn;
+    void *ctx;
+} BlackholeWalk;
+
+static int walk_route_msg(const struct nlmsghdr *nlh, void *ctx) {
+    BlackholeWalk *walk = (BlackholeWalk *)ctx;
+    Prefix prefix;
+    int protocol;
+    if (parse_blackhole(nlh, walk->family, walk->filter.table, &prefix, &protocol) &&
+        (!walk->filter.protocol || protocol == walk->filter.protocol)) {
+        walk->fn(&prefix, protocol, walk->ctx);
+    }
+    return 0;
+}
+
+// Dump the blackhole routes of one table (and protocol, unless 0) and pass each to fn
+static int walk_blackholes(NlSocket *nl, int family, unsigned char protocol, NlRouteFn fn, void *ctx) {
+    BlackholeWalk walk = { family, { nl->table, protocol }, fn, ctx };
+    return nl_dump(nl, RTM_GETROUTE, family, &walk.filter, walk_route_msg, &walk);
+}
+
+// Dump the routing tables once and pass each blackhole route of nl->table to fn
+int nl_walk_blackholes(NlSocket *nl, int family, NlRouteFn fn, void *ctx) {
+    return walk_blackholes(nl, family, 0, fn, ctx);
+}
+
+static void collect_blackhole(const Prefix *prefix, int protocol, void *ctx) {
+    (void)protocol;
+    prefix_list_push((PrefixList *)ctx, prefix);
+}
+
+// Collect our blackhole routes of nl->table; with strict checking the kernel
+// skips all other routes, however many the table holds
+int nl_dump_blackholes(NlSocket *nl, int family, PrefixList *out) {
+    return walk_blackholes(nl, family, nl->protocol, collect_blackhole, out);
+}
+
+
+// --- Policy rules ---
+
+// Send a single request and wait for its ACK. Returns 0, or the errno reported
+// by the kernel (-1 if the socket failed).
+static int nl_transact(NlSocket *nl, struct nlmsghdr *nlh) {
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    nlh->nlmsg_seq = nl->seq++;
+    ssize_t sent;
+    do {
+        sent = sendto(nl->fd, nlh, nlh->nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel));
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        log_errno("sendto failed on rtnetlink socket");
+        return -1;
+    }
+    for (;;) {
+        ssize_t len = recv(nl->fd, nl->recv_buf, NL_RECV_BUF_SIZE, 0);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            log_errno("recv failed on rtnetlink socket");
+            return -1;
+        }
+        int remaining = (int)len;
+        for (struct nlmsghdr *reply = (struct nlmsghdr *)nl->recv_buf; NLMSG_OK(reply, remaining);
+             reply = NLMSG_NEXT(reply, remaining)) {
+            if (reply->nlmsg_type != NLMSG_ERROR || reply->nlmsg_seq != nlh->nlmsg_seq ||
+                reply->nlmsg_pid != nl->port_id) {
+                continue;
+            }
+            return -((const struct nlmsgerr *)NLMSG_DATA(reply))->error;
+        }
+    }
+}
+
+// Add (RTM_NEWRULE) or delete (RTM_DELRULE) the rule "priority P lookup T" for
+// family. Adding an existing rule or deleting a missing one is not an error.
+// Returns 0 or -1.
+int nl_rule(NlSocket *nl, int cmd, int family, uint32_t priority, uint32_t table) {
+    char buf[NLMSG_SPACE(sizeof(struct fib_rule_hdr)) + 2 * RTA_SPACE(4)];
+    memset(buf, 0, sizeof(buf));
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct fib_rule_hdr));
+    nlh->nlmsg_type = (uint16_t)cmd;
+    if (cmd == RTM_NEWRULE) nlh->nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+
+    struct fib_rule_hdr *frh = (struct fib_rule_hdr *)NLMSG_DATA(nlh);
+    frh->family = (unsigned char)family;
+    frh->table = table < 256 ? (unsigned char)table : RT_TABLE_UNSPEC;
+    frh->action = FR_ACT_TO_TBL;
+    add_attr(nlh, FRA_PRIORITY, &priority, sizeof(priority));
+    add_attr(nlh, FRA_TABLE, &table, sizeof(table));
+
+    int error = nl_transact(nl, nlh);
+    if (error == 0 || (cmd == RTM_NEWRULE && error == EEXIST) || (cmd == RTM_DELRULE && error == ENOENT)) return 0;
+    if (error > 0) {
+        log_error("Failed to %s rule 'priority %u lookup %u' (%s): %s\n",
+                  cmd == RTM_NEWRULE ? "add" : "delete", priority, table,
+                  family == AF_INET ? "IPv4" : "IPv6", strerror(error));
+    }
+    return -1;
+}
+
+typedef struct {
+    uint32_t priority;
+    uint32_t *tables;
+    int max;
+    int count;
+} RuleQuery;
+
+static int find_rule_msg(const struct nlmsghdr *nlh, void *ctx) {
+    RuleQuery *query = (RuleQuery *)ctx;
+    if (nlh->nlmsg_type != RTM_NEWRULE) return 0;
+    const struct fib_rule_hdr *frh = (const struct fib_rule_hdr *)NLMSG_DATA(nlh);
+    if (frh->action != FR_ACT_TO_TBL) return 0;
+    uint32_t priority = 0, table = frh->table;
+    int attr_len = (int)(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*frh)));
+    for (const struct rtattr *rta = (const struct rtattr *)((const char *)frh + NLMSG_ALIGN(sizeof(*frh)));
+         RTA_OK(rta, attr_len); rta = RTA_NEXT(rta, attr_len)) {
+        if (rta->rta_type == FRA_PRIORITY && RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+            memcpy(&priority, RTA_DATA(rta), sizeof(uint32_t));
+        } else if (rta->rta_type == FRA_TABLE && RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+            memcpy(&table, RTA_DATA(rta), sizeof(uint32_t));
+        }
+    }
+    if (priority == query->priority && query->count < query->max) query->tables[query->count++] = table;
+    return 0;
+}
+
+// Store the tables looked up by the rules of family at priority in tables (at
+// most max). Returns the number of such rules, or -1 on error.
+int nl_rule_tables(NlSocket *nl, int family, uint32_t priority, uint32_t *tables, int max) {
+    RuleQuery query = { priority, tables, max, 0 };
+    if (nl_dump(nl, RTM_GETRULE, family, NULL, find_rule_msg, &query) == -1) return -1;
+    return query.count;
+}
+
+// --- XDP attachment ---
+
+int nl_xdp_attach(NlSocket *nl, int ifindex, int prog_fd, uint32_t flags) {
+    char buf[NLMSG_SPACE(sizeof(struct ifinfomsg)) + RTA_SPACE(2 * RTA_SPACE(4))];
+    memset(buf, 0, sizeof(buf));
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    nlh->nlmsg_type = RTM_SETLINK;
+
+    struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    // IFLA_XDP is nested: the program fd and the attach mode flags
+    struct rtattr *nest = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    nest->rta_type = IFLA_XDP | NLA_F_NESTED;
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_LENGTH(0);
+    int32_t fd = prog_fd;
+    add_attr(nlh, IFLA_XDP_FD, &fd, sizeof(fd));
+    if (flags) add_attr(nlh, IFLA_XDP_FLAGS, &flags, sizeof(flags));
+    nest->rta_len = (unsigned short)((char *)nlh + nlh->nlmsg_len - (char *)nest);
+
+    int error = nl_transact(nl, nlh);
+    if (error == 0) return 0;
+    if (error > 0) {
+        log_error("Failed to %s the XDP program on interface %d: %s\n",
+                  prog_fd >= 0 ? "attach" : "detach", ifindex, strerror(error));
+    }
+    return -1;
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE // For setns()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ipban.h"
+
+#define NETNS_RUN_DIR "/run/netns" // Where "ip netns add" mounts named namespaces
+
+// --- Network namespaces ---
+//
+// The block set is computed once and programmed into every configured namespace
+// as well as the one ipban runs in. A netlink socket stays bound to the network
+// namespace it was created in, so each target gets its own route backend opened
+// after a setns() into the namespace (and back), and can then be used from any
+// thread. The namespaces are programmed concurrently by a small worker pool.
+
+typedef struct {
+    NetnsSet *set;
+    const PrefixList **desired;
+    const PrefixDelta *delta;
+    int next;
+    pthread_mutex_t lock;
+} NetnsQueue;
+
+void init_netns_set(NetnsSet *set) {
+    set->targets = NULL;
+    set->count = 0;
+    set->capacity = 0;
+}
+
+// Path of a configured name: paths are used as they are, names live in /run/netns
+static void netns_path(const char *name, char *buf, size_t buf_len) {
+    if (strchr(name, '/')) {
+        snprintf(buf, buf_len, "%s", name);
+    } else {
+        snprintf(buf, buf_len, "%s/%s", NETNS_RUN_DIR, name);
+    }
+}
+
+// Expand the configured names into unique paths ("*" = every entry of /run/netns)
+static void expand_names(const StringArray *names, StringArray *paths) {
+    char path[4096];
+    for (int i = 0; i < names->count; i++) {
+        if (strcmp(names->items[i], "*") != 0) {
+            netns_path(names->items[i], path, sizeof(path));
+            add_string(paths, path);
+            continue;
+        }
+        DIR *dir = opendir(NETNS_RUN_DIR);
+        if (!dir) continue; // No named namespaces
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            netns_path(entry->d_name, path, sizeof(path));
+            add_string(paths, path);
+        }
+        closedir(dir);
+    }
+}
+
+// Open the route backend of target inside its namespace. Returns 0 or -1.
+static int open_target(NetnsTarget *target, const Settings *settings) {
+    int ns_fd = open(target->name, O_RDONLY | O_CLOEXEC);
+    if (ns_fd < 0) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Cannot open network namespace %s", target->name);
+        log_errno(error_buf);
+        return -1;
+    }
+    int home_fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    if (home_fd < 0) {
+        log_errno("Cannot open the current network namespace");
+        close(ns_fd);
+        return -1;
+    }
+    int ret = -1;
+    if (setns(ns_fd, CLONE_NEWNET) == -1) {
+        char error_buf[4200];
+        snprintf(error_buf, sizeof(error_buf), "Cannot enter network namespace %s", target->name);
+        log_errno(error_buf);
+    } else {
+        ret = backend_open(&target->backend, settings);
+        // Everything else ipban does must happen in the original namespace
+        if (setns(home_fd, CLONE_NEWNET) == -1) {
+            log_errno("Cannot return to the original network namespace");
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(ns_fd);
+    close(home_fd);
+    if (ret == -1) return -1;
+    for (int f = 0; f < 2; f++) {
+        snprintf(target->backend.label[f], sizeof(target->backend.label[f]), "%s [netns %s]",
+                 f == 0 ? "IPv4" : "IPv6", target->name);
+    }
+    return 0;
+}
+
+static void close_target(NetnsTarget *target) {
+    backend_close(&target->backend);
+    stats_remove_source("netns", target->name);
+    free(target->name);
+}
+
+int netns_sync(NetnsSet *set, const StringArray *names, const Settings *settings) {
+    StringArray paths;
+    init_string_array(&paths, names->count + 4);
+    if (names->count > 0 && strcmp(settings->backend, "route") != 0) {
+        log_warn("[namespaces] requires the route backend, namespaces ignored.\n");
+    } else {
+        expand_names(names, &paths);
+    }
+
+    // Close namespaces that are no longer configured
+    for (int i = 0; i < set->count; ) {
+        int still_listed = 0;
+        for (int j = 0; j < paths.count && !still_listed; j++) {
+            still_listed = strcmp(paths.items[j], set->targets[i].name) == 0;
+        }
+        if (still_listed) {
+            i++;
+            continue;
+        }
+        log_info("Network namespace %s removed from config.\n", set->targets[i].name);
+        close_target(&set->targets[i]);
+        set->targets[i] = set->targets[--set->count];
+    }
+
+    int failed = 0;
+    for (int j = 0; j < paths.count; j++) {
+        int known = 0;
+        for (int i = 0; i < set->count && !known; i++) known = strcmp(set->targets[i].name, paths.items[j]) == 0;
+        if (known) continue;
+        if (set->count == set->capacity) {
+            int new_capacity = set->capacity ? set->capacity * 2 : 8;
+            NetnsTarget *new_targets = (NetnsTarget*)realloc(set->targets, new_capacity * sizeof(NetnsTarget));
+            if (!new_targets) {
+                log_errno("Failed to allocate memory for network namespaces");
+                exit(EXIT_FAILURE);
+            }
+            set->targets = new_targets;
+            set->capacity = new_capacity;
+        }
+        NetnsTarget *target = &set->targets[set->count];
+        memset(target, 0, sizeof(*target));
+        target->name = strdup(paths.items[j]);
+        if (!target->name) {
+            log_errno("Failed to allocate memory for namespace name");
+            exit(EXIT_FAILURE);
+        }
+        if (open_target(target, settings) == -1) {
+            log_warn("Skipping network namespace %s.\n", target->name);
+            stats_source("netns", target->name, 0, 0, 0, 0, 1);
+            free(target->name);
+            failed++;
+            continue;
+        }
+        set->count++;
+    }
+    free_string_array(&paths);
+    return failed;
+}
+
+static void apply_target(NetnsTarget *target, const PrefixList *desired[2], const PrefixDelta *delta) {
+    double start = stats_now();
+    int ret = target->backend.apply(&target->backend, desired, target->synced ? delta : NULL);
+    target->seconds = stats_now() - start;
+    target->failed = ret == -1;
+    target->synced = ret == 0;
+}
+
+static void *netns_worker(void *arg) {
+    NetnsQueue *queue = (NetnsQueue *)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int idx = queue->next < queue->set->count ? queue->next++ : queue->set->count;
+        pthread_mutex_unlock(&queue->lock);
+        if (idx == queue->set->count) return NULL;
+        apply_target(&queue->set->targets[idx], queue->desired, queue->delta);
+    }
+}
+
+int netns_apply(NetnsSet *set, const PrefixList *desired[2], const PrefixDelta *delta, int jobs) {
+    if (set->count == 0) return 0;
+    NetnsQueue queue = { set, desired, delta, 0, PTHREAD_MUTEX_INITIALIZER };
+    if (jobs < 1) jobs = 1;
+    if (jobs > set->count) jobs = set->count;
+    pthread_t *threads = (pthread_t*)malloc(jobs * sizeof(pthread_t));
+    if (!threads) {
+        log_errno("Failed to allocate memory for namespace threads");
+        exit(EXIT_FAILURE);
+    }
+    log_info("\n--- Applying Block Set to %d network namespaces (%d at once) ---\n", set->count, jobs);
+    double start = stats_now();
+    int started = 0;
+    for (int t = 0; t < jobs; t++) {
+        if (pthread_create(&threads[t], NULL, netns_worker, &queue) != 0) {
+            log_errno("pthread_create failed for namespace worker");
+            break;
+        }
+        started++;
+    }
+    if (started == 0) netns_worker(&queue); // Fall back to applying in this thread
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    stats_phase("apply_netns", start, (uint64_t)set->count * (desired[0]->count + desired[1]->count));
+
+    int failed = 0;
+    for (int i = 0; i < set->count; i++) {
+        NetnsTarget *target = &set->targets[i];
+        log_info("  %s: %s (%.2f s)\n", target->name, target->failed ? "FAILED" : "ok", target->seconds);
+        stats_source("netns", target->name, desired[0]->count, desired[1]->count, target->seconds, 0, target->failed);
+        if (target->failed) failed++;
+    }
+    log_info("Namespaces: %d in sync, %d failed\n", set->count - failed, failed);
+    return failed;
+}
+
+void free_netns_set(NetnsSet *set) {
+    for (int i = 0; i < set->count; i++) {
+        backend_close(&set->targets[i].backend);
+        free(set->targets[i].name);
+    }
+    free(set->targets);
+    set->targets = NULL;
+    set->count = set->capacity = 0;
+}
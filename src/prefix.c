@@ -0,0 +1,611 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>  // For INET6_ADDRSTRLEN
+#include <arpa/inet.h>   // For inet_pton and inet_ntop
+
+#include "ipban.h"
+
+// --- Prefix parsing and formatting ---
+
+// Lenient dotted-quad parser: octets are always decimal, so "10.0.0.00" is
+// accepted as 10.0.0.0 where inet_pton() would reject the leading zero
+static int parse_ipv4_decimal(const char *text, unsigned char *out) {
+    for (int i = 0; i < 4; i++) {
+        int value = 0, digits = 0;
+        while (*text >= '0' && *text <= '9') {
+            value = value * 10 + (*text++ - '0');
+            if (++digits > 3 || value > 255) return 0;
+        }
+        if (digits == 0) return 0;
+        out[i] = (unsigned char)value;
+        if (i < 3 && *text++ != '.') return 0;
+    }
+    return *text == '\0';
+}
+
+// Parse "addr/len" into a binary prefix, clearing any host bits
+int parse_prefix(const char *text, int family, Prefix *out) {
+    char addr_buf[INET6_ADDRSTRLEN];
+    const char *slash = strchr(text, '/');
+    if (!slash || (size_t)(slash - text) >= sizeof(addr_buf)) return -1;
+
+    memcpy(addr_buf, text, slash - text);
+    addr_buf[slash - text] = '\0';
+
+    char *endptr;
+    long len = strtol(slash + 1, &endptr, 10);
+    int max_len = family == AF_INET ? 32 : 128;
+    if (endptr == slash + 1 || *endptr != '\0' || len < 0 || len > max_len) return -1;
+
+    memset(out, 0, sizeof(*out));
+    if (inet_pton(family, addr_buf, out->addr) != 1) {
+        if (family != AF_INET || !parse_ipv4_decimal(addr_buf, out->addr)) return -1;
+    }
+    out->family = (unsigned char)family;
+    out->len = (unsigned char)len;
+
+    // Clear host bits so that equivalent spellings compare equal; the kernel
+    // also rejects IPv4 routes that have them set
+    for (int bit = (int)len; bit < max_len; bit++) {
+        out->addr[bit / 8] &= (unsigned char)~(0x80 >> (bit % 8));
+    }
+    return 0;
+}
+
+// One entry of a prefix file: up to a blank, ',' or a '#'/';' comment, a bare
+// address taken as a host prefix
+int parse_prefix_line(const char *line, const char *line_end, Prefix *out, const char **entry, size_t *entry_len) {
+    const char *p = line;
+    while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    const char *start = p;
+    while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#' && *p != ';' && *p != ',') p++;
+    size_t len = p - start;
+    *entry = start;
+    *entry_len = len;
+    if (len == 0) return 0; // Blank or comment line
+
+    char text[PREFIX_STRLEN];
+    int family = memchr(start, ':', len) ? AF_INET6 : AF_INET;
+    int has_len = memchr(start, '/', len) != NULL;
+    if (len + 5 > sizeof(text)) return -1;
+    memcpy(text, start, len);
+    snprintf(text + len, sizeof(text) - len, "%s", has_len ? "" : family == AF_INET ? "/32" : "/128");
+    return parse_prefix(text, family, out) == 0 ? 1 : -1;
+}
+
+// Format a binary prefix as "addr/len"
+const char *format_prefix(const Prefix *prefix, char *buf, size_t buf_len) {
+    char addr_buf[INET6_ADDRSTRLEN];
+    if (!inet_ntop(prefix->family, prefix->addr, addr_buf, sizeof(addr_buf))) {
+        snprintf(buf, buf_len, "?/%u", prefix->len);
+    } else {
+        snprintf(buf, buf_len, "%s/%u", addr_buf, prefix->len);
+    }
+    return buf;
+}
+
+// Order prefixes by family, address, then length
+int prefix_cmp(const void *a, const void *b) {
+    const Prefix *pa = (const Prefix *)a, *pb = (const Prefix *)b;
+    if (pa->family != pb->family) return pa->family < pb->family ? -1 : 1;
+    int c = memcmp(pa->addr, pb->addr, pa->family == AF_INET ? 4 : 16);
+    if (c != 0) return c;
+    return (int)pa->len - (int)pb->len;
+}
+
+
+// --- Dynamic array of binary prefixes ---
+
+// Initialize prefix list
+void init_prefix_list(PrefixList *list, size_t initial_capacity) {
+    if (initial_capacity == 0) initial_capacity = 16;
+    list->items = (Prefix*)malloc(initial_capacity * sizeof(Prefix));
+    if (!list->items) {
+        log_errno("Failed to allocate memory for prefix list");
+        exit(EXIT_FAILURE);
+    }
+    list->count = 0;
+    list->capacity = initial_capacity;
+}
+
+// Append prefix to list
+void prefix_list_push(PrefixList *list, const Prefix *prefix) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity * 2;
+        Prefix *new_items = (Prefix*)realloc(list->items, new_capacity * sizeof(Prefix));
+        if (!new_items) {
+            log_errno("Failed to reallocate memory for prefix list");
+            exit(EXIT_FAILURE);
+        }
+        list->items = new_items;
+        list->capacity = new_capacity;
+    }
+    list->items[list->count++] = *prefix;
+}
+
+// Sort list and drop duplicates
+void prefix_list_sort_unique(PrefixList *list) {
+    if (list->count < 2) return;
+    qsort(list->items, list->count, sizeof(Prefix), prefix_cmp);
+    size_t out = 1;
+    for (size_t i = 1; i < list->count; i++) {
+        if (prefix_cmp(&list->items[out - 1], &list->items[i]) != 0) {
+            list->items[out++] = list->items[i];
+        }
+    }
+    list->count = out;
+}
+
+// Free memory for PrefixList
+void free_prefix_list(PrefixList *list) {
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// Split two sorted, unique lists into what is only in `want` (to_add) and
+// only in `have` (to_remove). Linear merge, both outputs stay sorted.
+void diff_prefix_lists(const PrefixList *want, const PrefixList *have,
+                       PrefixList *to_add, PrefixList *to_remove) {
+    size_t i = 0, j = 0;
+    while (i < want->count || j < have->count) {
+        int c;
+        if (i == want->count) c = 1;
+        else if (j == have->count) c = -1;
+        else c = prefix_cmp(&want->items[i], &have->items[j]);
+
+        if (c < 0) {
+            prefix_list_push(to_add, &want->items[i++]);
+        } else if (c > 0) {
+            prefix_list_push(to_remove, &have->items[j++]);
+        } else {
+            i++;
+            j++;
+        }
+    }
+}
+
+
+// Index of the first item not ordered before prefix (count if none)
+static size_t prefix_list_lower_bound(const PrefixList *list, const Prefix *prefix) {
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (prefix_cmp(&list->items[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Index of prefix in a sorted, unique list, or -1
+long prefix_list_find(const PrefixList *list, const Prefix *prefix) {
+    size_t i = prefix_list_lower_bound(list, prefix);
+    return i < list->count && prefix_cmp(&list->items[i], prefix) == 0 ? (long)i : -1;
+}
+
+// Apply a delta to a sorted, unique list in place: remove, then add (both
+// sorted and unique). Removing first lets the list shrink before it grows;
+// the cost is one move of the items behind the first change.
+void prefix_list_update(PrefixList *list, const PrefixList *add, const PrefixList *remove) {
+    size_t out = 0, j = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        while (j < remove->count && prefix_cmp(&remove->items[j], &list->items[i]) < 0) j++;
+        if (j < remove->count && prefix_cmp(&remove->items[j], &list->items[i]) == 0) continue;
+        list->items[out++] = list->items[i];
+    }
+    list->count = out;
+    if (add->count == 0) return;
+
+    size_t total = list->count + add->count;
+    if (total > list->capacity) {
+        Prefix *items = (Prefix*)realloc(list->items, total * sizeof(Prefix));
+        if (!items) {
+            log_errno("Failed to reallocate memory for prefix list");
+            exit(EXIT_FAILURE);
+        }
+        list->items = items;
+        list->capacity = total;
+    }
+    // Merge from the back so nothing is overwritten before it is moved
+    size_t i = list->count, k = add->count, w = total;
+    while (k > 0) {
+        int c = i > 0 ? prefix_cmp(&list->items[i - 1], &add->items[k - 1]) : -1;
+        if (c > 0) {
+            list->items[--w] = list->items[--i];
+        } else {
+            if (c == 0) i--; // Already present: keep one copy
+            list->items[--w] = add->items[--k];
+        }
+    }
+    // Items already present leave a gap between the untouched head and the merged tail
+    if (w > i) {
+        memmove(list->items + i, list->items + w, (total - w) * sizeof(Prefix));
+        total -= w - i;
+    }
+    list->count = total;
+}
+
+
+// --- CIDR aggregation ---
+
+static int prefix_bit(const Prefix *prefix, int bit) {
+    return (prefix->addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+// Check whether outer covers inner (same family)
+static int prefix_covers(const Prefix *outer, const Prefix *inner) {
+    if (outer->len > inner->len) return 0;
+    int full_bytes = outer->len / 8;
+    if (memcmp(outer->addr, inner->addr, full_bytes) != 0) return 0;
+    int rest = outer->len % 8;
+    if (rest == 0) return 1;
+    unsigned char mask = (unsigned char)(0xFF << (8 - rest));
+    return (outer->addr[full_bytes] & mask) == (inner->addr[full_bytes] & mask);
+}
+
+// Check whether a and b are the two halves of the same parent (a being the lower one)
+static int prefix_siblings(const Prefix *a, const Prefix *b) {
+    if (a->len != b->len || a->len == 0) return 0;
+    int bit = a->len - 1;
+    if (prefix_bit(a, bit) != 0 || prefix_bit(b, bit) != 1) return 0;
+    Prefix parent = *b;
+    parent.addr[bit / 8] &= (unsigned char)~(0x80 >> (bit % 8));
+    return memcmp(parent.addr, a->addr, sizeof(parent.addr)) == 0;
+}
+
+// Whether a shorter prefix in the sorted, unique list covers prefix. Every
+// candidate is prefix cut to a shorter length, so it is one lookup per length.
+int prefix_list_covered(const PrefixList *list, const Prefix *prefix) {
+    Prefix outer = *prefix;
+    for (int len = prefix->len - 1; len >= 0; len--) {
+        outer.addr[len / 8] &= (unsigned char)~(0x80 >> (len % 8));
+        outer.len = (unsigned char)len;
+        if (prefix_list_find(list, &outer) >= 0) return 1;
+    }
+    return 0;
+}
+
+// Whether prefix covers a longer prefix in the sorted, unique list. Those sort
+// right behind prefix itself, so only the next item needs a look.
+int prefix_list_covers(const PrefixList *list, const Prefix *prefix) {
+    size_t i = prefix_list_lower_bound(list, prefix);
+    if (i < list->count && prefix_cmp(&list->items[i], prefix) == 0) i++;
+    return i < list->count && list->items[i].family == prefix->family &&
+           prefix_covers(prefix, &list->items[i]);
+}
+
+// Single pass over the sorted list, using the output as a stack: a prefix covered by
+// the top of the stack is dropped, and sibling pairs on top are folded into their
+// parent (which may cascade). Sorted input guarantees only the top can cover or pair.
+void aggregate_prefix_list(PrefixList *list) {
+    size_t top = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        Prefix current = list->items[i];
+        if (top > 0 && prefix_covers(&list->items[top - 1], &current)) continue;
+        list->items[top++] = current;
+        while (top >= 2 && prefix_siblings(&list->items[top - 2], &list->items[top - 1])) {
+            top--;
+            list->items[top - 1].len--;
+        }
+    }
+    list->count = top;
+}
+
+
+
+// --- Prefix subtraction ---
+
+// Binary trie of the allowed prefixes: one node per bit, node 0 is the root
+// (the whole address space). A terminal node stands for an allowed prefix;
+// nothing below it is stored, since it is allowed as a whole.
+
+static uint32_t trie_new_node(PrefixTrie *trie) {
+    if (trie->count == trie->capacity) {
+        size_t new_capacity = trie->capacity ? trie->capacity * 2 : 256;
+        PrefixTrieNode *nodes = (PrefixTrieNode*)realloc(trie->nodes, new_capacity * sizeof(PrefixTrieNode));
+        if (!nodes) {
+            log_errno("Failed to allocate memory for prefix trie");
+            exit(EXIT_FAILURE);
+        }
+        trie->nodes = nodes;
+        trie->capacity = new_capacity;
+    }
+    memset(&trie->nodes[trie->count], 0, sizeof(PrefixTrieNode));
+    return (uint32_t)trie->count++;
+}
+
+// Build the trie of a list of prefixes of one family (any order)
+void init_prefix_trie(PrefixTrie *trie, const PrefixList *prefixes) {
+    memset(trie, 0, sizeof(*trie));
+    trie_new_node(trie);
+    for (size_t i = 0; i < prefixes->count; i++) {
+        const Prefix *prefix = &prefixes->items[i];
+        uint32_t node = 0;
+        for (int bit = 0; bit < prefix->len && !trie->nodes[node].terminal; bit++) {
+            int b = prefix_bit(prefix, bit);
+            if (!trie->nodes[node].child[b]) {
+                uint32_t child = trie_new_node(trie);
+                trie->nodes[node].child[b] = child;
+            }
+            node = trie->nodes[node].child[b];
+        }
+        if (trie->nodes[node].terminal) continue; // Already covered
+        trie->nodes[node].terminal = 1;
+        trie->nodes[node].child[0] = trie->nodes[node].child[1] = 0; // Longer ones are covered now
+    }
+}
+
+void free_prefix_trie(PrefixTrie *trie) {
+    free(trie->nodes);
+    memset(trie, 0, sizeof(*trie));
+}
+
+#define TRIE_MISSING -1 // No allowed prefix overlaps
+#define TRIE_COVERED -2 // A shorter or equal allowed prefix covers it
+
+// Node for exactly prefix, TRIE_MISSING or TRIE_COVERED
+static long trie_find(const PrefixTrie *trie, const Prefix *prefix) {
+    uint32_t node = 0;
+    for (int bit = 0; bit < prefix->len; bit++) {
+        if (trie->nodes[node].terminal) return TRIE_COVERED;
+        node = trie->nodes[node].child[prefix_bit(prefix, bit)];
+        if (!node) return TRIE_MISSING;
+    }
+    return trie->nodes[node].terminal ? TRIE_COVERED : (long)node;
+}
+
+// Whether prefix and any prefix in the trie share an address
+int prefix_trie_overlaps(const PrefixTrie *trie, const Prefix *prefix) {
+    long node = trie_find(trie, prefix);
+    if (node == TRIE_COVERED) return 1;
+    if (node == TRIE_MISSING) return 0;
+    // Inner nodes only exist on the way to an allowed prefix; the root may be bare
+    return trie->nodes[node].child[0] || trie->nodes[node].child[1];
+}
+
+// Whether every address of prefix is in the trie
+int prefix_trie_covers(const PrefixTrie *trie, const Prefix *prefix) {
+    return trie_find(trie, prefix) == TRIE_COVERED;
+}
+
+// Append the parts of `prefix` (trie node `node`) that no allowed prefix covers,
+// in address order, as the fewest possible CIDRs: for every branch of the trie
+// that is missing, the whole half-prefix stays blocked.
+static void trie_complement(const PrefixTrie *trie, uint32_t node, Prefix prefix, PrefixList *out) {
+    const PrefixTrieNode *n = &trie->nodes[node];
+    if (n->terminal) return;
+    int bit = prefix.len;
+    prefix.len++;
+    for (int b = 0; b < 2; b++) {
+        Prefix half = prefix;
+        if (b) half.addr[bit / 8] |= (unsigned char)(0x80 >> (bit % 8));
+        if (n->child[b]) {
+            trie_complement(trie, n->child[b], half, out);
+        } else {
+            prefix_list_push(out, &half);
+        }
+    }
+}
+
+// Remove every address of the trie from list, splitting blocks that contain
+// allowed prefixes into the remaining CIDRs. The result is sorted and unique.
+// Returns the number of blocks that were dropped or split.
+size_t subtract_prefix_list(PrefixList *list, const PrefixTrie *allow) {
+    PrefixList out;
+    size_t touched = 0;
+    init_prefix_list(&out, list->count);
+    for (size_t i = 0; i < list->count; i++) {
+        const Prefix *prefix = &list->items[i];
+        if (!prefix_trie_overlaps(allow, prefix)) {
+            prefix_list_push(&out, prefix);
+            continue;
+        }
+        touched++;
+        long node = trie_find(allow, prefix);
+        if (node != TRIE_COVERED) trie_complement(allow, (uint32_t)node, *prefix, &out);
+    }
+    free_prefix_list(list);
+    *list = out;
+    // Pieces of a split block can land behind blocks nested in it (without aggregation)
+    if (touched > 0) prefix_list_sort_unique(list);
+    return touched;
+}
+
+// --- Route store: contiguous prefix arena with hashed dedup ---
+
+// Hash the address bytes and length (unused IPv4 bytes are always zero)
+uint32_t prefix_hash(const Prefix *prefix) {
+    uint64_t hi, lo;
+    memcpy(&hi, prefix->addr, 8);
+    memcpy(&lo, prefix->addr + 8, 8);
+    uint64_t h = (hi ^ (lo * 0x9E3779B97F4A7C15ULL) ^ prefix->len) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+// Rebuild the hash table with new_slots buckets (power of two)
+static void rehash_route_array(RouteArray *array, size_t new_slots) {
+    uint32_t *slots = (uint32_t*)calloc(new_slots, sizeof(uint32_t));
+    if (!slots) {
+        log_errno("Failed to allocate route hash table");
+        exit(EXIT_FAILURE);
+    }
+    size_t mask = new_slots - 1;
+    for (size_t i = 0; i < array->count; i++) {
+        size_t pos = prefix_hash(&array->routes[i]) & mask;
+        while (slots[pos]) pos = (pos + 1) & mask;
+        slots[pos] = (uint32_t)(i + 1);
+    }
+    free(array->slots);
+    array->slots = slots;
+    array->slot_mask = mask;
+}
+
+// Initialize route array
+void init_route_array(RouteArray *array, int family, size_t initial_capacity) {
+    if (initial_capacity == 0) initial_capacity = 16;
+    array->routes = (Prefix*)malloc(initial_capacity * sizeof(Prefix));
+    if (!array->routes) {
+        log_errno("Failed to allocate memory for route array");
+        exit(EXIT_FAILURE);
+    }
+    array->count = 0;
+    array->capacity = initial_capacity;
+    array->family = family;
+    array->slots = NULL;
+    size_t slots = 16;
+    while (slots < initial_capacity * 4 / 3 + 1) slots *= 2;
+    rehash_route_array(array, slots);
+}
+
+// Add binary prefix to array. Returns 1 if added, 0 if it was already present.
+int add_prefix(RouteArray *array, const Prefix *prefix) {
+    size_t pos = prefix_hash(prefix) & array->slot_mask;
+    while (array->slots[pos]) {
+        if (memcmp(&array->routes[array->slots[pos] - 1], prefix, sizeof(Prefix)) == 0) {
+            return 0; // Don't add duplicates
+        }
+        pos = (pos + 1) & array->slot_mask;
+    }
+
+    // Increase arena size if necessary
+    if (array->count >= array->capacity) {
+        size_t new_capacity = array->capacity * 2;
+        Prefix *new_routes = (Prefix*)realloc(array->routes, new_capacity * sizeof(Prefix));
+        if (!new_routes) {
+            log_errno("Failed to reallocate memory for route array");
+            exit(EXIT_FAILURE);
+        }
+        array->routes = new_routes;
+        array->capacity = new_capacity;
+    }
+
+    array->routes[array->count] = *prefix;
+    array->slots[pos] = (uint32_t)(++array->count);
+
+    // Keep the load factor below 3/4
+    if (array->count * 4 >= (array->slot_mask + 1) * 3) {
+        rehash_route_array(array, (array->slot_mask + 1) * 2);
+    }
+    return 1;
+}
+
+// Parse and add route text. Returns 1 if added, 0 if duplicate, -1 if invalid.
+int add_route(RouteArray *array, const char *route) {
+    Prefix prefix;
+    if (parse_prefix(route, array->family, &prefix) == -1) return -1;
+    return add_prefix(array, &prefix);
+}
+
+// Check whether prefix is in the array
+int route_array_contains(const RouteArray *array, const Prefix *prefix) {
+    size_t pos = prefix_hash(prefix) & array->slot_mask;
+    while (array->slots[pos]) {
+        if (memcmp(&array->routes[array->slots[pos] - 1], prefix, sizeof(Prefix)) == 0) return 1;
+        pos = (pos + 1) & array->slot_mask;
+    }
+    return 0;
+}
+
+// Copy all routes into a sorted prefix list
+void route_array_to_list(const RouteArray *array, PrefixList *out) {
+    for (size_t i = 0; i < array->count; i++) {
+        prefix_list_push(out, &array->routes[i]);
+    }
+    prefix_list_sort_unique(out);
+}
+
+// Free memory for RouteArray
+void free_route_array(RouteArray *array) {
+    free(array->routes);
+    free(array->slots);
+    array->routes = NULL;
+    array->slots = NULL;
+    array->count = 0;
+    array->capacity = 0;
+}
+
+
+// --- Reference-counted prefix set ---
+
+// Initialize multiset
+void init_prefix_multiset(PrefixMultiset *set) {
+    init_prefix_list(&set->list, 16);
+    set->refs = (uint32_t*)malloc(16 * sizeof(uint32_t));
+    if (!set->refs) {
+        log_errno("Failed to allocate memory for prefix multiset");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Add (delta = 1) or drop (delta = -1) one reference for every prefix in the
+// sorted, unique list `changes`, in place: prefixes already in the set are
+// looked up, and only new or dropped ones move the rest of the arrays, in a
+// single pass. A few changes to a large set (runtime bans) stay cheap.
+void prefix_multiset_update(PrefixMultiset *set, const PrefixList *changes, int delta) {
+    size_t inserted = 0, dropped = 0;
+    for (size_t j = 0; j < changes->count; j++) {
+        long i = prefix_list_find(&set->list, &changes->items[j]);
+        if (i < 0) {
+            if (delta > 0) inserted++; // Dropping a prefix that is not in the set is a no-op
+            continue;
+        }
+        set->refs[i] += (uint32_t)delta;
+        if (set->refs[i] == 0) dropped++;
+    }
+
+    if (dropped > 0) {
+        size_t out = 0;
+        for (size_t i = 0; i < set->list.count; i++) {
+            if (set->refs[i] == 0) continue;
+            set->refs[out] = set->refs[i];
+            set->list.items[out++] = set->list.items[i];
+        }
+        set->list.count = out;
+    }
+    if (inserted == 0) return;
+
+    size_t total = set->list.count + inserted;
+    if (total > set->list.capacity) {
+        size_t capacity = set->list.capacity * 2 > total ? set->list.capacity * 2 : total;
+        Prefix *items = (Prefix*)realloc(set->list.items, capacity * sizeof(Prefix));
+        uint32_t *refs = (uint32_t*)realloc(set->refs, capacity * sizeof(uint32_t));
+        if (!items || !refs) {
+            log_errno("Failed to allocate memory for prefix multiset");
+            exit(EXIT_FAILURE);
+        }
+        set->list.items = items;
+        set->list.capacity = capacity;
+        set->refs = refs;
+    }
+    // Merge the new prefixes in from the back; those already counted are skipped
+    size_t i = set->list.count, k = changes->count, w = total;
+    while (w > i) {
+        int c = i > 0 ? prefix_cmp(&set->list.items[i - 1], &changes->items[k - 1]) : -1;
+        if (c > 0) {
+            w--;
+            i--;
+            set->refs[w] = set->refs[i];
+            set->list.items[w] = set->list.items[i];
+        } else {
+            if (c < 0) {
+                w--;
+                set->refs[w] = 1;
+                set->list.items[w] = changes->items[k - 1];
+            }
+            k--;
+        }
+    }
+    set->list.count = total;
+}
+
+// Free memory for PrefixMultiset
+void free_prefix_multiset(PrefixMultiset *set) {
+    free_prefix_list(&set->list);
+    free(set->refs);
+    set->refs = NULL;
+}
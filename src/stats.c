@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ipban.h"
+
+// --- Run statistics ---
+//
+// Process-wide counters, gauges, phase timings and per-source prefix counts.
+// Counters may be bumped from fetch worker threads and are updated atomically,
+// phases may be recorded by namespace workers and take a lock, and sources are
+// only recorded from the main thread. Everything is written on demand as a
+// node_exporter textfile and/or a JSON document, each replaced atomically with
+// rename().
+
+#define MAX_PHASES 32
+
+typedef struct {
+    const char *name;       // Metric name without the ipban_ prefix
+    const char *help;
+    int counter;            // Counter (monotonic total) or gauge
+} StatInfo;
+
+static const StatInfo stat_info[STAT_COUNT] = {
+    [STAT_KERNEL_OPS]        = { "kernel_ops_total", "Add/delete operations sent to the enforcement backend", 1 },
+    [STAT_KERNEL_OPS_FAILED] = { "kernel_ops_failed_total", "Add/delete operations that failed", 1 },
+    [STAT_ROUTES_ADDED]      = { "prefixes_added_total", "Prefixes newly blocked", 1 },
+    [STAT_ROUTES_REMOVED]    = { "prefixes_removed_total", "Prefixes unblocked", 1 },
+    [STAT_FETCHES]           = { "asn_fetches_total", "bgpq4 runs (one per ASN and address family)", 1 },
+    [STAT_FETCHES_FAILED]    = { "asn_fetches_failed_total", "bgpq4 runs that failed", 1 },
+    [STAT_CACHE_HITS]        = { "cache_hits_total", "ASN lookups served from a fresh cache entry", 1 },
+    [STAT_CACHE_MISSES]      = { "cache_misses_total", "ASN lookups without a fresh cache entry", 1 },
+    [STAT_CACHE_STALE]       = { "cache_stale_used_total", "Failed fetches replaced by stale cached data", 1 },
+    [STAT_FEEDS_PARSED]      = { "feeds_parsed_total", "Feed files parsed", 1 },
+    [STAT_FEEDS_UNCHANGED]   = { "feeds_unchanged_total", "Feed checks that found the feed unchanged", 1 },
+    [STAT_FEEDS_FAILED]      = { "feeds_failed_total", "Feed files that could not be read", 1 },
+    [STAT_GEO_PARSED]        = { "geo_files_parsed_total", "Delegated-stats files parsed", 1 },
+    [STAT_GEO_UNCHANGED]     = { "geo_files_cached_total", "Delegated-stats files whose countries were all cached", 1 },
+    [STAT_GEO_FAILED]        = { "geo_files_failed_total", "Delegated-stats files that could not be read", 1 },
+    [STAT_BANS_ADDED]        = { "dynamic_bans_added_total", "Prefixes newly banned at runtime (control socket or log watch)", 1 },
+    [STAT_BANS_EXPIRED]      = { "dynamic_bans_expired_total", "Runtime bans that expired", 1 },
+    [STAT_LOG_BYTES]         = { "log_bytes_read_total", "Bytes read from watched log files", 1 },
+    [STAT_LOG_MATCHES]       = { "log_matches_total", "Watched log lines matching a pattern", 1 },
+    [STAT_LOG_BANS]          = { "log_bans_total", "Addresses newly banned for crossing log_threshold", 1 },
+    [STAT_PREFIXES_CONFIG]   = { "config_prefixes", "Prefixes listed directly in the config", 0 },
+    [STAT_PREFIXES_ASN]      = { "asn_prefixes", "Prefixes contributed by ASNs", 0 },
+    [STAT_PREFIXES_FEED]     = { "feed_prefixes", "Prefixes contributed by feeds", 0 },
+    [STAT_PREFIXES_GEO]      = { "geo_prefixes", "Prefixes contributed by [geo_block] countries", 0 },
+    [STAT_PREFIXES_DESIRED]  = { "desired_prefixes", "Prefixes in the block set after aggregation", 0 },
+    [STAT_PREFIXES_ALLOWED]  = { "allowed_prefixes", "Prefixes listed in the [allow] section", 0 },
+    [STAT_BLOCKS_CARVED]     = { "carved_prefixes", "Blocks dropped or split because they contain allowed prefixes", 0 },
+    [STAT_XDP_DROPPED]       = { "xdp_dropped_packets", "Packets dropped by the XDP program since its maps were created", 0 },
+    [STAT_BANS_ACTIVE]       = { "dynamic_bans", "Prefixes currently banned at runtime", 0 },
+};
+
+typedef struct {
+    char name[32];
+    double seconds;
+    uint64_t items;
+} PhaseStat;
+
+typedef struct {
+    char type[8];           // "asn", "feed", "geo" or "netns"
+    char *name;
+    uint64_t v4;
+    uint64_t v6;
+    double fetch_seconds;
+    int cached;
+    int failed;
+} SourceStat;
+
+static struct {
+    uint64_t values[STAT_COUNT];
+    PhaseStat phases[MAX_PHASES];
+    int phase_count;
+    SourceStat *sources;
+    int source_count;
+    int source_capacity;
+} stats;
+
+static pthread_mutex_t phase_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void stats_add(int stat, uint64_t n) {
+    __atomic_fetch_add(&stats.values[stat], n, __ATOMIC_RELAXED);
+}
+
+void stats_set(int stat, uint64_t value) {
+    __atomic_store_n(&stats.values[stat], value, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_get(int stat) {
+    return __atomic_load_n(&stats.values[stat], __ATOMIC_RELAXED);
+}
+
+// Monotonic clock in seconds, for phase timers
+double stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Record the duration of a phase that began at start (stats_now()). A phase
+// that runs again replaces its previous entry.
+void stats_phase(const char *name, double start, uint64_t items) {
+    double seconds = stats_now() - start;
+    PhaseStat *phase = NULL;
+    pthread_mutex_lock(&phase_lock);
+    for (int i = 0; i < stats.phase_count && !phase; i++) {
+        if (strcmp(stats.phases[i].name, name) == 0) phase = &stats.phases[i];
+    }
+    if (!phase) {
+        if (stats.phase_count >= MAX_PHASES) {
+            pthread_mutex_unlock(&phase_lock);
+            return;
+        }
+        phase = &stats.phases[stats.phase_count++];
+        snprintf(phase->name, sizeof(phase->name), "%s", name);
+    }
+    phase->seconds = seconds;
+    phase->items = items;
+    pthread_mutex_unlock(&phase_lock);
+}
+
+static SourceStat *find_source(const char *type, const char *name) {
+    for (int i = 0; i < stats.source_count; i++) {
+        if (strcmp(stats.sources[i].type, type) == 0 && strcmp(stats.sources[i].name, name) == 0) {
+            return &stats.sources[i];
+        }
+    }
+    return NULL;
+}
+
+// Record the current contribution of one prefix source
+void stats_source(const char *type, const char *name, size_t v4, size_t v6, double fetch_seconds,
+                  int cached, int failed) {
+    SourceStat *source = find_source(type, name);
+    if (!source) {
+        if (stats.source_count >= stats.source_capacity) {
+            int new_capacity = stats.source_capacity ? stats.source_capacity * 2 : 16;
+            SourceStat *new_sources = (SourceStat*)realloc(stats.sources, new_capacity * sizeof(SourceStat));
+            if (!new_sources) {
+                log_errno("Failed to reallocate memory for source stats");
+                exit(EXIT_FAILURE);
+            }
+            stats.sources = new_sources;
+            stats.source_capacity = new_capacity;
+        }
+        source = &stats.sources[stats.source_count++];
+        snprintf(source->type, sizeof(source->type), "%s", type);
+        source->name = strdup(name);
+        if (!source->name) {
+            log_errno("Failed to duplicate source name");
+            exit(EXIT_FAILURE);
+        }
+    }
+    source->v4 = v4;
+    source->v6 = v6;
+    source->fetch_seconds = fetch_seconds;
+    source->cached = cached;
+    source->failed = failed;
+}
+
+void stats_remove_source(const char *type, const char *name) {
+    SourceStat *source = find_source(type, name);
+    if (!source) return;
+    free(source->name);
+    *source = stats.sources[--stats.source_count];
+}
+
+// Write a string with the escapes both Prometheus label values and JSON need
+static void write_escaped(FILE *file, const char *text) {
+    for (const char *p = text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', file);
+            fputc(*p, file);
+        } else if (*p == '\n') {
+            fputs("\\n", file);
+        } else {
+            fputc(*p, file);
+        }
+    }
+}
+
+static void write_prometheus(FILE *file, int success) {
+    fprintf(file, "# HELP ipban_phase_duration_seconds Wall time of the last run of each phase\n");
+    fprintf(file, "# TYPE ipban_phase_duration_seconds gauge\n");
+    for (int i = 0; i < stats.phase_count; i++) {
+        fprintf(file, "ipban_phase_duration_seconds{phase=\"%s\"} %.6f\n", stats.phases[i].name, stats.phases[i].seconds);
+    }
+    fprintf(file, "# HELP ipban_phase_items Prefixes handled in the last run of each phase\n");
+    fprintf(file, "# TYPE ipban_phase_items gauge\n");
+    for (int i = 0; i < stats.phase_count; i++) {
+        fprintf(file, "ipban_phase_items{phase=\"%s\"} %llu\n", stats.phases[i].name,
+                (unsigned long long)stats.phases[i].items);
+    }
+    for (int i = 0; i < STAT_COUNT; i++) {
+        fprintf(file, "# HELP ipban_%s %s\n", stat_info[i].name, stat_info[i].help);
+        fprintf(file, "# TYPE ipban_%s %s\n", stat_info[i].name, stat_info[i].counter ? "counter" : "gauge");
+        fprintf(file, "ipban_%s %llu\n", stat_info[i].name,
+                (unsigned long long)stats_get(i));
+    }
+    fprintf(file, "# HELP ipban_source_prefixes Prefixes contributed by each ASN or feed, or enforced in each namespace\n");
+    fprintf(file, "# TYPE ipban_source_prefixes gauge\n");
+    for (int i = 0; i < stats.source_count; i++) {
+        const SourceStat *source = &stats.sources[i];
+        for (int f = 0; f < 2; f++) {
+            fprintf(file, "ipban_source_prefixes{type=\"%s\",source=\"", source->type);
+            write_escaped(file, source->name);
+            fprintf(file, "\",family=\"%s\"} %llu\n", f == 0 ? "ipv4" : "ipv6",
+                    (unsigned long long)(f == 0 ? source->v4 : source->v6));
+        }
+    }
+    fprintf(file, "# HELP ipban_source_failed Whether the last fetch or read of a source, or the last apply in a namespace, failed\n");
+    fprintf(file, "# TYPE ipban_source_failed gauge\n");
+    for (int i = 0; i < stats.source_count; i++) {
+        fprintf(file, "ipban_source_failed{type=\"%s\",source=\"", stats.sources[i].type);
+        write_escaped(file, stats.sources[i].name);
+        fprintf(file, "\"} %d\n", stats.sources[i].failed);
+    }
+    fprintf(file, "# HELP ipban_asn_fetch_duration_seconds Time spent fetching each ASN (both families)\n");
+    fprintf(file, "# TYPE ipban_asn_fetch_duration_seconds gauge\n");
+    for (int i = 0; i < stats.source_count; i++) {
+        if (strcmp(stats.sources[i].type, "asn") != 0) continue;
+        fprintf(file, "ipban_asn_fetch_duration_seconds{source=\"");
+        write_escaped(file, stats.sources[i].name);
+        fprintf(file, "\"} %.6f\n", stats.sources[i].fetch_seconds);
+    }
+    fprintf(file, "# HELP ipban_last_run_success Whether the last apply succeeded completely\n");
+    fprintf(file, "# TYPE ipban_last_run_success gauge\n");
+    fprintf(file, "ipban_last_run_success %d\n", success);
+    fprintf(file, "# HELP ipban_last_run_timestamp_seconds Unix time of the last apply\n");
+    fprintf(file, "# TYPE ipban_last_run_timestamp_seconds gauge\n");
+    fprintf(file, "ipban_last_run_timestamp_seconds %lld\n", (long long)time(NULL));
+}
+
+static void write_json(FILE *file, int success) {
+    fprintf(file, "{\"timestamp\": %lld, \"success\": %s,\n \"phases\": [", (long long)time(NULL),
+            success ? "true" : "false");
+    for (int i = 0; i < stats.phase_count; i++) {
+        const PhaseStat *phase = &stats.phases[i];
+        fprintf(file, "%s{\"name\": \"%s\", \"seconds\": %.6f, \"items\": %llu, \"items_per_sec\": %.0f}",
+                i ? ", " : "", phase->name, phase->seconds, (unsigned long long)phase->items,
+                phase->seconds > 0 ? phase->items / phase->seconds : 0.0);
+    }
+    fprintf(file, "],\n \"metrics\": {");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        fprintf(file, "%s\"%s\": %llu", i ? ", " : "", stat_info[i].name,
+                (unsigned long long)stats_get(i));
+    }
+    fprintf(file, "},\n \"sources\": [");
+    for (int i = 0; i < stats.source_count; i++) {
+        const SourceStat *source = &stats.sources[i];
+        fprintf(file, "%s{\"type\": \"%s\", \"name\": \"", i ? ",\n  " : "\n  ", source->type);
+        write_escaped(file, source->name);
+        fprintf(file, "\", \"ipv4\": %llu, \"ipv6\": %llu, \"fetch_seconds\": %.6f, \"cached\": %s, \"failed\": %s}",
+                (unsigned long long)source->v4, (unsigned long long)source->v6, source->fetch_seconds,
+                source->cached ? "true" : "false", source->failed ? "true" : "false");
+    }
+    fprintf(file, "]}\n");
+}
+
+// Write to path through a temporary file and rename(), so readers never see a partial file
+static int write_atomically(const char *path, void (*writer)(FILE *, int), int success) {
+    char tmp_path[4200];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        log_errno(tmp_path);
+        return -1;
+    }
+    writer(file, success);
+    int ok = !ferror(file);
+    if (fclose(file) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) < 0) {
+        log_errno("Failed to write stats file");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Write the stats to the configured files (empty paths are skipped).
+// Returns 0, or -1 if a file could not be written.
+int stats_write(const char *textfile, const char *json_file, int success) {
+    int ret = 0;
+    if (textfile && textfile[0] && write_atomically(textfile, write_prometheus, success) == -1) ret = -1;
+    if (json_file && json_file[0] && write_atomically(json_file, write_json, success) == -1) ret = -1;
+    return ret;
+}
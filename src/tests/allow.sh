@@ -0,0 +1,104 @@
+#!/bin/sh
+# [allow] check: programs blocks overlapping allowed prefixes in every way (an
+# allow inside a block, a block inside an allow, equal ones, allows on the edges
+# of a block and next to it) with the route backend in a throwaway network
+# namespace, then asks the kernel (ip route get) and the lookup index
+# (--lookup) about addresses on both sides of every edge. Allowed addresses
+# must not hit a blackhole, the rest of each block must. Run with and without
+# aggregation. Exits 1 on the first mismatch.
+set -eu
+
+here=$(cd "$(dirname "$0")" && pwd)
+ipban=$here/../ipban
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+if unshare -rn true 2>/dev/null; then
+    netns="unshare -rn"
+elif unshare -n true 2>/dev/null; then
+    netns="unshare -n"
+else
+    echo "check: cannot create a network namespace (unshare -rn), giving up" >&2
+    exit 1
+fi
+command -v ip > /dev/null || { echo "check: the ip command is needed" >&2; exit 1; }
+
+# Addresses the blocks below must leave alone
+allowed="
+10.0.5.0 10.0.5.128 10.0.5.255
+10.1.2.0 10.1.2.255
+10.2.1.0
+10.3.0.0 10.3.0.255
+10.4.0.0 10.4.0.255
+10.5.0.128 10.5.0.255 10.5.1.0 10.5.1.255 10.5.255.255
+2001:db8:1:: 2001:db8:1:ffff:ffff:ffff:ffff:ffff
+2001:db8:ffff:ffff:: 2001:db8:ffff:ffff:ffff:ffff:ffff:ffff
+2001:db9:1:: 2001:db9:1:ffff:ffff:ffff:ffff:ffff
+"
+# Addresses right next to them that stay blocked
+blocked="
+10.0.0.0 10.0.4.255 10.0.6.0 10.0.255.255
+10.2.0.0 10.2.0.255
+10.3.0.1 10.3.0.254
+10.5.0.0 10.5.0.127 10.5.2.0 10.5.255.254
+2001:db8:: 2001:db8:0:ffff:ffff:ffff:ffff:ffff 2001:db8:2::
+2001:db8:ffff:fffe:ffff:ffff:ffff:ffff
+"
+
+gen_config() { # aggregate
+    cat <<TOML
+[settings]
+cache_dir = ""
+aggregate = $1
+index_file = "$work/index"
+
+[ipv4_routes]
+routes = ["10.0.0.0/16", "10.1.2.0/24", "10.2.0.0/24", "10.3.0.0/24", "10.4.0.0/24", "10.5.0.0/16"]
+
+[ipv6_routes]
+routes = ["2001:db8::/32", "2001:db9:1::/48"]
+
+[allow]
+routes = [
+    "10.0.5.0/24",                                  # inside a block
+    "10.1.0.0/16",                                  # covers a block
+    "10.2.1.0/24",                                  # next to a block
+    "10.3.0.0/32", "10.3.0.255/32",                 # both edges of a block
+    "10.4.0.0/24",                                  # equal to a block
+    "10.5.0.128/25", "10.5.1.0/24", "10.5.255.255/32",
+    "2001:db8:1::/48", "2001:db8:ffff:ffff::/64",
+    "2001:db9::/32",
+]
+TOML
+}
+
+for aggregate in true false; do
+    gen_config "$aggregate" > "$work/allow.toml"
+    $netns sh -c '
+        "$1" -c "$2/allow.toml" > "$2/apply.log" 2>&1 || exit 1
+        # With default routes every lookup succeeds unless a blackhole matches
+        ip link set lo up && ip route add default dev lo && ip -6 route add default dev lo || exit 1
+        for addr in $3; do
+            ip route get "$addr" > /dev/null 2>&1 || echo "allowed $addr is blackholed"
+        done
+        for addr in $4; do
+            ip route get "$addr" > /dev/null 2>&1 && echo "blocked $addr is not blackholed"
+        done
+        exit 0
+    ' check "$ipban" "$work" "$allowed" "$blocked" > "$work/kernel.out" || {
+        echo "check: ipban failed (aggregate = $aggregate):" >&2
+        cat "$work/apply.log" >&2
+        exit 1
+    }
+    # --lookup answers the [allow] entry for allowed addresses, a block for the others
+    "$ipban" --index "$work/index" --lookup $allowed 2>/dev/null |
+        awk '$3 != "allow:config" { print "lookup: allowed " $1 " matches " $2 " (" $3 ")" }' > "$work/lookup.out"
+    "$ipban" --index "$work/index" --lookup $blocked 2>/dev/null |
+        awk '$2 == "-" || $3 == "allow:config" { print "lookup: blocked " $1 " matches " $2 " (" $3 ")" }' >> "$work/lookup.out"
+    if [ -s "$work/kernel.out" ] || [ -s "$work/lookup.out" ]; then
+        echo "check: [allow] FAILED (aggregate = $aggregate)" >&2
+        cat "$work/kernel.out" "$work/lookup.out" >&2
+        exit 1
+    fi
+    echo "check: [allow] ok (aggregate = $aggregate)" >&2
+done
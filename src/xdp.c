@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>  // For AF_INET/AF_INET6
+#include <linux/bpf.h>
+
+#include "ipban.h"
+
+// --- XDP drop program ---
+//
+// A small XDP program looks up the source address of every IPv4/IPv6 packet in
+// one BPF_MAP_TYPE_LPM_TRIE per family and drops it on a match, before the
+// packet reaches the stack. Each trie entry's value counts the packets dropped
+// for that prefix, and a per-CPU array holds the total. The maps are pinned in
+// bpffs so that later runs update them in place; the program is built here as
+// raw instructions, so neither clang nor libbpf are needed.
+
+#define XDP_MAX_V4 (4U << 20)   // Trie capacity (entries are allocated on use)
+#define XDP_MAX_V6 (1U << 20)
+#define XDP_BATCH 4096          // Entries per batched map update/delete
+#define XDP_LOG_SIZE 65536      // Verifier log kept when the program is rejected
+
+// Key layout of BPF_MAP_TYPE_LPM_TRIE: prefix length, then the address
+typedef struct {
+    uint32_t prefixlen;
+    unsigned char addr[16];
+} XdpKey;
+
+static const char *map_names[3] = { "block_v4", "block_v6", "drops" };
+
+static long sys_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static size_t key_size(int f) {
+    return sizeof(uint32_t) + (f == 0 ? 4 : 16);
+}
+
+// --- Program ---
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define MOV64_REG(d, s)      INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i)      INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD64_IMM(d, i)      INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define LDX(size, d, s, o)   INSN(BPF_LDX | BPF_MEM | (size), d, s, o, 0)
+#define STX(size, d, s, o)   INSN(BPF_STX | BPF_MEM | (size), d, s, o, 0)
+#define ST_IMM(size, d, o, i) INSN(BPF_ST | BPF_MEM | (size), d, 0, o, i)
+#define ATOMIC_ADD64(d, s, o) INSN(BPF_STX | BPF_ATOMIC | BPF_DW, d, s, o, BPF_ADD)
+#define JMP_REG(op, d, s)    INSN(BPF_JMP | (op) | BPF_X, d, s, 0, 0)  // Offset patched in
+#define JMP_IMM(op, d, i)    INSN(BPF_JMP | (op) | BPF_K, d, 0, 0, i)
+#define JA()                 INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0)
+#define CALL(fn)             INSN(BPF_JMP | BPF_CALL, 0, 0, 0, fn)
+#define EXIT()               INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+#define XDP_PROG_MAX 64
+#define XDP_JUMPS_MAX 8
+
+typedef struct {
+    struct bpf_insn insns[XDP_PROG_MAX];
+    int count;
+    int pass[XDP_JUMPS_MAX];   // Jumps to the XDP_PASS exit
+    int pass_count;
+} XdpProg;
+
+static int emit(XdpProg *prog, struct bpf_insn insn) {
+    prog->insns[prog->count] = insn;
+    return prog->count++;
+}
+
+// Jump emitted at idx lands on the next instruction emitted
+static void land(XdpProg *prog, int idx) {
+    prog->insns[idx].off = (short)(prog->count - idx - 1);
+}
+
+static void emit_pass_jump(XdpProg *prog, struct bpf_insn insn) {
+    prog->pass[prog->pass_count++] = emit(prog, insn);
+}
+
+// r1 = map fd (a two-instruction load the kernel resolves to the map)
+static void emit_map_fd(XdpProg *prog, int fd) {
+    emit(prog, INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, fd));
+    emit(prog, INSN(0, 0, 0, 0, 0));
+}
+
+// Packet offsets: Ethernet header 14 bytes, IPv4 source at 14 + 12, IPv6 source at 14 + 8
+static void build_prog(XdpProg *prog, const XdpState *xdp) {
+    memset(prog, 0, sizeof(*prog));
+    emit(prog, LDX(BPF_W, BPF_REG_2, BPF_REG_1, 0));          // r2 = ctx->data
+    emit(prog, LDX(BPF_W, BPF_REG_3, BPF_REG_1, 4));          // r3 = ctx->data_end
+    emit(prog, MOV64_REG(BPF_REG_4, BPF_REG_2));
+    emit(prog, ADD64_IMM(BPF_REG_4, 14));
+    emit_pass_jump(prog, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3));
+    emit(prog, LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12));         // EtherType, in network order
+    int to_v6 = emit(prog, JMP_IMM(BPF_JEQ, BPF_REG_5, htons(0x86dd)));
+    emit_pass_jump(prog, JMP_IMM(BPF_JNE, BPF_REG_5, htons(0x0800)));
+
+    // IPv4: key = { 32, saddr } at fp-8
+    emit(prog, ADD64_IMM(BPF_REG_4, 20));
+    emit_pass_jump(prog, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3));
+    emit(prog, ST_IMM(BPF_W, BPF_REG_10, -8, 32));
+    emit(prog, LDX(BPF_W, BPF_REG_5, BPF_REG_2, 26));
+    emit(prog, STX(BPF_W, BPF_REG_10, BPF_REG_5, -4));
+    emit_map_fd(prog, xdp->map_fd[0]);
+    emit(prog, MOV64_REG(BPF_REG_2, BPF_REG_10));
+    emit(prog, ADD64_IMM(BPF_REG_2, -8));
+    emit(prog, CALL(BPF_FUNC_map_lookup_elem));
+    int to_hit = emit(prog, JA());
+
+    // IPv6: key = { 128, saddr } at fp-20
+    land(prog, to_v6);
+    emit(prog, ADD64_IMM(BPF_REG_4, 40));
+    emit_pass_jump(prog, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3));
+    emit(prog, ST_IMM(BPF_W, BPF_REG_10, -20, 128));
+    for (int i = 0; i < 4; i++) {
+        emit(prog, LDX(BPF_W, BPF_REG_5, BPF_REG_2, 22 + 4 * i));
+        emit(prog, STX(BPF_W, BPF_REG_10, BPF_REG_5, -16 + 4 * i));
+    }
+    emit_map_fd(prog, xdp->map_fd[1]);
+    emit(prog, MOV64_REG(BPF_REG_2, BPF_REG_10));
+    emit(prog, ADD64_IMM(BPF_REG_2, -20));
+    emit(prog, CALL(BPF_FUNC_map_lookup_elem));
+
+    // Matched: count per prefix (shared, atomic) and per CPU, then drop
+    land(prog, to_hit);
+    emit_pass_jump(prog, JMP_IMM(BPF_JEQ, BPF_REG_0, 0));
+    emit(prog, MOV64_IMM(BPF_REG_1, 1));
+    emit(prog, ATOMIC_ADD64(BPF_REG_0, BPF_REG_1, 0));
+    emit(prog, ST_IMM(BPF_W, BPF_REG_10, -24, 0));
+    emit_map_fd(prog, xdp->drops_fd);
+    emit(prog, MOV64_REG(BPF_REG_2, BPF_REG_10));
+    emit(prog, ADD64_IMM(BPF_REG_2, -24));
+    emit(prog, CALL(BPF_FUNC_map_lookup_elem));
+    int to_drop = emit(prog, JMP_IMM(BPF_JEQ, BPF_REG_0, 0));
+    emit(prog, LDX(BPF_DW, BPF_REG_1, BPF_REG_0, 0));
+    emit(prog, ADD64_IMM(BPF_REG_1, 1));
+    emit(prog, STX(BPF_DW, BPF_REG_0, BPF_REG_1, 0));
+    land(prog, to_drop);
+    emit(prog, MOV64_IMM(BPF_REG_0, XDP_DROP));
+    emit(prog, EXIT());
+
+    for (int i = 0; i < prog->pass_count; i++) land(prog, prog->pass[i]);
+    emit(prog, MOV64_IMM(BPF_REG_0, XDP_PASS));
+    emit(prog, EXIT());
+}
+
+static int load_prog(XdpState *xdp) {
+    XdpProg prog;
+    build_prog(&prog, xdp);
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)prog.insns;
+    attr.insn_cnt = (uint32_t)prog.count;
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    snprintf(attr.prog_name, sizeof(attr.prog_name), "ipban_drop");
+    xdp->prog_fd = (int)sys_bpf(BPF_PROG_LOAD, &attr);
+    if (xdp->prog_fd >= 0) return 0;
+    log_errno("Failed to load the XDP program");
+
+    // Load it again with the verifier log to say why
+    char *log = (char*)calloc(1, XDP_LOG_SIZE);
+    if (!log) {
+        log_errno("Failed to allocate memory for the verifier log");
+        exit(EXIT_FAILURE);
+    }
+    attr.log_buf = (uint64_t)(uintptr_t)log;
+    attr.log_size = XDP_LOG_SIZE;
+    attr.log_level = 1;
+    int fd = (int)sys_bpf(BPF_PROG_LOAD, &attr);
+    if (fd >= 0) close(fd);
+    if (log[0]) log_error("Verifier log:\n%s\n", log);
+    free(log);
+    return -1;
+}
+
+// --- Maps ---
+
+// Open the pinned map at path if it has the expected layout. Returns the fd, or
+// -1 if there is none (or an incompatible one, which is reported).
+static int get_pinned_map(const char *path, uint32_t type, uint32_t key_len, uint32_t value_len) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uint64_t)(uintptr_t)path;
+    int fd = (int)sys_bpf(BPF_OBJ_GET, &attr);
+    if (fd < 0) return -1;
+
+    struct bpf_map_info info;
+    memset(&info, 0, sizeof(info));
+    memset(&attr, 0, sizeof(attr));
+    attr.info.bpf_fd = (uint32_t)fd;
+    attr.info.info_len = sizeof(info);
+    attr.info.info = (uint64_t)(uintptr_t)&info;
+    if (sys_bpf(BPF_OBJ_GET_INFO_BY_FD, &attr) < 0 || info.type != type ||
+        info.key_size != key_len || info.value_size != value_len) {
+        log_warn("Pinned map %s has an unexpected layout, creating a new one.\n", path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+static int create_map(const char *name, uint32_t type, uint32_t key_len, uint32_t value_len,
+                      uint32_t max_entries, uint32_t flags) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_len;
+    attr.value_size = value_len;
+    attr.max_entries = max_entries;
+    attr.map_flags = flags;
+    snprintf(attr.map_name, sizeof(attr.map_name), "%s", name);
+    int fd = (int)sys_bpf(BPF_MAP_CREATE, &attr);
+    if (fd < 0) {
+        char error_buf[128];
+        snprintf(error_buf, sizeof(error_buf), "Failed to create BPF map %s", name);
+        log_errno(error_buf);
+    }
+    return fd;
+}
+
+static void pin(int fd, const char *path) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uint64_t)(uintptr_t)path;
+    attr.bpf_fd = (uint32_t)fd;
+    if (sys_bpf(BPF_OBJ_PIN, &attr) < 0) {
+        log_warn("Cannot pin %s (the next run will reload the full set): %s\n", path, strerror(errno));
+    }
+}
+
+// Number of possible CPUs, the stride of per-CPU map values
+static int possible_cpus(void) {
+    FILE *file = fopen("/sys/devices/system/cpu/possible", "r");
+    int first = 0, last = -1;
+    if (file) {
+        // "0-7", "0" or lists such as "0-3,8-11": the highest number counts
+        char text[256];
+        if (fgets(text, sizeof(text), file)) {
+            for (char *p = text; *p; ) {
+                char *end;
+                long n = strtol(p, &end, 10);
+                if (end == p) {
+                    p++;
+                    continue;
+                }
+                if (n > last) last = (int)n;
+                p = end;
+            }
+        }
+        fclose(file);
+    }
+    if (last < first) last = (int)sysconf(_SC_NPROCESSORS_CONF) - 1;
+    return last + 1;
+}
+
+int xdp_open(XdpState *xdp, const char *pin_dir) {
+    memset(xdp, 0, sizeof(*xdp));
+    xdp->map_fd[0] = xdp->map_fd[1] = xdp->drops_fd = xdp->prog_fd = -1;
+    xdp->cpus = possible_cpus();
+    if (mkdir(pin_dir, 0700) == -1 && errno != EEXIST) {
+        log_warn("Cannot create %s (is bpffs mounted?): %s\n", pin_dir, strerror(errno));
+    }
+
+    for (int m = 0; m < 3; m++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", pin_dir, map_names[m]);
+        uint32_t type = m < 2 ? BPF_MAP_TYPE_LPM_TRIE : BPF_MAP_TYPE_PERCPU_ARRAY;
+        uint32_t key_len = m < 2 ? (uint32_t)key_size(m) : sizeof(uint32_t);
+        int fd = get_pinned_map(path, type, key_len, sizeof(uint64_t));
+        if (fd < 0) {
+            fd = m < 2 ? create_map(map_names[m], type, key_len, sizeof(uint64_t), m == 0 ? XDP_MAX_V4 : XDP_MAX_V6,
+                                    BPF_F_NO_PREALLOC)
+                       : create_map(map_names[m], type, key_len, sizeof(uint64_t), 1, 0);
+            if (fd < 0) {
+                xdp_close(xdp);
+                return -1;
+            }
+            pin(fd, path);
+        }
+        if (m < 2) xdp->map_fd[m] = fd;
+        else xdp->drops_fd = fd;
+    }
+    if (load_prog(xdp) == -1) {
+        xdp_close(xdp);
+        return -1;
+    }
+    return 0;
+}
+
+void xdp_close(XdpState *xdp) {
+    for (int f = 0; f < 2; f++) {
+        if (xdp->map_fd[f] >= 0) close(xdp->map_fd[f]);
+        xdp->map_fd[f] = -1;
+    }
+    if (xdp->drops_fd >= 0) close(xdp->drops_fd);
+    if (xdp->prog_fd >= 0) close(xdp->prog_fd);
+    xdp->drops_fd = xdp->prog_fd = -1;
+}
+
+// --- Map contents ---
+
+static void to_key(const Prefix *prefix, XdpKey *key) {
+    key->prefixlen = prefix->len;
+    memcpy(key->addr, prefix->addr, prefix->family == AF_INET ? 4 : 16);
+}
+
+int xdp_dump(XdpState *xdp, int family, PrefixList *out) {
+    int f = family == AF_INET ? 0 : 1;
+    XdpKey key, next;
+    union bpf_attr attr;
+    int first = 1;
+    for (;;) {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)xdp->map_fd[f];
+        attr.key = first ? 0 : (uint64_t)(uintptr_t)&key; // NULL key = first entry
+        attr.next_key = (uint64_t)(uintptr_t)&next;
+        if (sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr) < 0) {
+            if (errno == ENOENT) return 0;
+            log_errno("Failed to read the XDP prefix map");
+            return -1;
+        }
+        Prefix prefix;
+        memset(&prefix, 0, sizeof(prefix));
+        prefix.family = (unsigned char)family;
+        prefix.len = (unsigned char)next.prefixlen;
+        memcpy(prefix.addr, next.addr, f == 0 ? 4 : 16);
+        prefix_list_push(out, &prefix);
+        key = next;
+        first = 0;
+    }
+}
+
+// One element at a time: exact per-prefix results
+static void update_single(XdpState *xdp, int f, int add, const unsigned char *keys, size_t count, NlResult *result) {
+    size_t stride = key_size(f);
+    uint64_t zero = 0;
+    for (size_t i = 0; i < count; i++) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)xdp->map_fd[f];
+        attr.key = (uint64_t)(uintptr_t)(keys + i * stride);
+        if (add) {
+            attr.value = (uint64_t)(uintptr_t)&zero;
+            attr.flags = BPF_NOEXIST; // Keep the counter of a prefix that is already there
+        }
+        if (sys_bpf(add ? BPF_MAP_UPDATE_ELEM : BPF_MAP_DELETE_ELEM, &attr) == 0) {
+            result->ok++;
+        } else if (add && errno == EEXIST) {
+            result->exists++;
+        } else if (!add && errno == ENOENT) {
+            result->absent++;
+        } else {
+            result->failed++;
+            if (result->failed == 1) log_errno(add ? "Failed to add XDP prefix" : "Failed to delete XDP prefix");
+        }
+    }
+}
+
+int xdp_update(XdpState *xdp, int add, int absent, const Prefix *prefixes, size_t count, NlResult *result) {
+    if (count == 0) return 0;
+    int f = prefixes[0].family == AF_INET ? 0 : 1;
+    size_t stride = key_size(f);
+    unsigned char *keys = (unsigned char*)malloc(XDP_BATCH * stride);
+    uint64_t *values = (uint64_t*)calloc(XDP_BATCH, sizeof(uint64_t));
+    if (!keys || !values) {
+        log_errno("Failed to allocate memory for XDP map updates");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t start = 0; start < count; start += XDP_BATCH) {
+        size_t n = count - start < XDP_BATCH ? count - start : XDP_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            XdpKey key;
+            to_key(&prefixes[start + i], &key);
+            memcpy(keys + i * stride, &key, stride);
+        }
+        size_t done = 0;
+        // Batch updates overwrite (elem_flags take no BPF_NOEXIST) and would
+        // reset the counter of a prefix already there: batch only prefixes
+        // known to be missing
+        while (done < n && !xdp->no_batch && (!add || absent)) {
+            union bpf_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.batch.map_fd = (uint32_t)xdp->map_fd[f];
+            attr.batch.keys = (uint64_t)(uintptr_t)(keys + done * stride);
+            attr.batch.values = (uint64_t)(uintptr_t)values;
+            attr.batch.count = (uint32_t)(n - done);
+            long ret = sys_bpf(add ? BPF_MAP_UPDATE_BATCH : BPF_MAP_DELETE_BATCH, &attr);
+            if (ret == 0) {
+                result->ok += n - done;
+                done = n;
+                break;
+            }
+            // Older kernels lack batch operations for tries, and a call rejected
+            // as a whole may leave the count untouched; otherwise the count says
+            // how far it got
+            if (attr.batch.count >= n - done ||
+                (attr.batch.count == 0 &&
+                 (errno == EINVAL || errno == ENOTSUP || errno == EOPNOTSUPP || errno == 524))) {
+                xdp->no_batch = 1;
+                break;
+            }
+            done += attr.batch.count;
+            result->ok += attr.batch.count;
+            // The element the batch stopped at on its own, which tells an absent
+            // prefix apart from a real error, then on with the batch
+            update_single(xdp, f, add, keys + done * stride, 1, result);
+            done++;
+        }
+        // Without batching, one by one
+        update_single(xdp, f, add, keys + done * stride, n - done, result);
+    }
+    free(keys);
+    free(values);
+    return result->failed > 0 ? -1 : 0;
+}
+
+uint64_t xdp_dropped(const XdpState *xdp) {
+    uint64_t *values = (uint64_t*)calloc(xdp->cpus, sizeof(uint64_t));
+    if (!values) {
+        log_errno("Failed to allocate memory for XDP counters");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t key = 0;
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)xdp->drops_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)values;
+    uint64_t total = 0;
+    if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) == 0) {
+        for (int i = 0; i < xdp->cpus; i++) total += values[i];
+    }
+    free(values);
+    return total;
+}